@@ -3,6 +3,10 @@ class MetaData:
         # initialize the prefix variable
         self.prefix = prefix
 
+        # blocks of a larger dataset have an origin and a core in that dataset
+        self.block_origin = None
+        self.block_core = None
+
         # open the meta data txt file
         filename = 'meta/{}.meta'.format(prefix)
         with open(filename, 'r') as fd:
@@ -24,6 +28,16 @@ class MetaData:
                     # read the grid size in x, y, z order
                     samples = value.split('x')
                     self.grid_size = (int(samples[2]), int(samples[1]), int(samples[0]))
+                elif comment == '# block origin':
+                    # the first voxel of the block (with halo) in x, y, z order
+                    samples = value.split('x')
+                    self.block_origin = (int(samples[2]), int(samples[1]), int(samples[0]))
+                elif comment == '# block core':
+                    # the minimum (inclusive) and maximum (exclusive) voxels that this block owns in x, y, z order
+                    minimum, maximum = value.split()
+                    minimum = minimum.split('x')
+                    maximum = maximum.split('x')
+                    self.block_core = (int(minimum[2]), int(minimum[1]), int(minimum[0]), int(maximum[2]), int(maximum[1]), int(maximum[0]))
 
     def GridSize(self):
         return self.grid_size
@@ -31,5 +45,11 @@ class MetaData:
     def Resolution(self):
         return self.resolution
 
+    def BlockOrigin(self):
+        return self.block_origin
+
+    def BlockCore(self):
+        return self.block_core
+
     def SegmentationFilename(self):
         return self.segmentation_filename.split()[0], self.segmentation_filename.split()[1]
@@ -1,6 +1,6 @@
 from topological_thinning.utilities.dataIO import ReadSegmentationData
 from topological_thinning.transforms.seg2seg import DownsampleMapping
-from topological_thinning.skeletonization.generate_skeletons import TopologicalThinning, FindEndpointVectors
+from topological_thinning.skeletonization.generate_skeletons import TopologicalThinning, FindEndpointVectors, DensifySkeletons
 
 
 
@@ -19,4 +19,7 @@ DownsampleMapping(prefix, seg)
 
 # call topological thinning function
 TopologicalThinning(prefix, seg)
-FindEndpointVectors(prefix)
\ No newline at end of file
+FindEndpointVectors(prefix)
+
+# connect the upsampled joints at full resolution
+DensifySkeletons(prefix, seg)
\ No newline at end of file
@@ -0,0 +1,32 @@
+import sys
+
+
+
+from topological_thinning.utilities.dataIO import NumberOfBlocks
+from topological_thinning.skeletonization.generate_skeletons import SkeletonizeBlock, StitchBlocks
+
+
+
+# each dataset is referenced by a unique identifier
+# the unique identifer corresponds to a file in meta/{PREFIX}.meta
+# that shows locations of various files and gives data attributes
+prefix = 'SNEMI3D'
+
+# every block owns block_size voxels and reads halo voxels of context on every side (z, y, x)
+block_size = (50, 512, 512)
+halo = (12, 64, 64)
+
+
+
+# blocks are independent so they can be split across nodes (python generate_skeleton_blocks.py {NODE} {NNODES})
+if len(sys.argv) == 3: node, nnodes = int(sys.argv[1]), int(sys.argv[2])
+else: node, nnodes = 0, 1
+
+nblocks = NumberOfBlocks(prefix, block_size)
+block_indices = [(iz, iy, ix) for iz in range(nblocks[0]) for iy in range(nblocks[1]) for ix in range(nblocks[2])]
+
+for block_index in block_indices[node::nnodes]:
+    SkeletonizeBlock(prefix, block_index, block_size, halo)
+
+# stitch the skeleton fragments into one skeleton per label (with several nodes, once all of them finish)
+if nnodes == 1: StitchBlocks(prefix, block_size)
@@ -0,0 +1,254 @@
+/* c++ file to skeletonize every label at its own resolution */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "cpp-generate_skeletons.h"
+#include "cpp-pipeline.h"
+#include "cpp-storage.h"
+
+
+
+// a label at its chosen resolution passed between the pipeline stages
+struct AdaptiveSkeleton {
+    int64_t label;
+    int64_t resolution;
+    std::vector<int64_t> down_elements;
+    std::vector<int64_t> up_elements;
+    std::vector<int64_t> skeleton;
+    std::vector<int64_t> up_endpoints;
+    std::vector<double> vectors;
+};
+
+
+
+// downsampled and upsampled files of one of the candidate resolutions
+typedef struct {
+    int64_t skeleton_resolution[3];
+    int64_t grid_size[3];
+    char downsample_filename[4096];
+    char upsample_filename[4096];
+    FILE *dfp;
+    FILE *ufp;
+    std::vector<int64_t> nelements;
+    std::vector<int64_t> bounding_boxes;
+    std::vector<int64_t> label_offsets;
+} ResolutionLevel;
+
+
+
+static bool OpenResolutionLevel(const char *prefix, ResolutionLevel &level, int64_t &max_label, int64_t up_grid_size[3])
+{
+    int64_t *skeleton_resolution = level.skeleton_resolution;
+    sprintf(level.downsample_filename, "skeletons/%s/downsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+    sprintf(level.upsample_filename, "skeletons/%s/upsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    level.dfp = CppOpenArtifact(level.downsample_filename, "rb");
+    if (!level.dfp) { fprintf(stderr, "Failed to read %s\n", level.downsample_filename); return false; }
+
+    level.ufp = CppOpenArtifact(level.upsample_filename, "rb");
+    if (!level.ufp) { fprintf(stderr, "Failed to read %s\n", level.upsample_filename); return false; }
+
+    int64_t down_max_label, up_max_label;
+    if (!CppReadSkeletonHeader(level.dfp, level.grid_size, &down_max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", level.downsample_filename); return false; }
+    if (!CppReadSkeletonHeader(level.ufp, up_grid_size, &up_max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", level.upsample_filename); return false; }
+    if (down_max_label != up_max_label) { fprintf(stderr, "Labels of %s do not match %s\n", level.downsample_filename, level.upsample_filename); return false; }
+
+    // every resolution comes from the same segmentation
+    if (max_label >= 0 && max_label != down_max_label) { fprintf(stderr, "Labels of %s do not match the other resolutions\n", level.downsample_filename); return false; }
+    max_label = down_max_label;
+
+    // the manifest gives the size of every label at this resolution and its location in both files
+    if (!CppReadLabelManifest(prefix, skeleton_resolution, max_label, level.nelements, level.bounding_boxes)) {
+        char manifest_filename[4096];
+        sprintf(manifest_filename, "skeletons/%s/manifest-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+        fprintf(stderr, "Failed to read %s\n", manifest_filename);
+        return false;
+    }
+
+    level.label_offsets.resize(max_label);
+    int64_t offset = 4 * sizeof(int64_t);
+    for (int64_t label = 0; label < max_label; ++label) {
+        level.label_offsets[label] = offset;
+        offset += (1 + level.nelements[label]) * sizeof(int64_t);
+    }
+
+    return true;
+}
+
+
+
+int CppAdaptiveTopologicalThinning(const char *prefix, int64_t *skeleton_resolutions, int64_t nskeleton_resolutions, int64_t label_voxel_budget, const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget)
+{
+    // initialize all of the lookup tables
+    ThinningContext *context = CppNewThinningContext(lookup_table_directory);
+    if (!context) return 0;
+
+    // resolutions go from finest to coarsest
+    int64_t max_label = -1;
+    int64_t up_grid_size[3];
+    std::vector<ResolutionLevel> levels = std::vector<ResolutionLevel>(nskeleton_resolutions);
+    FILE *sfp = NULL, *vfp = NULL, *rfp = NULL;
+    std::vector<ThinningContext *> workers;
+
+    // every error path closes the files opened so far and frees the contexts
+    std::function<int()> fail = [&]() {
+        for (int64_t ir = 0; ir < nskeleton_resolutions; ++ir) {
+            if (levels[ir].dfp) fclose(levels[ir].dfp);
+            if (levels[ir].ufp) fclose(levels[ir].ufp);
+        }
+        if (sfp) CppDiscardArtifact(sfp);
+        if (vfp) CppDiscardArtifact(vfp);
+        if (rfp) CppDiscardArtifact(rfp);
+        for (uint64_t thread = 0; thread < workers.size(); ++thread)
+            CppDeleteThinningContext(workers[thread]);
+        CppDeleteThinningContext(context);
+        return 0;
+    };
+
+    for (int64_t ir = 0; ir < nskeleton_resolutions; ++ir) {
+        levels[ir].skeleton_resolution[IB_Z] = skeleton_resolutions[3 * ir + IB_Z];
+        levels[ir].skeleton_resolution[IB_Y] = skeleton_resolutions[3 * ir + IB_Y];
+        levels[ir].skeleton_resolution[IB_X] = skeleton_resolutions[3 * ir + IB_X];
+        levels[ir].dfp = NULL;
+        levels[ir].ufp = NULL;
+    }
+
+    for (int64_t ir = 0; ir < nskeleton_resolutions; ++ir)
+        if (!OpenResolutionLevel(prefix, levels[ir], max_label, up_grid_size)) return fail();
+
+    // each label uses the finest resolution within the voxel budget (or the coarsest one)
+    std::vector<int64_t> label_resolutions = std::vector<int64_t>(max_label);
+    std::vector<int64_t> memory_costs = std::vector<int64_t>(max_label);
+    std::vector<int64_t> order = std::vector<int64_t>(max_label);
+    for (int64_t label = 0; label < max_label; ++label) {
+        int64_t ir = 0;
+        while (ir < nskeleton_resolutions - 1 && levels[ir].nelements[label] > label_voxel_budget) ++ir;
+        label_resolutions[label] = ir;
+
+        // the upsampled elements are held alongside the thinning volume
+        int64_t nelements = levels[ir].nelements[label];
+        memory_costs[label] = CppThinningMemoryCost(nelements, &(levels[ir].bounding_boxes[6 * label]), false) + nelements * sizeof(int64_t);
+        order[label] = label;
+    }
+
+    // thin the largest labels first so that no single large label is left running alone at the end
+    std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b) { return levels[label_resolutions[a]].nelements[a] > levels[label_resolutions[b]].nelements[b]; });
+
+    // open the output files
+    char skeleton_filename[4096];
+    sprintf(skeleton_filename, "skeletons/%s/thinning-adaptive-upsample-skeleton.pts", prefix);
+
+    char vectors_filename[4096];
+    sprintf(vectors_filename, "skeletons/%s/thinning-adaptive-endpoint-vectors.vec", prefix);
+
+    char resolutions_filename[4096];
+    sprintf(resolutions_filename, "skeletons/%s/thinning-adaptive-resolutions.bytes", prefix);
+
+    sfp = CppOpenArtifact(skeleton_filename, "wb");
+    if (!sfp) { fprintf(stderr, "Failed to write to %s\n", skeleton_filename); return fail(); }
+
+    vfp = CppOpenArtifact(vectors_filename, "wb");
+    if (!vfp) { fprintf(stderr, "Failed to write to %s\n", vectors_filename); return fail(); }
+
+    rfp = CppOpenArtifact(resolutions_filename, "wb");
+    if (!rfp) { fprintf(stderr, "Failed to write to %s\n", resolutions_filename); return fail(); }
+
+    if (!CppWriteSkeletonHeader(sfp, up_grid_size, max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to write to %s\n", skeleton_filename); return fail(); }
+    if (!CppWriteSkeletonHeader(vfp, up_grid_size, max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to write to %s\n", vectors_filename); return fail(); }
+    if (!CppWriteSkeletonHeader(rfp, up_grid_size, max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to write to %s\n", resolutions_filename); return fail(); }
+
+    // every worker gets its own working volume
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    workers = std::vector<ThinningContext *>(num_threads);
+    for (int64_t thread = 0; thread < num_threads; ++thread)
+        workers[thread] = CppNewWorkerThinningContext(context);
+
+    std::function<bool(int64_t, AdaptiveSkeleton &)> read = [&](int64_t label, AdaptiveSkeleton &item) {
+        ResolutionLevel &level = levels[label_resolutions[label]];
+        int64_t nelements = level.nelements[label];
+
+        item.label = label;
+        item.resolution = label_resolutions[label];
+        item.down_elements.resize(nelements);
+        item.up_elements.resize(nelements);
+
+        // the downsampled and upsampled files have the same number of elements for every label
+        if (fseek(level.dfp, level.label_offsets[label] + sizeof(int64_t), SEEK_SET)) { fprintf(stderr, "Failed to read %s\n", level.downsample_filename); return false; }
+        if (fread(item.down_elements.data(), sizeof(int64_t), nelements, level.dfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to read %s\n", level.downsample_filename); return false; }
+        if (fseek(level.ufp, level.label_offsets[label] + sizeof(int64_t), SEEK_SET)) { fprintf(stderr, "Failed to read %s\n", level.upsample_filename); return false; }
+        if (fread(item.up_elements.data(), sizeof(int64_t), nelements, level.ufp) != (uint64_t)nelements) { fprintf(stderr, "Failed to read %s\n", level.upsample_filename); return false; }
+
+        return true;
+    };
+
+    std::function<void(int64_t, AdaptiveSkeleton &)> process = [&](int64_t thread, AdaptiveSkeleton &item) {
+        ResolutionLevel &level = levels[item.resolution];
+
+        // thin this label on the grid of its resolution
+        CppSetThinningGridSize(workers[thread], level.grid_size);
+        item.skeleton.resize(item.down_elements.size());
+        int64_t nskeleton = CppThinSegment(workers[thread], item.down_elements.data(), item.down_elements.size(), item.skeleton.data());
+        item.skeleton.resize(nskeleton);
+
+        // find the endpoint vectors and upsample the skeleton (endpoints remain negative)
+        CppUpsampleLabelSkeleton(level.grid_size, item.down_elements, item.up_elements, item.skeleton, item.up_endpoints, item.vectors);
+
+        // only the outputs wait for the writer
+        std::vector<int64_t>().swap(item.down_elements);
+        std::vector<int64_t>().swap(item.up_elements);
+    };
+
+    std::function<bool(AdaptiveSkeleton &)> write = [&](AdaptiveSkeleton &item) {
+        int64_t nskeleton = item.skeleton.size();
+        if (fwrite(&nskeleton, sizeof(int64_t), 1, sfp) != 1) { fprintf(stderr, "Failed to write to %s\n", skeleton_filename); return false; }
+        if (fwrite(item.skeleton.data(), sizeof(int64_t), nskeleton, sfp) != (uint64_t)nskeleton) { fprintf(stderr, "Failed to write to %s\n", skeleton_filename); return false; }
+
+        int64_t nendpoints = item.up_endpoints.size();
+        if (fwrite(&nendpoints, sizeof(int64_t), 1, vfp) != 1) { fprintf(stderr, "Failed to write to %s\n", vectors_filename); return false; }
+        for (int64_t ie = 0; ie < nendpoints; ++ie) {
+            if (fwrite(&(item.up_endpoints[ie]), sizeof(int64_t), 1, vfp) != 1) { fprintf(stderr, "Failed to write to %s\n", vectors_filename); return false; }
+            if (fwrite(&(item.vectors[3 * ie]), sizeof(double), 3, vfp) != 3) { fprintf(stderr, "Failed to write to %s\n", vectors_filename); return false; }
+        }
+
+        // the resolution of every label (z, y, x) so that the endpoint vectors can be interpreted
+        if (fwrite(levels[item.resolution].skeleton_resolution, sizeof(int64_t), 3, rfp) != 3) { fprintf(stderr, "Failed to write to %s\n", resolutions_filename); return false; }
+
+        return true;
+    };
+
+    std::function<int64_t(AdaptiveSkeleton &)> result_bytes = [&](AdaptiveSkeleton &item) {
+        return (int64_t) ((item.skeleton.capacity() + item.up_endpoints.capacity()) * sizeof(int64_t) + item.vectors.capacity() * sizeof(double));
+    };
+
+    if (!RunScheduledPipeline(order, memory_costs, memory_budget, num_threads, read, process, write, result_bytes)) return fail();
+
+    // close the I/O files
+    for (int64_t ir = 0; ir < nskeleton_resolutions; ++ir) {
+        fclose(levels[ir].dfp);
+        fclose(levels[ir].ufp);
+        levels[ir].dfp = levels[ir].ufp = NULL;
+    }
+
+    int closed = !fclose(sfp);
+    sfp = NULL;
+    if (!closed) { fprintf(stderr, "Failed to write to %s\n", skeleton_filename); return fail(); }
+
+    closed = !fclose(vfp);
+    vfp = NULL;
+    if (!closed) { fprintf(stderr, "Failed to write to %s\n", vectors_filename); return fail(); }
+
+    closed = !fclose(rfp);
+    rfp = NULL;
+    if (!closed) { fprintf(stderr, "Failed to write to %s\n", resolutions_filename); return fail(); }
+
+    for (int64_t thread = 0; thread < num_threads; ++thread)
+        CppDeleteThinningContext(workers[thread]);
+    CppDeleteThinningContext(context);
+
+    return 1;
+}
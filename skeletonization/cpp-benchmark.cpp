@@ -0,0 +1,495 @@
+/* c++ executable that times every native stage on synthetic segmentations */
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "cpp-generate_skeletons.h"
+#include "cpp-perf.h"
+#include "cpp-storage.h"
+#include "cpp-synthetic.h"
+#include "../transforms/cpp-seg2seg.h"
+
+
+
+// every case is generated with the same seed and resolutions so that its outputs can be compared with the stored
+// checksums (the segmentation is 20 nm isotropic and thinned at 80 nm)
+static const char *const benchmark_shapes[] = { "tubes", "trees", "sheets", "blobs", "dense", "heavy-tailed", "sparse-ids" };
+static const int64_t nbenchmark_shapes = 7;
+static const uint64_t benchmark_seed = 1;
+static float benchmark_input_resolution[3] = { 20, 20, 20 };
+static int64_t benchmark_skeleton_resolution[3] = { 80, 80, 80 };
+
+
+
+static void Usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [options]\n", program);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --shapes LIST             comma separated shapes (default: tubes,trees,sheets,blobs,dense,heavy-tailed,sparse-ids)\n");
+    fprintf(stderr, "  --sizes LIST              comma separated edge lengths in voxels (default: 64,128,256)\n");
+    fprintf(stderr, "  --warmup N                untimed runs of every stage (default: 1)\n");
+    fprintf(stderr, "  --repetitions N           timed runs of every stage (default: 3)\n");
+    fprintf(stderr, "  --threads N               threads for generation and thinning, all cores if zero (default: 0)\n");
+    fprintf(stderr, "  --slab-depth N            z slices downsampled at once (default: 16)\n");
+    fprintf(stderr, "  --output DIRECTORY        outputs are written to DIRECTORY/skeletons/SHAPE-SIZE (default: benchmark-data)\n");
+    fprintf(stderr, "  --results FILE            results are appended as json lines (default: benchmark-results.jsonl)\n");
+    fprintf(stderr, "  --checksums FILE          stored checksums (default: benchmark-checksums.txt next to the executable)\n");
+    fprintf(stderr, "  --record-checksums        store the checksums of these runs instead of verifying them\n");
+    fprintf(stderr, "  --morton                  thin in a working volume of z-order bricks (stages after downsampling get a -morton suffix)\n");
+    fprintf(stderr, "  --container               write the outputs of every case into the single file skeletons/SHAPE-SIZE.container\n");
+    fprintf(stderr, "  --lookup-tables DIRECTORY directory of lut_simple.dat and lut_isthmus.dat (default: next to the executable)\n");
+}
+
+
+
+static bool ParseList(const char *argument, std::vector<std::string> &items)
+{
+    items.clear();
+
+    std::string list(argument);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        if (end == start) return false;
+
+        items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+
+    return true;
+}
+
+
+
+static bool MakeDirectory(const char *directory)
+{
+    if (!mkdir(directory, 0777) || errno == EEXIST) return true;
+
+    fprintf(stderr, "Failed to create %s\n", directory);
+    return false;
+}
+
+
+
+static std::string AbsolutePath(const char *filename)
+{
+    if (filename[0] == '/') return filename;
+
+    char directory[PATH_MAX];
+    if (!getcwd(directory, PATH_MAX)) return filename;
+
+    return std::string(directory) + "/" + filename;
+}
+
+
+
+static double ElapsedSeconds(std::chrono::steady_clock::time_point start_time)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+
+
+// 64 bit fnv-1a over the bytes of the outputs
+static const uint64_t fnv_offset = 0xcbf29ce484222325ULL;
+static const uint64_t fnv_prime = 0x100000001b3ULL;
+
+static uint64_t HashBytes(uint64_t hash, const unsigned char *bytes, int64_t nbytes)
+{
+    for (int64_t ib = 0; ib < nbytes; ++ib) {
+        hash ^= bytes[ib];
+        hash *= fnv_prime;
+    }
+
+    return hash;
+}
+
+
+
+static bool HashFile(uint64_t *hash, const char *filename)
+{
+    FILE *fp = CppOpenArtifact(filename, "rb");
+    if (!fp) { fprintf(stderr, "Failed to read %s\n", filename); return false; }
+
+    std::vector<unsigned char> buffer(1 << 20);
+    size_t nread;
+    while ((nread = fread(buffer.data(), 1, buffer.size(), fp)) > 0)
+        *hash = HashBytes(*hash, buffer.data(), nread);
+
+    fclose(fp);
+
+    return true;
+}
+
+
+
+// the checksums file has one line of shape, size, stage and checksum per stage of every case
+static bool ReadChecksums(const char *filename, std::map<std::string, uint64_t> &checksums)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return errno == ENOENT;
+
+    char line[4096];
+    while (fgets(line, 4096, fp)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        char shape[1024], stage[1024];
+        int64_t size;
+        uint64_t checksum;
+        if (sscanf(line, "%1023s %ld %1023s %lx", shape, &size, stage, &checksum) != 4) { fprintf(stderr, "Failed to read %s\n", filename); fclose(fp); return false; }
+
+        char key[4096];
+        sprintf(key, "%s %ld %s", shape, size, stage);
+        checksums[key] = checksum;
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+
+
+static bool WriteChecksums(const char *filename, std::map<std::string, uint64_t> &checksums)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp) { fprintf(stderr, "Failed to write %s\n", filename); return false; }
+
+    fprintf(fp, "# shape, size, stage and 64 bit fnv-1a checksum of its outputs (written by benchmark --record-checksums)\n");
+    for (std::map<std::string, uint64_t>::iterator it = checksums.begin(); it != checksums.end(); ++it)
+        fprintf(fp, "%s %016lx\n", it->first.c_str(), it->second);
+
+    fclose(fp);
+
+    return true;
+}
+
+
+
+typedef struct {
+    const char *shape;
+    int64_t size;
+    char prefix[1024];
+    SyntheticSegmentation *segmentation;
+    int64_t num_threads;
+    int64_t slab_depth;
+    const char *lookup_table_directory;
+    bool morton;
+    bool container;
+} BenchmarkCase;
+
+typedef struct {
+    const char *stage;
+    std::vector<double> seconds;
+    uint64_t checksum;
+    bool deterministic;
+} StageResult;
+
+
+
+// generate the segmentation one slab at a time and downsample it (only the downsampling is timed)
+static bool RunDownsample(BenchmarkCase &benchmark, double *downsample_seconds, double *generate_seconds, uint64_t *segmentation_checksum)
+{
+    int64_t size = benchmark.size;
+    int64_t grid_size[3] = { size, size, size };
+    std::vector<int64_t> slab(benchmark.slab_depth * size * size);
+
+    *downsample_seconds = 0;
+    *generate_seconds = 0;
+
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+    DownsampleContext *context = CppNewDownsampleContext(benchmark.prefix, benchmark_input_resolution, benchmark_skeleton_resolution, grid_size);
+    *downsample_seconds += ElapsedSeconds(start_time);
+
+    for (int64_t iz = 0; iz < size; iz += benchmark.slab_depth) {
+        int64_t nslices = std::min(benchmark.slab_depth, size - iz);
+
+        start_time = std::chrono::steady_clock::now();
+        CppSyntheticSlab(benchmark.segmentation, iz, nslices, slab.data(), benchmark.num_threads);
+        *generate_seconds += ElapsedSeconds(start_time);
+
+        if (segmentation_checksum)
+            *segmentation_checksum = HashBytes(*segmentation_checksum, (unsigned char *) slab.data(), nslices * size * size * sizeof(int64_t));
+
+        start_time = std::chrono::steady_clock::now();
+        int downsampled = CppDownsampleSlab(context, slab.data(), sizeof(int64_t), nslices, NULL);
+        *downsample_seconds += ElapsedSeconds(start_time);
+        if (!downsampled) { CppDeleteDownsampleContext(context); return false; }
+    }
+
+    start_time = std::chrono::steady_clock::now();
+    int finished = CppFinishDownsampleMapping(context, NULL);
+    CppDeleteDownsampleContext(context);
+    *downsample_seconds += ElapsedSeconds(start_time);
+
+    return finished;
+}
+
+
+
+// stages are downsample, thinning, upsample and endpoint-vectors in that order
+static bool HashOutputs(BenchmarkCase &benchmark, int stage, uint64_t *checksum)
+{
+    int64_t *resolution = benchmark_skeleton_resolution;
+    char filename[4096];
+
+    *checksum = fnv_offset;
+    if (stage == 0) {
+        static const char *const names[3] = { "downsample", "upsample", "manifest" };
+        for (int in = 0; in < 3; ++in) {
+            sprintf(filename, "skeletons/%s/%s-%03ldx%03ldx%03ld.bytes", benchmark.prefix, names[in], resolution[IB_X], resolution[IB_Y], resolution[IB_Z]);
+            if (!HashFile(checksum, filename)) return false;
+        }
+
+        return true;
+    }
+
+    if (stage == 1) CppSkeletonFilename(filename, benchmark.prefix, resolution, "downsample-skeleton", "pts", 0, ALL_LABELS);
+    else if (stage == 2) CppSkeletonFilename(filename, benchmark.prefix, resolution, "upsample-skeleton", "pts", 0, ALL_LABELS);
+    else CppSkeletonFilename(filename, benchmark.prefix, resolution, "endpoint-vectors", "vec", 0, ALL_LABELS);
+
+    return HashFile(checksum, filename);
+}
+
+
+
+// run every stage warmup + repetitions times in pipeline order (every run of a stage rewrites the same inputs of the
+// next stage) and keep the timed runs
+static bool RunBenchmarkCase(BenchmarkCase &benchmark, int64_t warmup, int64_t repetitions, std::vector<StageResult> &results)
+{
+    static const char *const stages[4] = { "downsample", "thinning", "upsample", "endpoint-vectors" };
+    static const char *const morton_stages[4] = { "downsample", "thinning-morton", "upsample-morton", "endpoint-vectors-morton" };
+
+    results.clear();
+    results.resize(5);
+    results[0].stage = "segmentation";
+    results[0].checksum = fnv_offset;
+    results[0].deterministic = true;
+
+    for (int is = 0; is < 4; ++is) {
+        StageResult &result = results[is + 1];
+        result.stage = benchmark.morton ? morton_stages[is] : stages[is];
+        result.deterministic = true;
+
+        for (int64_t run = 0; run < warmup + repetitions; ++run) {
+            double seconds = 0;
+
+            if (is == 0) {
+                // the segmentation is only hashed once as it is generated again for every run
+                double generate_seconds;
+                if (!RunDownsample(benchmark, &seconds, &generate_seconds, run ? NULL : &results[0].checksum)) return false;
+                if (run >= warmup) results[0].seconds.push_back(generate_seconds);
+            }
+            else {
+                std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+                if (is == 1) { if (!CppTopologicalThinning(benchmark.prefix, benchmark_skeleton_resolution, benchmark.lookup_table_directory, benchmark.num_threads, 0, 0, ALL_LABELS, 0, 0, false, benchmark.morton, NULL)) return false; }
+                else if (is == 2) { if (!CppApplyUpsampleOperation(benchmark.prefix, NULL, benchmark_skeleton_resolution, benchmark_input_resolution, 0, ALL_LABELS)) return false; }
+                else if (!CppFindEndpointVectors(benchmark.prefix, benchmark_skeleton_resolution, benchmark_input_resolution, 0, ALL_LABELS)) return false;
+                seconds = ElapsedSeconds(start_time);
+            }
+            if (run >= warmup) result.seconds.push_back(seconds);
+
+            uint64_t checksum;
+            if (!HashOutputs(benchmark, is, &checksum)) return false;
+            if (!run) result.checksum = checksum;
+            else if (checksum != result.checksum) result.deterministic = false;
+        }
+
+        if (is == 0) CppPrintPerfCounters("downsampling");
+        if (is == 1) CppPrintPerfCounters("thinning");
+    }
+
+    return true;
+}
+
+
+
+static void WriteResult(FILE *fp, const char *date, const char *host, BenchmarkCase &benchmark, int64_t warmup, StageResult &result, const char *verification)
+{
+    std::vector<double> sorted = result.seconds;
+    std::sort(sorted.begin(), sorted.end());
+
+    double mean = 0;
+    for (uint64_t ir = 0; ir < sorted.size(); ++ir)
+        mean += sorted[ir] / sorted.size();
+    double median = sorted.empty() ? 0 : (sorted[(sorted.size() - 1) / 2] + sorted[sorted.size() / 2]) / 2;
+    double minimum = sorted.empty() ? 0 : sorted[0];
+
+    fprintf(fp, "{\"date\": \"%s\", \"host\": \"%s\", \"shape\": \"%s\", \"size\": %ld, \"max_label\": %ld, \"stage\": \"%s\", \"storage\": \"%s\", ", date, host, benchmark.shape, benchmark.size, CppSyntheticMaxLabel(benchmark.segmentation), result.stage, benchmark.container ? "container" : "directory");
+    fprintf(fp, "\"threads\": %ld, \"warmup\": %ld, \"repetitions\": %lu, \"seconds\": [", benchmark.num_threads, warmup, result.seconds.size());
+    for (uint64_t ir = 0; ir < result.seconds.size(); ++ir)
+        fprintf(fp, "%s%0.6f", ir ? ", " : "", result.seconds[ir]);
+    fprintf(fp, "], \"min\": %0.6f, \"median\": %0.6f, \"mean\": %0.6f, \"checksum\": \"%016lx\", \"verification\": \"%s\"}\n", minimum, median, mean, result.checksum, verification);
+
+    printf("%-12s %5ld^3 %-16s median %9.4f s  min %9.4f s  %016lx %s\n", benchmark.shape, benchmark.size, result.stage, median, minimum, result.checksum, verification);
+}
+
+
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> shapes(benchmark_shapes, benchmark_shapes + nbenchmark_shapes);
+    std::vector<std::string> size_arguments;
+    ParseList("64,128,256", size_arguments);
+    int64_t warmup = 1;
+    int64_t repetitions = 3;
+    int64_t num_threads = 0;
+    int64_t slab_depth = 16;
+    const char *output_directory = "benchmark-data";
+    const char *results_filename = "benchmark-results.jsonl";
+    const char *checksums_filename = NULL;
+    const char *lookup_table_directory = NULL;
+    bool record_checksums = false;
+    bool morton = false;
+    bool container = false;
+
+    static struct option options[] = {
+        { "shapes", required_argument, NULL, 'S' },
+        { "sizes", required_argument, NULL, 's' },
+        { "warmup", required_argument, NULL, 'w' },
+        { "repetitions", required_argument, NULL, 'n' },
+        { "threads", required_argument, NULL, 't' },
+        { "slab-depth", required_argument, NULL, 'z' },
+        { "output", required_argument, NULL, 'o' },
+        { "results", required_argument, NULL, 'r' },
+        { "checksums", required_argument, NULL, 'c' },
+        { "record-checksums", no_argument, NULL, 'R' },
+        { "morton", no_argument, NULL, 'M' },
+        { "container", no_argument, NULL, 'C' },
+        { "lookup-tables", required_argument, NULL, 'l' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "S:s:w:n:t:z:o:r:c:RMCl:h", options, NULL)) != -1) {
+        bool valid = true;
+        if (option == 'S') valid = ParseList(optarg, shapes);
+        else if (option == 's') valid = ParseList(optarg, size_arguments);
+        else if (option == 'w') valid = sscanf(optarg, "%ld", &warmup) == 1 && warmup >= 0;
+        else if (option == 'n') valid = sscanf(optarg, "%ld", &repetitions) == 1 && repetitions > 0;
+        else if (option == 't') valid = sscanf(optarg, "%ld", &num_threads) == 1 && num_threads >= 0;
+        else if (option == 'z') valid = sscanf(optarg, "%ld", &slab_depth) == 1 && slab_depth > 0;
+        else if (option == 'o') output_directory = optarg;
+        else if (option == 'r') results_filename = optarg;
+        else if (option == 'c') checksums_filename = optarg;
+        else if (option == 'R') record_checksums = true;
+        else if (option == 'M') morton = true;
+        else if (option == 'C') container = true;
+        else if (option == 'l') lookup_table_directory = optarg;
+        else if (option == 'h') { Usage(argv[0]); return 0; }
+        else valid = false;
+
+        if (!valid) { Usage(argv[0]); return -1; }
+    }
+    if (optind != argc) { Usage(argv[0]); return -1; }
+
+    std::vector<int64_t> sizes;
+    for (uint64_t is = 0; is < size_arguments.size(); ++is) {
+        int64_t size;
+        char trailing;
+        if (sscanf(size_arguments[is].c_str(), "%ld%c", &size, &trailing) != 1 || size < 8) { Usage(argv[0]); return -1; }
+        sizes.push_back(size);
+    }
+
+    // the lookup tables and stored checksums are installed next to the executable
+    char executable_directory[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", executable_directory, PATH_MAX - 1);
+    if (length < 0) { fprintf(stderr, "Failed to find the executable directory (use --lookup-tables and --checksums)\n"); return -1; }
+    executable_directory[length] = '\0';
+    *strrchr(executable_directory, '/') = '\0';
+    if (!lookup_table_directory) lookup_table_directory = executable_directory;
+
+    std::string default_checksums_filename = std::string(executable_directory) + "/benchmark-checksums.txt";
+    std::string checksums_path = checksums_filename ? AbsolutePath(checksums_filename) : default_checksums_filename;
+    std::string results_path = AbsolutePath(results_filename);
+
+    char lookup_table_path[PATH_MAX];
+    if (!realpath(lookup_table_directory, lookup_table_path)) { fprintf(stderr, "Failed to read %s\n", lookup_table_directory); return -1; }
+
+    std::map<std::string, uint64_t> checksums;
+    if (!ReadChecksums(checksums_path.c_str(), checksums)) return -1;
+
+    FILE *rfp = fopen(results_path.c_str(), "a");
+    if (!rfp) { fprintf(stderr, "Failed to write %s\n", results_path.c_str()); return -1; }
+
+    char date[64];
+    time_t now = time(NULL);
+    strftime(date, 64, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    char host[256];
+    if (gethostname(host, 256)) strcpy(host, "unknown");
+    host[255] = '\0';
+
+    // every case writes to skeletons/{SHAPE}-{SIZE} (or skeletons/{SHAPE}-{SIZE}.container) in the output directory
+    if (!MakeDirectory(output_directory)) return -1;
+    if (chdir(output_directory)) { fprintf(stderr, "Failed to write to %s\n", output_directory); return -1; }
+    if (!MakeDirectory("skeletons")) return -1;
+
+    bool verified = true;
+    for (uint64_t ishape = 0; ishape < shapes.size(); ++ishape) {
+        for (uint64_t isize = 0; isize < sizes.size(); ++isize) {
+            BenchmarkCase benchmark;
+            benchmark.shape = shapes[ishape].c_str();
+            benchmark.size = sizes[isize];
+            benchmark.num_threads = num_threads;
+            benchmark.slab_depth = slab_depth;
+            benchmark.lookup_table_directory = lookup_table_path;
+            benchmark.morton = morton;
+            benchmark.container = container;
+            benchmark.segmentation = CppNewSyntheticSegmentation(benchmark.shape, benchmark.size, benchmark_seed);
+            if (!benchmark.segmentation) { fprintf(stderr, "Unknown shape %s\n", benchmark.shape); return -1; }
+
+            sprintf(benchmark.prefix, "%s-%04ld", benchmark.shape, benchmark.size);
+            if (container) {
+                // a container keeps the chunks of replaced outputs so every run starts from a new one
+                std::string container_filename = std::string("skeletons/") + benchmark.prefix + ".container";
+                unlink(container_filename.c_str());
+                if (!CppCreateContainer(benchmark.prefix)) return -1;
+            }
+            else {
+                if (!CppCreateDirectory(benchmark.prefix)) return -1;
+            }
+
+            std::vector<StageResult> results;
+            if (!RunBenchmarkCase(benchmark, warmup, repetitions, results)) { fprintf(stderr, "Failed to run %s\n", benchmark.prefix); return -1; }
+
+            for (uint64_t ir = 0; ir < results.size(); ++ir) {
+                char key[4096];
+                sprintf(key, "%s %ld %s", benchmark.shape, benchmark.size, results[ir].stage);
+
+                const char *verification;
+                if (!results[ir].deterministic) verification = "nondeterministic";
+                else if (record_checksums) verification = "recorded";
+                else if (!checksums.count(key)) verification = "unrecorded";
+                else if (checksums[key] == results[ir].checksum) verification = "match";
+                else verification = "mismatch";
+
+                if (!results[ir].deterministic || !strcmp(verification, "mismatch")) verified = false;
+                if (record_checksums) checksums[key] = results[ir].checksum;
+
+                WriteResult(rfp, date, host, benchmark, warmup, results[ir], verification);
+            }
+            fflush(rfp);
+
+            CppDeleteSyntheticSegmentation(benchmark.segmentation);
+        }
+    }
+    fclose(rfp);
+
+    if (record_checksums && !WriteChecksums(checksums_path.c_str(), checksums)) return -1;
+    if (!verified) { fprintf(stderr, "Outputs differ from the stored checksums in %s\n", checksums_path.c_str()); return -1; }
+
+    return 0;
+}
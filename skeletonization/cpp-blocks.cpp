@@ -0,0 +1,330 @@
+/* c++ file to stitch the skeletons of overlapping blocks into one skeleton per label */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "cpp-generate_skeletons.h"
+#include "cpp-storage.h"
+
+
+
+// a skeleton point of one block with its downsampled location in the volume (blocks start on whole downsample periods
+// so the downsampled grids of all blocks are part of the grid of the volume)
+typedef struct {
+    int64_t block;
+    int64_t element;
+    int64_t cell;
+    bool core;
+} BlockPoint;
+
+// skeleton points and endpoint vectors of one global label gathered from all blocks, and the points of every block
+// (with its halo) in block order to join the fragments of neighboring blocks
+typedef struct {
+    std::vector<int64_t> elements;
+    std::vector<int64_t> endpoints;
+    std::vector<double> vectors;
+    std::vector<BlockPoint> points;
+} StitchedSkeleton;
+
+// the downsampled grid of the volume
+typedef struct {
+    float down[3];
+    int64_t grid_size[3];
+} DownsampledGrid;
+
+
+
+// read the global label of every block label (blocks are relabeled to keep their memory bounded)
+static bool ReadBlockLabels(const char *block_prefix, std::vector<int64_t> &labels)
+{
+    char labels_filename[4096];
+    sprintf(labels_filename, "skeletons/%s/labels.bytes", block_prefix);
+
+    FILE *lfp = CppOpenArtifact(labels_filename, "rb");
+    if (!lfp) { fprintf(stderr, "Failed to read %s\n", labels_filename); return false; }
+
+    int64_t nlabels;
+    if (fread(&nlabels, sizeof(int64_t), 1, lfp) != 1) { fprintf(stderr, "Failed to read %s\n", labels_filename); fclose(lfp); return false; }
+
+    labels.resize(nlabels);
+    if (fread(labels.data(), sizeof(int64_t), nlabels, lfp) != (uint64_t)nlabels) { fprintf(stderr, "Failed to read %s\n", labels_filename); fclose(lfp); return false; }
+    fclose(lfp);
+
+    return true;
+}
+
+
+
+// convert an index in the block to the global volume with its downsampled cell and whether it is in the block core
+// (the halo belongs to the neighboring block)
+static int64_t BlockToGlobal(int64_t index, int64_t block_grid_size[3], int64_t block_origin[3], int64_t block_core[6], int64_t grid_size[3], DownsampledGrid &down_grid, int64_t &cell, bool &core)
+{
+    int64_t iz = index / (block_grid_size[IB_Y] * block_grid_size[IB_X]) + block_origin[IB_Z];
+    int64_t iy = (index / block_grid_size[IB_X]) % block_grid_size[IB_Y] + block_origin[IB_Y];
+    int64_t ix = index % block_grid_size[IB_X] + block_origin[IB_X];
+
+    core = true;
+    if (iz < block_core[IB_Z] || iz >= block_core[3 + IB_Z]) core = false;
+    if (iy < block_core[IB_Y] || iy >= block_core[3 + IB_Y]) core = false;
+    if (ix < block_core[IB_X] || ix >= block_core[3 + IB_X]) core = false;
+
+    // the same cell as DownsampleMapping of the volume
+    int64_t iw = (int64_t) (iz / down_grid.down[IB_Z]);
+    int64_t iv = (int64_t) (iy / down_grid.down[IB_Y]);
+    int64_t iu = (int64_t) (ix / down_grid.down[IB_X]);
+    cell = iw * down_grid.grid_size[IB_Y] * down_grid.grid_size[IB_X] + iv * down_grid.grid_size[IB_X] + iu;
+
+    return iz * grid_size[IB_Y] * grid_size[IB_X] + iy * grid_size[IB_X] + ix;
+}
+
+
+
+// add the core of every label of this block in [first_label, last_label) to the stitched skeletons
+static bool StitchBlock(const char *block_prefix, int64_t block, int64_t skeleton_resolution[3], int64_t block_origin[3], int64_t block_core[6], int64_t grid_size[3], DownsampledGrid &down_grid, int64_t first_label, std::vector<int64_t> &labels, std::vector<StitchedSkeleton> &skeletons)
+{
+    char skeleton_filename[4096];
+    CppSkeletonFilename(skeleton_filename, block_prefix, skeleton_resolution, "upsample-skeleton", "pts", 0, ALL_LABELS);
+
+    char vectors_filename[4096];
+    CppSkeletonFilename(vectors_filename, block_prefix, skeleton_resolution, "endpoint-vectors", "vec", 0, ALL_LABELS);
+
+    FILE *sfp = CppOpenArtifact(skeleton_filename, "rb");
+    if (!sfp) { fprintf(stderr, "Failed to read %s\n", skeleton_filename); return false; }
+
+    FILE *vfp = CppOpenArtifact(vectors_filename, "rb");
+    if (!vfp) { fprintf(stderr, "Failed to read %s\n", vectors_filename); fclose(sfp); return false; }
+
+    int64_t block_grid_size[3], vectors_grid_size[3];
+    int64_t skeleton_max_label, vectors_max_label;
+    if (!CppReadSkeletonHeader(sfp, block_grid_size, &skeleton_max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", skeleton_filename); fclose(sfp); fclose(vfp); return false; }
+    if (!CppReadSkeletonHeader(vfp, vectors_grid_size, &vectors_max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", vectors_filename); fclose(sfp); fclose(vfp); return false; }
+    if (skeleton_max_label != (int64_t)labels.size() || vectors_max_label != (int64_t)labels.size()) { fprintf(stderr, "Labels of %s do not match its skeletons\n", block_prefix); fclose(sfp); fclose(vfp); return false; }
+
+    for (int64_t block_label = 0; block_label < skeleton_max_label; ++block_label) {
+        int64_t nelements, nendpoints;
+        if (fread(&nelements, sizeof(int64_t), 1, sfp) != 1) { fprintf(stderr, "Failed to read %s\n", skeleton_filename); fclose(sfp); fclose(vfp); return false; }
+        if (fread(&nendpoints, sizeof(int64_t), 1, vfp) != 1) { fprintf(stderr, "Failed to read %s\n", vectors_filename); fclose(sfp); fclose(vfp); return false; }
+
+        // skip the labels outside of this range (and the background)
+        int64_t label = labels[block_label];
+        if (!label || label < first_label || label >= first_label + (int64_t)skeletons.size()) {
+            if (fseek(sfp, nelements * sizeof(int64_t), SEEK_CUR)) { fprintf(stderr, "Failed to read %s\n", skeleton_filename); fclose(sfp); fclose(vfp); return false; }
+            if (fseek(vfp, nendpoints * (sizeof(int64_t) + 3 * sizeof(double)), SEEK_CUR)) { fprintf(stderr, "Failed to read %s\n", vectors_filename); fclose(sfp); fclose(vfp); return false; }
+            continue;
+        }
+        StitchedSkeleton &skeleton = skeletons[label - first_label];
+
+        std::vector<int64_t> elements = std::vector<int64_t>(nelements);
+        if (fread(elements.data(), sizeof(int64_t), nelements, sfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to read %s\n", skeleton_filename); fclose(sfp); fclose(vfp); return false; }
+
+        // keep the joints and endpoints in the block core (endpoints remain negative) and every point for joining
+        for (int64_t ie = 0; ie < nelements; ++ie) {
+            BlockPoint point;
+            point.block = block;
+            int64_t element = elements[ie] < 0 ? -1 * elements[ie] : elements[ie];
+            point.element = BlockToGlobal(element, block_grid_size, block_origin, block_core, grid_size, down_grid, point.cell, point.core);
+            skeleton.points.push_back(point);
+            if (!point.core) continue;
+
+            if (elements[ie] < 0) skeleton.elements.push_back(-1 * point.element);
+            else skeleton.elements.push_back(point.element);
+        }
+
+        for (int64_t ie = 0; ie < nendpoints; ++ie) {
+            int64_t endpoint;
+            double vector[3];
+            if (fread(&endpoint, sizeof(int64_t), 1, vfp) != 1) { fprintf(stderr, "Failed to read %s\n", vectors_filename); fclose(sfp); fclose(vfp); return false; }
+            if (fread(vector, sizeof(double), 3, vfp) != 3) { fprintf(stderr, "Failed to read %s\n", vectors_filename); fclose(sfp); fclose(vfp); return false; }
+
+            int64_t cell;
+            bool core;
+            int64_t global_endpoint = BlockToGlobal(endpoint, block_grid_size, block_origin, block_core, grid_size, down_grid, cell, core);
+            if (!core) continue;
+
+            skeleton.endpoints.push_back(global_endpoint);
+            skeleton.vectors.push_back(vector[0]);
+            skeleton.vectors.push_back(vector[1]);
+            skeleton.vectors.push_back(vector[2]);
+        }
+    }
+
+    fclose(sfp);
+    fclose(vfp);
+
+    return true;
+}
+
+
+
+// the cells around a downsampled cell (and the cell itself) that are in the grid
+static void NeighborCells(DownsampledGrid &down_grid, int64_t cell, std::vector<int64_t> &neighbors)
+{
+    int64_t *grid_size = down_grid.grid_size;
+    int64_t iz = cell / (grid_size[IB_Y] * grid_size[IB_X]);
+    int64_t iy = (cell / grid_size[IB_X]) % grid_size[IB_Y];
+    int64_t ix = cell % grid_size[IB_X];
+
+    neighbors.clear();
+    for (int64_t iw = std::max(iz - 1, (int64_t) 0); iw <= std::min(iz + 1, grid_size[IB_Z] - 1); ++iw)
+        for (int64_t iv = std::max(iy - 1, (int64_t) 0); iv <= std::min(iy + 1, grid_size[IB_Y] - 1); ++iv)
+            for (int64_t iu = std::max(ix - 1, (int64_t) 0); iu <= std::min(ix + 1, grid_size[IB_X] - 1); ++iu)
+                neighbors.push_back(iw * grid_size[IB_Y] * grid_size[IB_X] + iv * grid_size[IB_X] + iu);
+}
+
+
+
+// whether a cell or one around it has core points of another block
+static bool TouchesOtherBlock(DownsampledGrid &down_grid, std::unordered_map<int64_t, int64_t> &core_blocks, int64_t cell, int64_t block)
+{
+    std::vector<int64_t> neighbors;
+    NeighborCells(down_grid, cell, neighbors);
+    for (uint64_t in = 0; in < neighbors.size(); ++in) {
+        std::unordered_map<int64_t, int64_t>::iterator it = core_blocks.find(neighbors[in]);
+        if (it != core_blocks.end() && it->second != block) return true;
+    }
+
+    return false;
+}
+
+
+
+// the skeletons of neighboring blocks are thinned separately and need not meet where their cores meet; follow the
+// skeleton of every block from its core into its halo (through 26-adjacent downsampled cells) and add the halo points
+// up to the first one that touches the core points of another block, unless the core point it starts from touches
+// them already
+static void JoinBlockFragments(StitchedSkeleton &skeleton, DownsampledGrid &down_grid)
+{
+    std::vector<BlockPoint> &points = skeleton.points;
+
+    // the block of the core points in every cell and the cells with a stitched point
+    std::unordered_map<int64_t, int64_t> core_blocks;
+    std::unordered_set<int64_t> stitched;
+    for (uint64_t ip = 0; ip < points.size(); ++ip) {
+        if (!points[ip].core) continue;
+        core_blocks.insert(std::make_pair(points[ip].cell, points[ip].block));
+        stitched.insert(points[ip].cell);
+    }
+
+    std::vector<int64_t> neighbors;
+
+    // the points of every block are consecutive
+    uint64_t start = 0;
+    while (start < points.size()) {
+        int64_t block = points[start].block;
+        uint64_t end = start;
+        while (end < points.size() && points[end].block == block) end++;
+
+        std::unordered_map<int64_t, uint64_t> block_cells;
+        for (uint64_t ip = start; ip < end; ++ip)
+            block_cells.insert(std::make_pair(points[ip].cell, ip));
+
+        // breadth first from the core points that do not touch another block yet
+        std::unordered_map<uint64_t, uint64_t> parents;
+        std::deque<uint64_t> queue;
+        for (uint64_t ip = start; ip < end; ++ip) {
+            if (!points[ip].core || TouchesOtherBlock(down_grid, core_blocks, points[ip].cell, block)) continue;
+            parents[ip] = ip;
+            queue.push_back(ip);
+        }
+
+        while (!queue.empty()) {
+            uint64_t ip = queue.front();
+            queue.pop_front();
+
+            if (!points[ip].core && TouchesOtherBlock(down_grid, core_blocks, points[ip].cell, block)) {
+                // add the path back to the core (as joints)
+                for (uint64_t iq = ip; !points[iq].core; iq = parents[iq]) {
+                    if (!stitched.insert(points[iq].cell).second) continue;
+                    skeleton.elements.push_back(points[iq].element);
+                }
+                continue;
+            }
+
+            NeighborCells(down_grid, points[ip].cell, neighbors);
+            for (uint64_t in = 0; in < neighbors.size(); ++in) {
+                std::unordered_map<int64_t, uint64_t>::iterator it = block_cells.find(neighbors[in]);
+                if (it == block_cells.end() || points[it->second].core || parents.count(it->second)) continue;
+
+                parents[it->second] = ip;
+                queue.push_back(it->second);
+            }
+        }
+
+        start = end;
+    }
+
+    std::vector<BlockPoint>().swap(points);
+}
+
+
+
+int CppStitchBlocks(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3], int64_t grid_size[3], const char **block_prefixes, int64_t *block_origins, int64_t *block_cores, int64_t nblocks, int64_t label_start, int64_t label_end)
+{
+    // the global labels of every block give the number of labels in the volume
+    std::vector<std::vector<int64_t> > block_labels = std::vector<std::vector<int64_t> >(nblocks);
+    int64_t max_label = 1;
+    for (int64_t ib = 0; ib < nblocks; ++ib) {
+        if (!ReadBlockLabels(block_prefixes[ib], block_labels[ib])) return 0;
+        for (uint64_t il = 0; il < block_labels[ib].size(); ++il)
+            if (block_labels[ib][il] + 1 > max_label) max_label = block_labels[ib][il] + 1;
+    }
+
+    // only the labels in this range are held in memory
+    int64_t first_label, last_label;
+    if (!CppLabelRange(max_label, &label_start, &label_end, &first_label, &last_label)) return 0;
+
+    DownsampledGrid down_grid;
+    for (int dim = 0; dim < 3; ++dim) {
+        down_grid.down[dim] = ((float) skeleton_resolution[dim]) / output_resolution[dim];
+        down_grid.grid_size[dim] = (int64_t) ceil(grid_size[dim] / down_grid.down[dim]);
+    }
+
+    std::vector<StitchedSkeleton> skeletons = std::vector<StitchedSkeleton>(last_label - first_label);
+    for (int64_t ib = 0; ib < nblocks; ++ib) {
+        if (!StitchBlock(block_prefixes[ib], ib, skeleton_resolution, &(block_origins[3 * ib]), &(block_cores[6 * ib]), grid_size, down_grid, first_label, block_labels[ib], skeletons)) return 0;
+    }
+
+    for (uint64_t is = 0; is < skeletons.size(); ++is)
+        JoinBlockFragments(skeletons[is], down_grid);
+
+    // write the stitched skeletons and endpoint vectors in the layout of the unblocked outputs
+    char skeleton_filename[4096];
+    CppSkeletonFilename(skeleton_filename, prefix, skeleton_resolution, "upsample-skeleton", "pts", label_start, label_end);
+
+    char vectors_filename[4096];
+    CppSkeletonFilename(vectors_filename, prefix, skeleton_resolution, "endpoint-vectors", "vec", label_start, label_end);
+
+    FILE *sfp = CppOpenArtifact(skeleton_filename, "wb");
+    if (!sfp) { fprintf(stderr, "Failed to write %s\n", skeleton_filename); return 0; }
+
+    FILE *vfp = CppOpenArtifact(vectors_filename, "wb");
+    if (!vfp) { fprintf(stderr, "Failed to write %s\n", vectors_filename); CppDiscardArtifact(sfp); return 0; }
+
+    if (!CppWriteSkeletonHeader(sfp, grid_size, max_label, label_start, label_end)) { fprintf(stderr, "Failed to write %s\n", skeleton_filename); CppDiscardArtifact(sfp); CppDiscardArtifact(vfp); return 0; }
+    if (!CppWriteSkeletonHeader(vfp, grid_size, max_label, label_start, label_end)) { fprintf(stderr, "Failed to write %s\n", vectors_filename); CppDiscardArtifact(sfp); CppDiscardArtifact(vfp); return 0; }
+
+    for (int64_t label = first_label; label < last_label; ++label) {
+        StitchedSkeleton &skeleton = skeletons[label - first_label];
+
+        int64_t nelements = skeleton.elements.size();
+        if (fwrite(&nelements, sizeof(int64_t), 1, sfp) != 1) { fprintf(stderr, "Failed to write %s\n", skeleton_filename); CppDiscardArtifact(sfp); CppDiscardArtifact(vfp); return 0; }
+        if (fwrite(skeleton.elements.data(), sizeof(int64_t), nelements, sfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to write %s\n", skeleton_filename); CppDiscardArtifact(sfp); CppDiscardArtifact(vfp); return 0; }
+
+        int64_t nendpoints = skeleton.endpoints.size();
+        if (fwrite(&nendpoints, sizeof(int64_t), 1, vfp) != 1) { fprintf(stderr, "Failed to write %s\n", vectors_filename); CppDiscardArtifact(sfp); CppDiscardArtifact(vfp); return 0; }
+        for (int64_t ie = 0; ie < nendpoints; ++ie) {
+            if (fwrite(&(skeleton.endpoints[ie]), sizeof(int64_t), 1, vfp) != 1) { fprintf(stderr, "Failed to write %s\n", vectors_filename); CppDiscardArtifact(sfp); CppDiscardArtifact(vfp); return 0; }
+            if (fwrite(&(skeleton.vectors[3 * ie]), sizeof(double), 3, vfp) != 3) { fprintf(stderr, "Failed to write %s\n", vectors_filename); CppDiscardArtifact(sfp); CppDiscardArtifact(vfp); return 0; }
+        }
+    }
+
+    if (fclose(sfp)) { fprintf(stderr, "Failed to write %s\n", skeleton_filename); CppDiscardArtifact(vfp); return 0; }
+    if (fclose(vfp)) { fprintf(stderr, "Failed to write %s\n", vectors_filename); return 0; }
+
+    return 1;
+}
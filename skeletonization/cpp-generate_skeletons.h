@@ -2,12 +2,79 @@
 #define __CPP_GENERATE_SKELETONS__
 
 #include <inttypes.h>
+#include <stdio.h>
+#include <vector>
+#include "cpp-progress.h"
 
 
 // function calls across cpp files
-void CppTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory);
-void CppFindEndpointVectors(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3]);
-void CppApplyUpsampleOperation(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3]);
+int CppTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget, int64_t label_start, int64_t label_end, int64_t max_iterations, double max_seconds, bool statistics, bool morton, ProgressContext *progress);
+int CppResumeTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t max_iterations, double max_seconds);
+int CppFindEndpointVectors(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3], int64_t label_start, int64_t label_end);
+int CppApplyUpsampleOperation(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3], int64_t label_start, int64_t label_end);
+int CppDensifySkeletons(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3], int64_t num_threads);
+int CppAdaptiveTopologicalThinning(const char *prefix, int64_t *skeleton_resolutions, int64_t nskeleton_resolutions, int64_t label_voxel_budget, const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget);
+int64_t CppIncrementalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget);
+int CppRunSkeletonService(const char *socket_path, const char *lookup_table_directory);
+
+
+// label range shards (label_end of ALL_LABELS runs every label into the canonical files)
+static const int64_t ALL_LABELS = -1;
+
+void CppSkeletonFilename(char *filename, const char *prefix, int64_t skeleton_resolution[3], const char *name, const char *extension, int64_t label_start, int64_t label_end);
+bool CppLabelRange(int64_t max_label, int64_t *label_start, int64_t *label_end, int64_t *first_label, int64_t *last_label);
+bool CppWriteSkeletonHeader(FILE *fp, int64_t grid_size[3], int64_t max_label, int64_t label_start, int64_t label_end);
+bool CppReadSkeletonHeader(FILE *fp, int64_t grid_size[3], int64_t *max_label, int64_t label_start, int64_t label_end);
+int CppMergeShards(const char *output_filename, const char **shard_filenames, int64_t nshards);
+
+
+// stitch the skeletons of overlapping blocks (origins in z, y, x and cores as zmin, ymin, xmin, zmax, ymax, xmax, all
+// on whole downsample periods of the volume at output_resolution)
+int CppStitchBlocks(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3], int64_t grid_size[3], const char **block_prefixes, int64_t *block_origins, int64_t *block_cores, int64_t nblocks, int64_t label_start, int64_t label_end);
+
+
+// thinning context with the lookup tables and working volume (one context per thread, workers share the tables)
+struct ThinningContext;
+
+ThinningContext *CppNewThinningContext(const char *lookup_table_directory);
+ThinningContext *CppNewWorkerThinningContext(ThinningContext *context);
+void CppDeleteThinningContext(ThinningContext *context);
+void CppSetThinningGridSize(ThinningContext *context, int64_t grid_size[3]);
+void CppSegmentBoundingBox(int64_t grid_size[3], int64_t *elements, int64_t nelements, int64_t bounding_box[6]);
+int64_t CppThinSegment(ThinningContext *context, int64_t *elements, int64_t nelements, int64_t *skeleton);
+int64_t CppResumeThinSegment(ThinningContext *context, int64_t *state, int64_t nstate, int64_t *skeleton);
+
+// thinning budget (unlimited if zero) and the progress of the last segment (the state of a segment that did not
+// converge is the direction and changes of its interrupted iteration and its layout followed by the remaining voxels
+// and their values; resuming it restores that layout)
+void CppSetThinningBudget(ThinningContext *context, int64_t max_iterations, double max_seconds);
+
+// store the working volume in 8 x 8 x 8 bricks along the z-order curve rather than by rows and start the surface
+// list in that order (skeletons can differ from the row layout where the order of deletions matters)
+void CppSetThinningLayout(ThinningContext *context, bool morton);
+bool CppThinningConverged(ThinningContext *context);
+int64_t CppThinningIterations(ThinningContext *context);
+std::vector<int64_t> &CppThinningState(ThinningContext *context);
+
+// work done on one label (bounding box as zmin, ymin, xmin, zmax, ymax, xmax and deleted voxels per thinning direction);
+// the iterations, deletions, isthmuses and seconds are those of the last segment of a context
+typedef struct {
+    int64_t label;
+    int64_t nvoxels;
+    int64_t bounding_box[6];
+    int64_t iterations;
+    int64_t deleted[6];
+    int64_t isthmuses;
+    int64_t nskeleton;
+    double detect_seconds;
+    double delete_seconds;
+} ThinningStatistics;
+
+void CppThinningStatistics(ThinningContext *context, ThinningStatistics *statistics);
+int64_t CppThinningMemoryCost(int64_t nelements, int64_t bounding_box[6], bool morton);
+void CppUpsampleLabelSkeleton(int64_t grid_size[3], std::vector<int64_t> &down_elements, std::vector<int64_t> &up_elements, std::vector<int64_t> &skeleton, std::vector<int64_t> &up_endpoints, std::vector<double> &vectors);
+bool CppReadLabelManifest(const char *prefix, int64_t skeleton_resolution[3], int64_t max_label, std::vector<int64_t> &nelements, std::vector<int64_t> &bounding_boxes);
+uint64_t CppLabelHash(std::vector<int64_t> &down_elements, std::vector<int64_t> &up_elements);
 
 
 // universal variables and functions
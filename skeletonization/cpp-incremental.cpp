@@ -0,0 +1,370 @@
+/* c++ file to skeletonize only the labels that changed since the previous run */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "cpp-generate_skeletons.h"
+#include "cpp-pipeline.h"
+#include "cpp-storage.h"
+
+
+
+// outputs of a skeleton resolution that are kept up to date (in the order of the offsets in the cache)
+static const int NOUTPUTS = 3;
+static const char *output_names[NOUTPUTS] = { "downsample-skeleton", "upsample-skeleton", "endpoint-vectors" };
+static const char *output_extensions[NOUTPUTS] = { "pts", "pts", "vec" };
+
+// size of the blocks copied from the previous outputs
+static const int64_t copy_block_size = 1 << 20;
+
+
+
+// a changed label passed between the pipeline stages
+struct IncrementalSkeleton {
+    int64_t label;
+    std::vector<int64_t> down_elements;
+    std::vector<int64_t> up_elements;
+    std::vector<int64_t> down_skeleton;
+    std::vector<int64_t> up_skeleton;
+    std::vector<int64_t> up_endpoints;
+    std::vector<double> vectors;
+};
+
+
+
+// hashes of every label from the previous run with the offset of every label in each output
+typedef struct {
+    int64_t down_grid_size[3];
+    int64_t up_grid_size[3];
+    int64_t max_label;
+    int64_t file_sizes[NOUTPUTS];
+    std::vector<uint64_t> hashes;
+    std::vector<int64_t> offsets;
+} SkeletonCache;
+
+
+
+static uint64_t MixElement(uint64_t value)
+{
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+
+    return value;
+}
+
+
+
+// the hash does not depend on the order of the elements since the downsampled file stores them in any order
+uint64_t CppLabelHash(std::vector<int64_t> &down_elements, std::vector<int64_t> &up_elements)
+{
+    uint64_t hash = MixElement(down_elements.size());
+    for (uint64_t ie = 0; ie < down_elements.size(); ++ie)
+        hash += MixElement(MixElement(down_elements[ie]) ^ up_elements[ie]);
+
+    return hash;
+}
+
+
+
+static int64_t FileSize(const char *filename)
+{
+    FILE *fp = CppOpenArtifact(filename, "rb");
+    if (!fp) return -1;
+
+    if (fseek(fp, 0, SEEK_END)) { fclose(fp); return -1; }
+    int64_t size = ftell(fp);
+    fclose(fp);
+
+    return size;
+}
+
+
+
+// the cache is only used if it describes the outputs that are on disk
+static bool ReadSkeletonCache(const char *cache_filename, char output_filenames[NOUTPUTS][4096], SkeletonCache &cache)
+{
+    FILE *cfp = CppOpenArtifact(cache_filename, "rb");
+    if (!cfp) return false;
+
+    if (fread(cache.down_grid_size, sizeof(int64_t), 3, cfp) != 3) { fclose(cfp); return false; }
+    if (fread(cache.up_grid_size, sizeof(int64_t), 3, cfp) != 3) { fclose(cfp); return false; }
+    if (fread(&(cache.max_label), sizeof(int64_t), 1, cfp) != 1) { fclose(cfp); return false; }
+    if (fread(cache.file_sizes, sizeof(int64_t), NOUTPUTS, cfp) != NOUTPUTS) { fclose(cfp); return false; }
+
+    cache.hashes.resize(cache.max_label);
+    cache.offsets.resize(NOUTPUTS * cache.max_label);
+    for (int64_t label = 0; label < cache.max_label; ++label) {
+        if (fread(&(cache.hashes[label]), sizeof(uint64_t), 1, cfp) != 1) { fclose(cfp); return false; }
+        if (fread(&(cache.offsets[NOUTPUTS * label]), sizeof(int64_t), NOUTPUTS, cfp) != NOUTPUTS) { fclose(cfp); return false; }
+    }
+    fclose(cfp);
+
+    for (int io = 0; io < NOUTPUTS; ++io) {
+        if (FileSize(output_filenames[io]) != cache.file_sizes[io]) return false;
+    }
+
+    return true;
+}
+
+
+
+static bool WriteSkeletonCache(const char *cache_filename, SkeletonCache &cache)
+{
+    FILE *cfp = CppOpenArtifact(cache_filename, "wb");
+    if (!cfp) return false;
+
+    if (fwrite(cache.down_grid_size, sizeof(int64_t), 3, cfp) != 3) { CppDiscardArtifact(cfp); return false; }
+    if (fwrite(cache.up_grid_size, sizeof(int64_t), 3, cfp) != 3) { CppDiscardArtifact(cfp); return false; }
+    if (fwrite(&(cache.max_label), sizeof(int64_t), 1, cfp) != 1) { CppDiscardArtifact(cfp); return false; }
+    if (fwrite(cache.file_sizes, sizeof(int64_t), NOUTPUTS, cfp) != NOUTPUTS) { CppDiscardArtifact(cfp); return false; }
+
+    for (int64_t label = 0; label < cache.max_label; ++label) {
+        if (fwrite(&(cache.hashes[label]), sizeof(uint64_t), 1, cfp) != 1) { CppDiscardArtifact(cfp); return false; }
+        if (fwrite(&(cache.offsets[NOUTPUTS * label]), sizeof(int64_t), NOUTPUTS, cfp) != NOUTPUTS) { CppDiscardArtifact(cfp); return false; }
+    }
+
+    return !fclose(cfp);
+}
+
+
+
+static bool CopyBytes(FILE *rfp, int64_t offset, int64_t nbytes, FILE *wfp, char *block)
+{
+    if (fseek(rfp, offset, SEEK_SET)) return false;
+
+    while (nbytes > 0) {
+        int64_t nblock = std::min(nbytes, copy_block_size);
+        if (fread(block, 1, nblock, rfp) != (uint64_t)nblock) return false;
+        if (fwrite(block, 1, nblock, wfp) != (uint64_t)nblock) return false;
+        nbytes -= nblock;
+    }
+
+    return true;
+}
+
+
+
+// thin, find the endpoint vectors of and upsample only the labels whose downsampled voxels (or their upsampled
+// locations) changed since the previous call; the other labels are copied from the previous outputs with the offsets
+// saved in the cache; returns the number of labels skeletonized or -1 on failure
+int64_t CppIncrementalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget)
+{
+    char downsample_filename[4096];
+    sprintf(downsample_filename, "skeletons/%s/downsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    char upsample_filename[4096];
+    sprintf(upsample_filename, "skeletons/%s/upsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    FILE *dfp = CppOpenArtifact(downsample_filename, "rb");
+    if (!dfp) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return -1; }
+
+    FILE *ufp = CppOpenArtifact(upsample_filename, "rb");
+    if (!ufp) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); return -1; }
+
+    SkeletonCache current;
+    int64_t up_max_label;
+    if (!CppReadSkeletonHeader(dfp, current.down_grid_size, &(current.max_label), 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return -1; }
+    if (!CppReadSkeletonHeader(ufp, current.up_grid_size, &up_max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return -1; }
+    if (current.max_label != up_max_label) { fprintf(stderr, "Labels of %s do not match %s\n", downsample_filename, upsample_filename); fclose(dfp); fclose(ufp); return -1; }
+    int64_t max_label = current.max_label;
+
+    char output_filenames[NOUTPUTS][4096];
+    char partial_filenames[NOUTPUTS][4096];
+    for (int io = 0; io < NOUTPUTS; ++io) {
+        CppSkeletonFilename(output_filenames[io], prefix, skeleton_resolution, output_names[io], output_extensions[io], 0, ALL_LABELS);
+        sprintf(partial_filenames[io], "%s.partial", output_filenames[io]);
+    }
+
+    char cache_filename[4096];
+    CppSkeletonFilename(cache_filename, prefix, skeleton_resolution, "cache", "bytes", 0, ALL_LABELS);
+
+    // without a matching cache every label is skeletonized
+    SkeletonCache previous;
+    bool cached = ReadSkeletonCache(cache_filename, output_filenames, previous);
+    for (int dim = 0; dim < 3 && cached; ++dim) {
+        if (previous.down_grid_size[dim] != current.down_grid_size[dim] || previous.up_grid_size[dim] != current.up_grid_size[dim]) cached = false;
+    }
+
+    // hash every label and find the location and cost of the changed ones
+    current.hashes.resize(max_label);
+    current.offsets.resize(NOUTPUTS * max_label);
+    std::vector<int64_t> label_offsets = std::vector<int64_t>(max_label);
+    std::vector<int64_t> memory_costs = std::vector<int64_t>(max_label, 0);
+    std::vector<bool> changed = std::vector<bool>(max_label, true);
+    std::vector<int64_t> nelements = std::vector<int64_t>(max_label);
+    std::vector<int64_t> order;
+
+    std::vector<int64_t> down_elements, up_elements;
+    int64_t offset = 4 * sizeof(int64_t);
+    for (int64_t label = 0; label < max_label; ++label) {
+        int64_t up_nelements;
+        if (fread(&(nelements[label]), sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return -1; }
+        if (fread(&up_nelements, sizeof(int64_t), 1, ufp) != 1 || up_nelements != nelements[label]) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return -1; }
+
+        down_elements.resize(nelements[label]);
+        up_elements.resize(nelements[label]);
+        if (fread(down_elements.data(), sizeof(int64_t), nelements[label], dfp) != (uint64_t)nelements[label]) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return -1; }
+        if (fread(up_elements.data(), sizeof(int64_t), nelements[label], ufp) != (uint64_t)nelements[label]) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return -1; }
+
+        label_offsets[label] = offset;
+        offset += (1 + nelements[label]) * sizeof(int64_t);
+
+        current.hashes[label] = CppLabelHash(down_elements, up_elements);
+        if (cached && label < previous.max_label && previous.hashes[label] == current.hashes[label]) changed[label] = false;
+        if (!changed[label]) continue;
+
+        // the upsampled elements are held alongside the thinning volume
+        int64_t bounding_box[6];
+        CppSegmentBoundingBox(current.down_grid_size, down_elements.data(), nelements[label], bounding_box);
+        memory_costs[label] = CppThinningMemoryCost(nelements[label], bounding_box, false) + nelements[label] * sizeof(int64_t);
+        order.push_back(label);
+    }
+
+    // thin the largest labels first so that no single large label is left running alone at the end
+    std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b) { return nelements[a] > nelements[b]; });
+
+    // the unchanged labels come from the previous outputs which are replaced once the new ones are complete
+    FILE *previous_fps[NOUTPUTS] = { NULL, NULL, NULL };
+    FILE *wfps[NOUTPUTS];
+    for (int io = 0; io < NOUTPUTS; ++io) {
+        if (cached) {
+            previous_fps[io] = CppOpenArtifact(output_filenames[io], "rb");
+            if (!previous_fps[io]) { fprintf(stderr, "Failed to read %s\n", output_filenames[io]); return -1; }
+        }
+
+        wfps[io] = CppOpenArtifact(partial_filenames[io], "wb");
+        if (!wfps[io]) { fprintf(stderr, "Failed to write %s\n", partial_filenames[io]); return -1; }
+
+        // the downsampled skeleton is in the downsampled grid and the other outputs in the input grid
+        int64_t *grid_size = io ? current.up_grid_size : current.down_grid_size;
+        if (!CppWriteSkeletonHeader(wfps[io], grid_size, max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to write %s\n", partial_filenames[io]); return -1; }
+    }
+
+    // every worker gets its own working volume
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    ThinningContext *context = CppNewThinningContext(lookup_table_directory);
+    if (!context) return -1;
+
+    CppSetThinningGridSize(context, current.down_grid_size);
+    std::vector<ThinningContext *> workers = std::vector<ThinningContext *>(num_threads);
+    for (int64_t thread = 0; thread < num_threads; ++thread)
+        workers[thread] = CppNewWorkerThinningContext(context);
+
+    int64_t positions[NOUTPUTS] = { 4 * sizeof(int64_t), 4 * sizeof(int64_t), 4 * sizeof(int64_t) };
+    int64_t next_label = 0;
+    char *block = new char[copy_block_size];
+
+    // copy the unchanged labels [next_label, label) which are consecutive in the previous outputs (the changed labels
+    // before label are already written)
+    std::function<bool(int64_t)> copy_unchanged = [&](int64_t label) {
+        if (next_label >= label) return true;
+
+        for (int io = 0; io < NOUTPUTS; ++io) {
+            int64_t start = previous.offsets[NOUTPUTS * next_label + io];
+            int64_t end = label < previous.max_label ? previous.offsets[NOUTPUTS * label + io] : previous.file_sizes[io];
+            if (!CopyBytes(previous_fps[io], start, end - start, wfps[io], block)) { fprintf(stderr, "Failed to copy %s\n", output_filenames[io]); return false; }
+
+            for (int64_t iv = next_label; iv < label; ++iv)
+                current.offsets[NOUTPUTS * iv + io] = positions[io] + previous.offsets[NOUTPUTS * iv + io] - start;
+            positions[io] += end - start;
+        }
+        next_label = label;
+
+        return true;
+    };
+
+    std::function<bool(int64_t, IncrementalSkeleton &)> read = [&](int64_t label, IncrementalSkeleton &item) {
+        int64_t num = nelements[label];
+
+        item.label = label;
+        item.down_elements.resize(num);
+        item.up_elements.resize(num);
+
+        // the downsampled and upsampled files have the same number of elements for every label
+        if (fseek(dfp, label_offsets[label] + sizeof(int64_t), SEEK_SET)) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return false; }
+        if (fread(item.down_elements.data(), sizeof(int64_t), num, dfp) != (uint64_t)num) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return false; }
+        if (fseek(ufp, label_offsets[label] + sizeof(int64_t), SEEK_SET)) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return false; }
+        if (fread(item.up_elements.data(), sizeof(int64_t), num, ufp) != (uint64_t)num) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return false; }
+
+        return true;
+    };
+
+    std::function<void(int64_t, IncrementalSkeleton &)> process = [&](int64_t thread, IncrementalSkeleton &item) {
+        item.down_skeleton.resize(item.down_elements.size());
+        int64_t nskeleton = CppThinSegment(workers[thread], item.down_elements.data(), item.down_elements.size(), item.down_skeleton.data());
+        item.down_skeleton.resize(nskeleton);
+
+        // find the endpoint vectors and upsample the skeleton (endpoints remain negative)
+        item.up_skeleton = item.down_skeleton;
+        CppUpsampleLabelSkeleton(current.down_grid_size, item.down_elements, item.up_elements, item.up_skeleton, item.up_endpoints, item.vectors);
+
+        // only the outputs wait for the writer
+        std::vector<int64_t>().swap(item.down_elements);
+        std::vector<int64_t>().swap(item.up_elements);
+    };
+
+    std::function<bool(IncrementalSkeleton &)> write = [&](IncrementalSkeleton &item) {
+        if (!copy_unchanged(item.label)) return false;
+
+        for (int io = 0; io < NOUTPUTS; ++io)
+            current.offsets[NOUTPUTS * item.label + io] = positions[io];
+
+        std::vector<int64_t> *skeletons[2] = { &(item.down_skeleton), &(item.up_skeleton) };
+        for (int io = 0; io < 2; ++io) {
+            int64_t nskeleton = skeletons[io]->size();
+            if (fwrite(&nskeleton, sizeof(int64_t), 1, wfps[io]) != 1) { fprintf(stderr, "Failed to write %s\n", partial_filenames[io]); return false; }
+            if (fwrite(skeletons[io]->data(), sizeof(int64_t), nskeleton, wfps[io]) != (uint64_t)nskeleton) { fprintf(stderr, "Failed to write %s\n", partial_filenames[io]); return false; }
+            positions[io] += (1 + nskeleton) * sizeof(int64_t);
+        }
+
+        int64_t nendpoints = item.up_endpoints.size();
+        if (fwrite(&nendpoints, sizeof(int64_t), 1, wfps[2]) != 1) { fprintf(stderr, "Failed to write %s\n", partial_filenames[2]); return false; }
+        for (int64_t ie = 0; ie < nendpoints; ++ie) {
+            if (fwrite(&(item.up_endpoints[ie]), sizeof(int64_t), 1, wfps[2]) != 1) { fprintf(stderr, "Failed to write %s\n", partial_filenames[2]); return false; }
+            if (fwrite(&(item.vectors[3 * ie]), sizeof(double), 3, wfps[2]) != 3) { fprintf(stderr, "Failed to write %s\n", partial_filenames[2]); return false; }
+        }
+        positions[2] += sizeof(int64_t) + nendpoints * (sizeof(int64_t) + 3 * sizeof(double));
+
+        next_label = item.label + 1;
+
+        return true;
+    };
+
+    std::function<int64_t(IncrementalSkeleton &)> result_bytes = [&](IncrementalSkeleton &item) {
+        return (int64_t) ((item.down_skeleton.capacity() + item.up_skeleton.capacity() + item.up_endpoints.capacity()) * sizeof(int64_t) + item.vectors.capacity() * sizeof(double));
+    };
+
+    bool succeeded = RunScheduledPipeline(order, memory_costs, memory_budget, num_threads, read, process, write, result_bytes) && copy_unchanged(max_label);
+    delete[] block;
+
+    // close the I/O files
+    fclose(dfp);
+    fclose(ufp);
+    for (int io = 0; io < NOUTPUTS; ++io) {
+        if (previous_fps[io]) fclose(previous_fps[io]);
+        if (!succeeded) CppDiscardArtifact(wfps[io]);
+        else if (fclose(wfps[io])) { fprintf(stderr, "Failed to write %s\n", partial_filenames[io]); succeeded = false; }
+    }
+
+    for (int64_t thread = 0; thread < num_threads; ++thread)
+        CppDeleteThinningContext(workers[thread]);
+    CppDeleteThinningContext(context);
+
+    if (!succeeded) return -1;
+
+    // replace the previous outputs and save the hashes and offsets for the next call
+    for (int io = 0; io < NOUTPUTS; ++io) {
+        if (CppRenameArtifact(partial_filenames[io], output_filenames[io])) { fprintf(stderr, "Failed to write %s\n", output_filenames[io]); return -1; }
+        current.file_sizes[io] = positions[io];
+    }
+    if (!WriteSkeletonCache(cache_filename, current)) { fprintf(stderr, "Failed to write %s\n", cache_filename); return -1; }
+
+    return order.size();
+}
@@ -0,0 +1,273 @@
+#ifndef __CPP_PERF__
+#define __CPP_PERF__
+
+// hardware counters around the hot loops of thinning and downsampling; compiled in with -DPERF_COUNTERS (linux only)
+// and otherwise every scope is empty. PERF_SCOPE(scope) counts the rest of the enclosing block (inclusive of nested
+// scopes) and CppPrintPerfCounters prints the totals over all threads since the last print (a thread releases its
+// counters when it exits and leaves its totals behind).
+
+#include <inttypes.h>
+#include <stdio.h>
+
+enum PerfScope {
+    PERF_COLLECT_NEIGHBORS,
+    PERF_SIMPLE_LOOKUP,
+    PERF_ISTHMUS_LOOKUP,
+    PERF_DETECT_BORDER_POINTS,
+    PERF_DOWNSAMPLE_SCAN,
+    PERF_REPRESENTATIVE_SEARCH,
+    NPERF_SCOPES
+};
+
+
+
+#ifndef PERF_COUNTERS
+
+#define PERF_SCOPE(scope)
+
+inline void CppPrintPerfCounters(const char *stage) { (void) stage; }
+
+#else
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+static const int NPERF_COUNTERS = 4;
+static const char *const perf_scope_names[NPERF_SCOPES] = { "Collect26Neighbors", "Simple26_6", "Isthmus", "DetectSimpleBorderPoints", "DownsampleScan", "RepresentativeSearch" };
+static const char *const perf_counter_names[NPERF_COUNTERS] = { "cycles", "instructions", "llc-misses", "branch-misses" };
+
+
+
+// the counters of one thread (read in user space with rdpmc when the kernel allows it) and its totals per scope
+struct PerfThread {
+    int fds[NPERF_COUNTERS];
+    struct perf_event_mmap_page *pages[NPERF_COUNTERS];
+    uint64_t calls[NPERF_SCOPES];
+    uint64_t totals[NPERF_SCOPES][NPERF_COUNTERS];
+};
+
+
+
+// the threads that count and the totals of the threads that exited since the last print (zero initialized)
+struct PerfRegistry {
+    std::mutex mutex;
+    std::vector<PerfThread *> threads;
+    uint64_t calls[NPERF_SCOPES];
+    uint64_t totals[NPERF_SCOPES][NPERF_COUNTERS];
+    bool available;
+};
+
+
+
+inline PerfRegistry &CurrentPerfRegistry(void)
+{
+    static PerfRegistry registry;
+
+    return registry;
+}
+
+
+
+inline PerfThread *NewPerfThread(void)
+{
+    static const uint64_t configs[NPERF_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+    PerfThread *thread = new PerfThread();
+    memset(thread, 0, sizeof(PerfThread));
+
+    for (int ic = 0; ic < NPERF_COUNTERS; ++ic) {
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(attributes);
+        attributes.config = configs[ic];
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        // counters that the machine does not have (or may not be read) stay at zero
+        thread->fds[ic] = syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+        thread->pages[ic] = NULL;
+        if (thread->fds[ic] < 0) continue;
+
+        void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, thread->fds[ic], 0);
+        if (page != MAP_FAILED) thread->pages[ic] = (struct perf_event_mmap_page *) page;
+    }
+
+    PerfRegistry &registry = CurrentPerfRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.push_back(thread);
+
+    return thread;
+}
+
+
+
+// keep the totals of an exiting thread and release its counters
+inline void DeletePerfThread(PerfThread *thread)
+{
+    {
+        PerfRegistry &registry = CurrentPerfRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        for (int is = 0; is < NPERF_SCOPES; ++is) {
+            registry.calls[is] += thread->calls[is];
+            for (int ic = 0; ic < NPERF_COUNTERS; ++ic)
+                registry.totals[is][ic] += thread->totals[is][ic];
+        }
+        for (int ic = 0; ic < NPERF_COUNTERS; ++ic)
+            if (thread->fds[ic] >= 0) registry.available = true;
+
+        registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), thread));
+    }
+
+    for (int ic = 0; ic < NPERF_COUNTERS; ++ic) {
+        if (thread->pages[ic]) munmap(thread->pages[ic], sysconf(_SC_PAGESIZE));
+        if (thread->fds[ic] >= 0) close(thread->fds[ic]);
+    }
+    delete thread;
+}
+
+
+
+// the counters of a thread live until it exits (thread locals are destroyed before the registry)
+struct PerfThreadOwner {
+    PerfThread *thread;
+
+    ~PerfThreadOwner() { if (thread) DeletePerfThread(thread); }
+};
+
+
+
+inline PerfThread *CurrentPerfThread(void)
+{
+    static thread_local PerfThreadOwner owner = { NULL };
+    if (!owner.thread) owner.thread = NewPerfThread();
+
+    return owner.thread;
+}
+
+
+
+inline uint64_t ReadPerfCounter(PerfThread *thread, int counter)
+{
+    if (thread->fds[counter] < 0) return 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    // a system call per read would cost more than the small scopes measure
+    struct perf_event_mmap_page *page = thread->pages[counter];
+    if (page && page->cap_user_rdpmc) {
+        uint32_t sequence;
+        uint64_t count;
+        do {
+            sequence = page->lock;
+            __sync_synchronize();
+
+            uint32_t index = page->index;
+            count = page->offset;
+            if (index) {
+                uint32_t low, high;
+                __asm__ volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (index - 1));
+                int64_t pmc = ((uint64_t) high << 32) | low;
+
+                // sign extend the counter from its width
+                pmc <<= 64 - page->pmc_width;
+                pmc >>= 64 - page->pmc_width;
+                count += pmc;
+            }
+
+            __sync_synchronize();
+        } while (page->lock != sequence);
+
+        return count;
+    }
+#endif
+
+    uint64_t count;
+    if (read(thread->fds[counter], &count, sizeof(uint64_t)) != sizeof(uint64_t)) return 0;
+
+    return count;
+}
+
+
+
+class PerfScopeCounter {
+public:
+    PerfScopeCounter(PerfScope scope) : scope(scope), thread(CurrentPerfThread())
+    {
+        for (int ic = 0; ic < NPERF_COUNTERS; ++ic)
+            start[ic] = ReadPerfCounter(thread, ic);
+    }
+
+    ~PerfScopeCounter()
+    {
+        for (int ic = 0; ic < NPERF_COUNTERS; ++ic)
+            thread->totals[scope][ic] += ReadPerfCounter(thread, ic) - start[ic];
+        thread->calls[scope]++;
+    }
+
+private:
+    PerfScope scope;
+    PerfThread *thread;
+    uint64_t start[NPERF_COUNTERS];
+};
+
+#define PERF_SCOPE_VARIABLE(line) perf_scope_##line
+#define PERF_SCOPE_NAME(line) PERF_SCOPE_VARIABLE(line)
+#define PERF_SCOPE(scope) PerfScopeCounter PERF_SCOPE_NAME(__LINE__)(scope)
+
+
+
+// print and reset the totals (only call once the threads that count have finished)
+inline void CppPrintPerfCounters(const char *stage)
+{
+    PerfRegistry &registry = CurrentPerfRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    std::vector<PerfThread *> &threads = registry.threads;
+
+    fprintf(stderr, "Hardware counters for %s:\n", stage);
+
+    bool available = registry.available;
+    for (uint64_t it = 0; it < threads.size(); ++it)
+        for (int ic = 0; ic < NPERF_COUNTERS; ++ic)
+            if (threads[it]->fds[ic] >= 0) available = true;
+    if (!available) fprintf(stderr, "  counters are unavailable (see /proc/sys/kernel/perf_event_paranoid) so only calls are counted\n");
+
+    fprintf(stderr, "  %-26s %12s", "scope", "calls");
+    for (int ic = 0; ic < NPERF_COUNTERS; ++ic)
+        fprintf(stderr, " %16s", perf_counter_names[ic]);
+    fprintf(stderr, "\n");
+
+    for (int is = 0; is < NPERF_SCOPES; ++is) {
+        uint64_t calls = registry.calls[is];
+        uint64_t totals[NPERF_COUNTERS];
+        registry.calls[is] = 0;
+        for (int ic = 0; ic < NPERF_COUNTERS; ++ic) {
+            totals[ic] = registry.totals[is][ic];
+            registry.totals[is][ic] = 0;
+        }
+        for (uint64_t it = 0; it < threads.size(); ++it) {
+            calls += threads[it]->calls[is];
+            threads[it]->calls[is] = 0;
+            for (int ic = 0; ic < NPERF_COUNTERS; ++ic) {
+                totals[ic] += threads[it]->totals[is][ic];
+                threads[it]->totals[is][ic] = 0;
+            }
+        }
+        if (!calls) continue;
+
+        fprintf(stderr, "  %-26s %12lu", perf_scope_names[is], calls);
+        for (int ic = 0; ic < NPERF_COUNTERS; ++ic)
+            fprintf(stderr, " %16lu", totals[ic]);
+        fprintf(stderr, "\n");
+    }
+}
+
+#endif
+
+#endif
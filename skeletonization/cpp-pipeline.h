@@ -0,0 +1,241 @@
+#ifndef __CPP_PIPELINE__
+#define __CPP_PIPELINE__
+
+#include <inttypes.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+// number of labels that can wait between two stages before the producer blocks
+static const int64_t pipeline_queue_depth = 16;
+
+
+
+// queue between two pipeline stages (push blocks while full, pop blocks while empty)
+template <typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(int64_t capacity) : capacity(capacity), closed(false) {}
+
+    void Push(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this]() { return (int64_t) items.size() < capacity; });
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+    }
+
+    // returns false once the queue is closed and drained
+    bool Pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]() { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    int64_t capacity;
+    bool closed;
+};
+
+
+
+// elements of a single label passed between the stages
+struct LabelElements {
+    int64_t label;
+    std::vector<int64_t> elements;
+};
+
+
+
+// memory reserved by the labels in flight: a label reserves its working memory until it is processed and then only
+// the bytes of its result until it is written. A label waits while others are processing and the budget is full,
+// but never for results alone, since the result that the writer waits for may belong to a label that is not read yet
+// (a label larger than the whole budget runs alone).
+class MemoryBudget {
+public:
+    MemoryBudget(int64_t budget) : budget(budget), in_use(0), processing(0) {}
+
+    void Acquire(int64_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [this, bytes]() { return budget <= 0 || !processing || in_use + bytes <= budget; });
+        in_use += bytes;
+        processing++;
+    }
+
+    // the working memory of a processed label is released except for the bytes of its result
+    void Processed(int64_t bytes, int64_t result_bytes)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        in_use -= bytes - result_bytes;
+        processing--;
+        released.notify_all();
+    }
+
+    void Release(int64_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        in_use -= bytes;
+        released.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable released;
+    int64_t budget;
+    int64_t in_use;
+    int64_t processing;
+};
+
+
+
+// read labels in the scheduled order, process the nparts independent parts of every label on nthreads workers,
+// merge the parts of a label once they are all processed and write the labels in increasing label order; each label
+// reserves memory_costs[label] bytes of the memory budget (zero for no budget) from before it is read until it is
+// merged and then result_bytes(item) until it is written (so merge should free everything that write does not
+// need); returns false if any read or write failed
+template <typename Item>
+bool RunPartitionedPipeline(std::vector<int64_t> &order, std::vector<int64_t> &memory_costs, int64_t memory_budget, int64_t nthreads, std::function<bool(int64_t label, Item &item)> read, std::function<int64_t(Item &item)> nparts, std::function<void(int64_t thread, Item &item, int64_t part)> process, std::function<void(Item &item)> merge, std::function<bool(Item &item)> write, std::function<int64_t(Item &item)> result_bytes)
+{
+    // the parts of a label point to the same item which is merged by the worker that finishes the last part
+    struct PartitionedItem {
+        Item item;
+        std::atomic<int64_t> remaining;
+    };
+    struct Part {
+        PartitionedItem *partitioned;
+        int64_t part;
+    };
+
+    BoundedQueue<Part> read_queue(pipeline_queue_depth);
+    BoundedQueue<Item> write_queue(pipeline_queue_depth);
+    MemoryBudget budget(memory_budget);
+    std::atomic<bool> failed(false);
+
+    std::thread reader([&]() {
+        for (uint64_t il = 0; il < order.size() && !failed; ++il) {
+            int64_t label = order[il];
+            budget.Acquire(memory_costs[label]);
+
+            PartitionedItem *partitioned = new PartitionedItem();
+            if (!read(label, partitioned->item)) { budget.Processed(memory_costs[label], 0); delete partitioned; failed = true; break; }
+
+            int64_t nitem_parts = std::max((int64_t) 1, nparts(partitioned->item));
+            partitioned->remaining = nitem_parts;
+            for (int64_t ip = 0; ip < nitem_parts; ++ip) {
+                Part part = { partitioned, ip };
+                read_queue.Push(part);
+            }
+        }
+        read_queue.Close();
+    });
+
+    // results finish out of order so the writer holds them until all earlier labels are written
+    std::vector<int64_t> write_order = order;
+    std::sort(write_order.begin(), write_order.end());
+
+    std::thread writer([&]() {
+        std::map<int64_t, Item> finished;
+        uint64_t next_write = 0;
+
+        Item item;
+        while (write_queue.Pop(item)) {
+            int64_t label = item.label;
+            finished[label] = std::move(item);
+
+            while (next_write < write_order.size() && finished.count(write_order[next_write])) {
+                typename std::map<int64_t, Item>::iterator it = finished.find(write_order[next_write]);
+                int64_t bytes = result_bytes(it->second);
+                if (!failed && !write(it->second)) failed = true;
+                finished.erase(it);
+                budget.Release(bytes);
+                next_write++;
+            }
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (int64_t thread = 0; thread < nthreads; ++thread) {
+        workers.push_back(std::thread([&, thread]() {
+            Part part;
+            while (read_queue.Pop(part)) {
+                PartitionedItem *partitioned = part.partitioned;
+                if (!failed) process(thread, partitioned->item, part.part);
+                if (--(partitioned->remaining)) continue;
+
+                int64_t label = partitioned->item.label;
+                if (!failed) merge(partitioned->item);
+                budget.Processed(memory_costs[label], result_bytes(partitioned->item));
+                write_queue.Push(partitioned->item);
+                delete partitioned;
+            }
+        }));
+    }
+
+    reader.join();
+    for (uint64_t it = 0; it < workers.size(); ++it)
+        workers[it].join();
+    write_queue.Close();
+    writer.join();
+
+    return !failed;
+}
+
+
+
+// read labels in the scheduled order, process them on nthreads workers and write them in increasing label order;
+// each label reserves memory_costs[label] bytes of the memory budget (zero for no budget) from before it is read
+// until it is processed and then result_bytes(item) until it is written; returns false if any read or write failed
+template <typename Item>
+bool RunScheduledPipeline(std::vector<int64_t> &order, std::vector<int64_t> &memory_costs, int64_t memory_budget, int64_t nthreads, std::function<bool(int64_t label, Item &item)> read, std::function<void(int64_t thread, Item &item)> process, std::function<bool(Item &item)> write, std::function<int64_t(Item &item)> result_bytes)
+{
+    std::function<int64_t(Item &)> single_part = [](Item &) { return (int64_t) 1; };
+    std::function<void(int64_t, Item &, int64_t)> process_part = [&](int64_t thread, Item &item, int64_t) { process(thread, item); };
+    std::function<void(Item &)> no_merge = [](Item &) {};
+
+    return RunPartitionedPipeline(order, memory_costs, memory_budget, nthreads, read, single_part, process_part, no_merge, write, result_bytes);
+}
+
+
+
+// read, process and write labels [label_start, label_end) concurrently: a reader thread prefetches labels, a single
+// worker processes them in order and a writer thread drains the results; returns false if any read or write failed
+template <typename Item>
+bool RunLabelPipeline(int64_t label_start, int64_t label_end, std::function<bool(int64_t label, Item &item)> read, std::function<void(Item &item)> process, std::function<bool(Item &item)> write)
+{
+    std::vector<int64_t> order;
+    for (int64_t label = label_start; label < label_end; ++label)
+        order.push_back(label);
+    std::vector<int64_t> memory_costs = std::vector<int64_t>(label_end, 0);
+
+    std::function<void(int64_t, Item &)> process_in_order = [&](int64_t, Item &item) { process(item); };
+    std::function<int64_t(Item &)> no_result_bytes = [](Item &) { return (int64_t) 0; };
+
+    return RunScheduledPipeline(order, memory_costs, 0, 1, read, process_in_order, write, no_result_bytes);
+}
+
+#endif
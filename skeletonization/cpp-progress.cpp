@@ -0,0 +1,143 @@
+/* c++ file to report the progress of the native stages and let the caller cancel them */
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include "cpp-progress.h"
+
+
+
+// the callback of one call and the totals of its running stage (the mutex only guards the totals, the callback is
+// called on a copy after the mutex is released)
+struct ProgressContext {
+    ProgressCallback callback;
+    void *data;
+    double interval;
+
+    std::mutex mutex;
+    std::string stage;
+    StageProgress progress;
+    std::atomic<bool> cancelled;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point report_time;
+    int64_t report_voxels;
+    int64_t report_bytes;
+};
+
+
+
+ProgressContext *CppNewProgressContext(ProgressCallback callback, void *data, double interval)
+{
+    ProgressContext *progress = new ProgressContext();
+    progress->callback = callback;
+    progress->data = data;
+    progress->interval = interval;
+    progress->cancelled = false;
+
+    CppStartProgress(progress, "", 0, 0);
+
+    return progress;
+}
+
+
+
+void CppDeleteProgressContext(ProgressContext *progress)
+{
+    delete progress;
+}
+
+
+
+void CppStartProgress(ProgressContext *progress, const char *stage, int64_t nlabels, int64_t nvoxels)
+{
+    if (!progress) return;
+
+    std::unique_lock<std::mutex> lock(progress->mutex);
+
+    progress->stage = stage;
+    progress->progress.stage = progress->stage.c_str();
+    progress->progress.labels = 0;
+    progress->progress.nlabels = nlabels;
+    progress->progress.voxels = 0;
+    progress->progress.nvoxels = nvoxels;
+    progress->progress.bytes = 0;
+    progress->progress.seconds = 0;
+    progress->progress.voxels_per_second = 0;
+    progress->progress.bytes_per_second = 0;
+    progress->cancelled = false;
+
+    progress->start_time = std::chrono::steady_clock::now();
+    progress->report_time = progress->start_time;
+    progress->report_voxels = 0;
+    progress->report_bytes = 0;
+}
+
+
+
+// copy the totals so far with the rates since the previous call (the mutex is held)
+static StageProgress ProgressSnapshot(ProgressContext *progress)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - progress->report_time).count();
+
+    progress->progress.seconds = std::chrono::duration<double>(now - progress->start_time).count();
+    progress->progress.voxels_per_second = elapsed > 0 ? (progress->progress.voxels - progress->report_voxels) / elapsed : 0;
+    progress->progress.bytes_per_second = elapsed > 0 ? (progress->progress.bytes - progress->report_bytes) / elapsed : 0;
+
+    progress->report_time = now;
+    progress->report_voxels = progress->progress.voxels;
+    progress->report_bytes = progress->progress.bytes;
+
+    return progress->progress;
+}
+
+
+
+bool CppReportProgress(ProgressContext *progress, int64_t labels, int64_t voxels, int64_t bytes)
+{
+    if (!progress) return false;
+
+    StageProgress snapshot;
+    {
+        std::unique_lock<std::mutex> lock(progress->mutex);
+
+        progress->progress.labels += labels;
+        progress->progress.voxels += voxels;
+        progress->progress.bytes += bytes;
+
+        // the callback is not called again between the cancellation and the end of the stage, and the thread that
+        // takes the snapshot moves the report time so that the others do not call it for the same interval
+        if (progress->cancelled || std::chrono::duration<double>(std::chrono::steady_clock::now() - progress->report_time).count() < progress->interval) return progress->cancelled;
+        snapshot = ProgressSnapshot(progress);
+    }
+
+    if (progress->callback && progress->callback(&snapshot, progress->data)) progress->cancelled = true;
+
+    return progress->cancelled;
+}
+
+
+
+bool CppProgressCancelled(ProgressContext *progress)
+{
+    return progress && progress->cancelled;
+}
+
+
+
+bool CppFinishProgress(ProgressContext *progress)
+{
+    if (!progress) return false;
+
+    StageProgress snapshot;
+    {
+        std::unique_lock<std::mutex> lock(progress->mutex);
+        snapshot = ProgressSnapshot(progress);
+    }
+
+    // a cancellation on the last call comes too late to stop anything
+    if (progress->callback) progress->callback(&snapshot, progress->data);
+
+    return progress->cancelled;
+}
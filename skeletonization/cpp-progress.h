@@ -0,0 +1,40 @@
+#ifndef __CPP_PROGRESS__
+#define __CPP_PROGRESS__
+
+#include <inttypes.h>
+
+
+
+// progress of a long native stage (downsampling or thinning) for job managers. The stage adds the labels, voxels and
+// bytes it finished and the callback is called at most once every interval seconds from whichever thread added them,
+// and once more when the stage ends. The totals are zero while unknown and the rates cover the time since the
+// previous call. A callback that returns true cancels the stage, which stops at the next consistent point.
+typedef struct {
+    const char *stage;
+    int64_t labels;
+    int64_t nlabels;
+    int64_t voxels;
+    int64_t nvoxels;
+    int64_t bytes;
+    double seconds;
+    double voxels_per_second;
+    double bytes_per_second;
+} StageProgress;
+
+typedef bool (*ProgressCallback)(const StageProgress *progress, void *data);
+
+// the callback of one call (every stage function takes its own context so that concurrent calls never share one, and
+// a NULL context reports nothing and is never cancelled)
+struct ProgressContext;
+
+ProgressContext *CppNewProgressContext(ProgressCallback callback, void *data, double interval);
+void CppDeleteProgressContext(ProgressContext *progress);
+
+// a stage starts, adds its work from any thread (returns true once the stage is cancelled) and finishes with a last
+// call of the callback (returns whether the stage was cancelled); the callback is never called with a lock held
+void CppStartProgress(ProgressContext *progress, const char *stage, int64_t nlabels, int64_t nvoxels);
+bool CppReportProgress(ProgressContext *progress, int64_t labels, int64_t voxels, int64_t bytes);
+bool CppProgressCancelled(ProgressContext *progress);
+bool CppFinishProgress(ProgressContext *progress);
+
+#endif
@@ -0,0 +1,425 @@
+/* c++ file to answer skeleton requests from a resident copy of the downsampled labels */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpp-generate_skeletons.h"
+#include "cpp-storage.h"
+
+
+
+// requests are an operation, the prefix length and prefix, the skeleton resolution and a list of labels (all int64);
+// responses start with a status of zero (or -1 on failure) followed by the answer to the operation
+static const int64_t SERVICE_SKELETONS = 0;     // number of labels then every upsampled skeleton and its endpoint vectors
+static const int64_t SERVICE_VECTORS = 1;       // number of labels then only the endpoint vectors of every label
+static const int64_t SERVICE_RETHIN = 2;        // reread the downsampled labels and answer as SERVICE_SKELETONS
+static const int64_t SERVICE_SHUTDOWN = 3;      // no answer
+
+// prefixes and label lists are only sanity checked
+static const int64_t max_prefix_length = 1024;
+static const int64_t max_request_labels = 1 << 24;
+
+
+
+// an upsampled skeleton (endpoints are negative) with the endpoint vectors in z, y, x
+typedef struct {
+    std::vector<int64_t> skeleton;
+    std::vector<int64_t> up_endpoints;
+    std::vector<double> vectors;
+} ServiceSkeleton;
+
+
+
+// the downsampled and upsampled elements of every label of one prefix and resolution
+typedef struct {
+    int64_t down_grid_size[3];
+    int64_t up_grid_size[3];
+    int64_t max_label;
+    std::vector<std::vector<int64_t> > down_elements;
+    std::vector<std::vector<int64_t> > up_elements;
+    std::vector<uint64_t> hashes;
+
+    // skeletons are thinned the first time they are requested
+    std::mutex skeleton_mutex;
+    std::vector<std::shared_ptr<ServiceSkeleton> > skeletons;
+} ServiceDataset;
+
+
+
+typedef struct {
+    ThinningContext *context;
+    int listen_fd;
+    bool shutdown;
+
+    // datasets are replaced rather than modified so connections can keep using the one they looked up
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<ServiceDataset> > datasets;
+    std::set<int> connection_fds;
+    std::condition_variable connections_closed;
+} SkeletonService;
+
+
+
+static bool ReadAll(int fd, void *buffer, int64_t nbytes)
+{
+    char *bytes = (char *) buffer;
+    while (nbytes > 0) {
+        ssize_t nread = read(fd, bytes, nbytes);
+        if (nread < 0 && errno == EINTR) continue;
+        if (nread <= 0) return false;
+
+        bytes += nread;
+        nbytes -= nread;
+    }
+
+    return true;
+}
+
+
+
+static bool WriteAll(int fd, const void *buffer, int64_t nbytes)
+{
+    const char *bytes = (const char *) buffer;
+    while (nbytes > 0) {
+        // a client that disconnects must not take down the service
+        ssize_t nwritten = send(fd, bytes, nbytes, MSG_NOSIGNAL);
+        if (nwritten < 0 && errno == EINTR) continue;
+        if (nwritten <= 0) return false;
+
+        bytes += nwritten;
+        nbytes -= nwritten;
+    }
+
+    return true;
+}
+
+
+
+static void AppendBytes(std::vector<char> &response, const void *buffer, int64_t nbytes)
+{
+    response.insert(response.end(), (const char *) buffer, (const char *) buffer + nbytes);
+}
+
+
+
+static void AppendInt64(std::vector<char> &response, int64_t value)
+{
+    AppendBytes(response, &value, sizeof(int64_t));
+}
+
+
+
+static bool ReadLabelElements(FILE *fp, int64_t max_label, std::vector<std::vector<int64_t> > &elements)
+{
+    elements.resize(max_label);
+    for (int64_t label = 0; label < max_label; ++label) {
+        int64_t nelements;
+        if (fread(&nelements, sizeof(int64_t), 1, fp) != 1) return false;
+
+        elements[label].resize(nelements);
+        if (fread(elements[label].data(), sizeof(int64_t), nelements, fp) != (uint64_t)nelements) return false;
+    }
+
+    return true;
+}
+
+
+
+static std::shared_ptr<ServiceDataset> ReadServiceDataset(const char *prefix, int64_t skeleton_resolution[3])
+{
+    // requests only read datasets inside skeletons/
+    if (strstr(prefix, "..")) { fprintf(stderr, "Rejected prefix %s\n", prefix); return NULL; }
+
+    char downsample_filename[4096];
+    sprintf(downsample_filename, "skeletons/%s/downsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    char upsample_filename[4096];
+    sprintf(upsample_filename, "skeletons/%s/upsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    std::shared_ptr<ServiceDataset> dataset = std::make_shared<ServiceDataset>();
+
+    FILE *dfp = CppOpenArtifact(downsample_filename, "rb");
+    if (!dfp) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return NULL; }
+
+    int64_t down_max_label;
+    if (!CppReadSkeletonHeader(dfp, dataset->down_grid_size, &down_max_label, 0, ALL_LABELS) || !ReadLabelElements(dfp, down_max_label, dataset->down_elements)) {
+        fprintf(stderr, "Failed to read %s\n", downsample_filename);
+        fclose(dfp);
+        return NULL;
+    }
+    fclose(dfp);
+
+    FILE *ufp = CppOpenArtifact(upsample_filename, "rb");
+    if (!ufp) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return NULL; }
+
+    int64_t up_max_label;
+    if (!CppReadSkeletonHeader(ufp, dataset->up_grid_size, &up_max_label, 0, ALL_LABELS) || !ReadLabelElements(ufp, up_max_label, dataset->up_elements)) {
+        fprintf(stderr, "Failed to read %s\n", upsample_filename);
+        fclose(ufp);
+        return NULL;
+    }
+    fclose(ufp);
+
+    if (down_max_label != up_max_label) { fprintf(stderr, "Labels of %s do not match %s\n", downsample_filename, upsample_filename); return NULL; }
+    dataset->max_label = down_max_label;
+
+    dataset->hashes.resize(dataset->max_label);
+    for (int64_t label = 0; label < dataset->max_label; ++label) {
+        if (dataset->down_elements[label].size() != dataset->up_elements[label].size()) { fprintf(stderr, "Labels of %s do not match %s\n", downsample_filename, upsample_filename); return NULL; }
+        dataset->hashes[label] = CppLabelHash(dataset->down_elements[label], dataset->up_elements[label]);
+    }
+    dataset->skeletons.resize(dataset->max_label);
+
+    return dataset;
+}
+
+
+
+// get the resident dataset, reading it on first use or rereading it (keeping the skeletons of unchanged labels)
+static std::shared_ptr<ServiceDataset> GetServiceDataset(SkeletonService *service, const char *prefix, int64_t skeleton_resolution[3], bool reread)
+{
+    char key[4096];
+    sprintf(key, "%s-%03ldx%03ldx%03ld", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    std::shared_ptr<ServiceDataset> previous;
+    {
+        std::lock_guard<std::mutex> lock(service->mutex);
+        auto iter = service->datasets.find(key);
+        if (iter != service->datasets.end()) previous = iter->second;
+    }
+    if (previous && !reread) return previous;
+
+    // other connections continue with the previous dataset while the files are read
+    std::shared_ptr<ServiceDataset> dataset = ReadServiceDataset(prefix, skeleton_resolution);
+    if (!dataset) return NULL;
+
+    if (previous) {
+        bool same_grid = true;
+        for (int dim = 0; dim < 3; ++dim) {
+            if (previous->down_grid_size[dim] != dataset->down_grid_size[dim]) same_grid = false;
+            if (previous->up_grid_size[dim] != dataset->up_grid_size[dim]) same_grid = false;
+        }
+
+        std::lock_guard<std::mutex> lock(previous->skeleton_mutex);
+        for (int64_t label = 0; same_grid && label < std::min(previous->max_label, dataset->max_label); ++label) {
+            if (previous->hashes[label] == dataset->hashes[label]) dataset->skeletons[label] = previous->skeletons[label];
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(service->mutex);
+    service->datasets[key] = dataset;
+
+    return dataset;
+}
+
+
+
+static std::shared_ptr<ServiceSkeleton> GetServiceSkeleton(ThinningContext *worker, ServiceDataset *dataset, int64_t label)
+{
+    {
+        std::lock_guard<std::mutex> lock(dataset->skeleton_mutex);
+        if (dataset->skeletons[label]) return dataset->skeletons[label];
+    }
+
+    // thin without the lock so that other labels are answered concurrently (a label requested by two connections at
+    // once is thinned twice to the same skeleton)
+    std::vector<int64_t> &down_elements = dataset->down_elements[label];
+    std::vector<int64_t> &up_elements = dataset->up_elements[label];
+
+    std::shared_ptr<ServiceSkeleton> skeleton = std::make_shared<ServiceSkeleton>();
+    skeleton->skeleton.resize(down_elements.size());
+
+    CppSetThinningGridSize(worker, dataset->down_grid_size);
+    int64_t nskeleton = CppThinSegment(worker, down_elements.data(), down_elements.size(), skeleton->skeleton.data());
+    skeleton->skeleton.resize(nskeleton);
+
+    CppUpsampleLabelSkeleton(dataset->down_grid_size, down_elements, up_elements, skeleton->skeleton, skeleton->up_endpoints, skeleton->vectors);
+
+    std::lock_guard<std::mutex> lock(dataset->skeleton_mutex);
+    dataset->skeletons[label] = skeleton;
+
+    return skeleton;
+}
+
+
+
+static bool AnswerRequest(SkeletonService *service, ThinningContext *worker, int fd, std::vector<char> &response)
+{
+    int64_t operation, prefix_length;
+    if (!ReadAll(fd, &operation, sizeof(int64_t))) return false;
+    if (!ReadAll(fd, &prefix_length, sizeof(int64_t))) return false;
+    if (prefix_length < 0 || prefix_length >= max_prefix_length) return false;
+
+    char prefix[max_prefix_length];
+    if (!ReadAll(fd, prefix, prefix_length)) return false;
+    prefix[prefix_length] = '\0';
+
+    int64_t skeleton_resolution[3];
+    int64_t nlabels;
+    if (!ReadAll(fd, skeleton_resolution, 3 * sizeof(int64_t))) return false;
+    if (!ReadAll(fd, &nlabels, sizeof(int64_t))) return false;
+    if (nlabels < 0 || nlabels > max_request_labels) return false;
+
+    std::vector<int64_t> labels = std::vector<int64_t>(nlabels);
+    if (!ReadAll(fd, labels.data(), nlabels * sizeof(int64_t))) return false;
+
+    response.clear();
+    if (operation == SERVICE_SHUTDOWN) {
+        AppendInt64(response, 0);
+        WriteAll(fd, response.data(), response.size());
+
+        // stop accepting connections and end the others once their current request is answered
+        std::lock_guard<std::mutex> lock(service->mutex);
+        service->shutdown = true;
+        shutdown(service->listen_fd, SHUT_RDWR);
+        for (int connection_fd : service->connection_fds)
+            shutdown(connection_fd, SHUT_RD);
+
+        return false;
+    }
+
+    std::shared_ptr<ServiceDataset> dataset;
+    if (operation == SERVICE_SKELETONS || operation == SERVICE_VECTORS || operation == SERVICE_RETHIN)
+        dataset = GetServiceDataset(service, prefix, skeleton_resolution, operation == SERVICE_RETHIN);
+
+    bool valid = (dataset != NULL);
+    for (int64_t il = 0; valid && il < nlabels; ++il)
+        if (labels[il] < 0 || labels[il] >= dataset->max_label) valid = false;
+
+    if (!valid) {
+        AppendInt64(response, -1);
+        return WriteAll(fd, response.data(), response.size());
+    }
+
+    AppendInt64(response, 0);
+    AppendInt64(response, nlabels);
+    for (int64_t il = 0; il < nlabels; ++il) {
+        std::shared_ptr<ServiceSkeleton> skeleton = GetServiceSkeleton(worker, dataset.get(), labels[il]);
+
+        AppendInt64(response, labels[il]);
+        if (operation != SERVICE_VECTORS) {
+            AppendInt64(response, skeleton->skeleton.size());
+            AppendBytes(response, skeleton->skeleton.data(), skeleton->skeleton.size() * sizeof(int64_t));
+        }
+
+        // endpoints are followed by their vectors as in the endpoint vector files
+        int64_t nendpoints = skeleton->up_endpoints.size();
+        AppendInt64(response, nendpoints);
+        for (int64_t ie = 0; ie < nendpoints; ++ie) {
+            AppendInt64(response, skeleton->up_endpoints[ie]);
+            AppendBytes(response, &(skeleton->vectors[3 * ie]), 3 * sizeof(double));
+        }
+    }
+
+    return WriteAll(fd, response.data(), response.size());
+}
+
+
+
+static void ServeConnection(SkeletonService *service, int fd)
+{
+    // every connection thins with its own working volume
+    ThinningContext *worker = CppNewWorkerThinningContext(service->context);
+
+    std::vector<char> response;
+    while (AnswerRequest(service, worker, fd, response));
+
+    CppDeleteThinningContext(worker);
+
+    std::lock_guard<std::mutex> lock(service->mutex);
+    service->connection_fds.erase(fd);
+    close(fd);
+    if (service->connection_fds.empty()) service->connections_closed.notify_all();
+}
+
+
+
+// a socket that a previous service left behind (nothing accepts connections on it any more)
+static bool StaleSocket(const char *socket_path, struct sockaddr_un *address)
+{
+    struct stat socket_stat;
+    if (lstat(socket_path, &socket_stat) || !S_ISSOCK(socket_stat.st_mode)) return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    bool refused = connect(fd, (struct sockaddr *) address, sizeof(struct sockaddr_un)) && errno == ECONNREFUSED;
+    close(fd);
+
+    return refused;
+}
+
+
+
+// serve requests on a unix socket until a shutdown request arrives (returns 1 on a clean shutdown)
+int CppRunSkeletonService(const char *socket_path, const char *lookup_table_directory)
+{
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) { fprintf(stderr, "Socket path %s is too long\n", socket_path); return 0; }
+
+    SkeletonService *service = new SkeletonService();
+    service->shutdown = false;
+
+    // the lookup tables are read once and shared by every connection
+    service->context = CppNewThinningContext(lookup_table_directory);
+    if (!service->context) { delete service; return 0; }
+
+    service->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (service->listen_fd < 0) { fprintf(stderr, "Failed to create socket %s\n", socket_path); CppDeleteThinningContext(service->context); delete service; return 0; }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    // remove the socket of a previous service that did not shut down (other files and live services fail the bind)
+    if (StaleSocket(socket_path, &address)) unlink(socket_path);
+    if (bind(service->listen_fd, (struct sockaddr *) &address, sizeof(address)) || listen(service->listen_fd, SOMAXCONN)) {
+        fprintf(stderr, "Failed to listen on %s\n", socket_path);
+        close(service->listen_fd);
+        CppDeleteThinningContext(service->context);
+        delete service;
+        return 0;
+    }
+
+    while (true) {
+        int fd = accept(service->listen_fd, NULL, NULL);
+        if (fd < 0 && errno == EINTR) continue;
+
+        std::lock_guard<std::mutex> lock(service->mutex);
+        if (service->shutdown) { if (fd >= 0) close(fd); break; }
+        if (fd < 0) { fprintf(stderr, "Failed to accept on %s\n", socket_path); break; }
+
+        service->connection_fds.insert(fd);
+        std::thread(ServeConnection, service, fd).detach();
+    }
+
+    // a failed accept also ends the open connections
+    {
+        std::unique_lock<std::mutex> lock(service->mutex);
+        for (int connection_fd : service->connection_fds)
+            shutdown(connection_fd, SHUT_RD);
+        service->connections_closed.wait(lock, [&] { return service->connection_fds.empty(); });
+    }
+
+    bool clean = service->shutdown;
+
+    close(service->listen_fd);
+    unlink(socket_path);
+    CppDeleteThinningContext(service->context);
+    delete service;
+
+    return clean;
+}
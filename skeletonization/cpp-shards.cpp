@@ -0,0 +1,170 @@
+/* c++ file to split the skeleton outputs into label ranges and merge them back */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include "cpp-generate_skeletons.h"
+#include "cpp-storage.h"
+
+
+
+// size of the blocks copied from the shards into the merged file
+static const int64_t merge_block_size = 1 << 20;
+
+
+
+void CppSkeletonFilename(char *filename, const char *prefix, int64_t skeleton_resolution[3], const char *name, const char *extension, int64_t label_start, int64_t label_end)
+{
+    // the canonical file has every label, a shard has the labels [label_start, label_end)
+    if (label_end == ALL_LABELS) sprintf(filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-%s.%s", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z], name, extension);
+    else sprintf(filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-%s-shard-%ld-%ld.%s", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z], name, label_start, label_end, extension);
+}
+
+
+
+bool CppLabelRange(int64_t max_label, int64_t *label_start, int64_t *label_end, int64_t *first_label, int64_t *last_label)
+{
+    // without a range every label is processed
+    if (*label_end == ALL_LABELS) {
+        *first_label = 0;
+        *last_label = max_label;
+        return true;
+    }
+
+    // the last shard may ask for labels past the end of the volume
+    if (*label_end > max_label) *label_end = max_label;
+    if (*label_start < 0 || *label_start > *label_end) { fprintf(stderr, "Invalid label range [%ld, %ld)\n", *label_start, *label_end); return false; }
+
+    *first_label = *label_start;
+    *last_label = *label_end;
+
+    return true;
+}
+
+
+
+bool CppWriteSkeletonHeader(FILE *fp, int64_t grid_size[3], int64_t max_label, int64_t label_start, int64_t label_end)
+{
+    if (fwrite(&(grid_size[IB_Z]), sizeof(int64_t), 1, fp) != 1) return false;
+    if (fwrite(&(grid_size[IB_Y]), sizeof(int64_t), 1, fp) != 1) return false;
+    if (fwrite(&(grid_size[IB_X]), sizeof(int64_t), 1, fp) != 1) return false;
+    if (fwrite(&max_label, sizeof(int64_t), 1, fp) != 1) return false;
+
+    // shards also record their label range
+    if (label_end == ALL_LABELS) return true;
+    if (fwrite(&label_start, sizeof(int64_t), 1, fp) != 1) return false;
+    if (fwrite(&label_end, sizeof(int64_t), 1, fp) != 1) return false;
+
+    return true;
+}
+
+
+
+bool CppReadSkeletonHeader(FILE *fp, int64_t grid_size[3], int64_t *max_label, int64_t label_start, int64_t label_end)
+{
+    if (fread(&(grid_size[IB_Z]), sizeof(int64_t), 1, fp) != 1) return false;
+    if (fread(&(grid_size[IB_Y]), sizeof(int64_t), 1, fp) != 1) return false;
+    if (fread(&(grid_size[IB_X]), sizeof(int64_t), 1, fp) != 1) return false;
+    if (fread(max_label, sizeof(int64_t), 1, fp) != 1) return false;
+
+    if (label_end == ALL_LABELS) return true;
+
+    // make sure this is the shard that was asked for
+    int64_t shard_start, shard_end;
+    if (fread(&shard_start, sizeof(int64_t), 1, fp) != 1) return false;
+    if (fread(&shard_end, sizeof(int64_t), 1, fp) != 1) return false;
+
+    return shard_start == label_start && shard_end == label_end;
+}
+
+
+
+typedef struct {
+    const char *filename;
+    FILE *fp;
+    int64_t label_start;
+    int64_t label_end;
+} Shard;
+
+
+
+int CppMergeShards(const char *output_filename, const char **shard_filenames, int64_t nshards)
+{
+    if (!nshards) { fprintf(stderr, "No shards to merge into %s\n", output_filename); return 0; }
+
+    int64_t grid_size[3];
+    int64_t max_label = 0;
+
+    std::vector<Shard> shards = std::vector<Shard>(nshards);
+    FILE *wfp = NULL;
+    char *block = NULL;
+
+    // close every shard and drop the partial output (an earlier merged file in a container stays)
+    std::function<int()> fail = [&]() {
+        for (int64_t is = 0; is < nshards; ++is)
+            if (shards[is].fp) fclose(shards[is].fp);
+        if (wfp) CppDiscardArtifact(wfp);
+        delete[] block;
+        return 0;
+    };
+
+    // read the headers of all shards
+    for (int64_t is = 0; is < nshards; ++is) {
+        Shard &shard = shards[is];
+        shard.filename = shard_filenames[is];
+        shard.fp = CppOpenArtifact(shard.filename, "rb");
+        if (!shard.fp) { fprintf(stderr, "Failed to read %s\n", shard.filename); return fail(); }
+
+        int64_t shard_grid_size[3];
+        int64_t shard_max_label;
+        if (!CppReadSkeletonHeader(shard.fp, shard_grid_size, &shard_max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", shard.filename); return fail(); }
+        if (fread(&(shard.label_start), sizeof(int64_t), 1, shard.fp) != 1) { fprintf(stderr, "Failed to read %s\n", shard.filename); return fail(); }
+        if (fread(&(shard.label_end), sizeof(int64_t), 1, shard.fp) != 1) { fprintf(stderr, "Failed to read %s\n", shard.filename); return fail(); }
+
+        if (!is) {
+            grid_size[IB_Z] = shard_grid_size[IB_Z];
+            grid_size[IB_Y] = shard_grid_size[IB_Y];
+            grid_size[IB_X] = shard_grid_size[IB_X];
+            max_label = shard_max_label;
+        }
+        else if (grid_size[IB_Z] != shard_grid_size[IB_Z] || grid_size[IB_Y] != shard_grid_size[IB_Y] || grid_size[IB_X] != shard_grid_size[IB_X] || max_label != shard_max_label) {
+            fprintf(stderr, "Shard %s does not match %s\n", shard.filename, shards[0].filename);
+            return fail();
+        }
+    }
+
+    // the shards must cover every label exactly once
+    std::sort(shards.begin(), shards.end(), [](const Shard &a, const Shard &b) { return a.label_start < b.label_start; });
+
+    int64_t next_label = 0;
+    for (int64_t is = 0; is < nshards; ++is) {
+        if (shards[is].label_start != next_label) { fprintf(stderr, "Shards for %s are missing labels [%ld, %ld)\n", output_filename, next_label, shards[is].label_start); return fail(); }
+        next_label = shards[is].label_end;
+    }
+    if (next_label != max_label) { fprintf(stderr, "Shards for %s are missing labels [%ld, %ld)\n", output_filename, next_label, max_label); return fail(); }
+
+    wfp = CppOpenArtifact(output_filename, "wb");
+    if (!wfp) { fprintf(stderr, "Failed to write %s\n", output_filename); return fail(); }
+
+    if (!CppWriteSkeletonHeader(wfp, grid_size, max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to write %s\n", output_filename); return fail(); }
+
+    // the labels in each shard are already in the canonical layout so the bodies are copied as is
+    block = new char[merge_block_size];
+    for (int64_t is = 0; is < nshards; ++is) {
+        size_t nbytes;
+        while ((nbytes = fread(block, 1, merge_block_size, shards[is].fp)) > 0) {
+            if (fwrite(block, 1, nbytes, wfp) != nbytes) { fprintf(stderr, "Failed to write %s\n", output_filename); return fail(); }
+        }
+        if (ferror(shards[is].fp)) { fprintf(stderr, "Failed to read %s\n", shards[is].filename); return fail(); }
+
+        fclose(shards[is].fp);
+        shards[is].fp = NULL;
+    }
+    delete[] block;
+
+    if (fclose(wfp)) { fprintf(stderr, "Failed to write %s\n", output_filename); return 0; }
+
+    return 1;
+}
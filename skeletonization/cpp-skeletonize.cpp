@@ -0,0 +1,276 @@
+/* c++ executable that downsamples, thins and upsamples a raw segmentation without python */
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpp-generate_skeletons.h"
+#include "cpp-perf.h"
+#include "cpp-storage.h"
+#include "../transforms/cpp-seg2seg.h"
+
+
+
+static void Usage(const char *program)
+{
+    fprintf(stderr, "usage: %s --input FILE [--input FILE ...] --grid-size XxYxZ --resolution XxYxZ --output DIRECTORY [options]\n", program);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --input FILE                 raw segmentation in z, y, x order (several files are consecutive z chunks)\n");
+    fprintf(stderr, "  --grid-size XxYxZ            number of voxels of the whole segmentation\n");
+    fprintf(stderr, "  --resolution XxYxZ           resolution of the segmentation in nm\n");
+    fprintf(stderr, "  --output DIRECTORY           outputs are written to DIRECTORY/skeletons/PREFIX\n");
+    fprintf(stderr, "  --prefix PREFIX              name of the dataset (default: segmentation)\n");
+    fprintf(stderr, "  --bytes-per-voxel N          1, 2, 4 or 8 byte unsigned labels (default: 8)\n");
+    fprintf(stderr, "  --skeleton-resolution XxYxZ  resolution of the thinning in nm (default: 80x80x80)\n");
+    fprintf(stderr, "  --threads N                  threads for thinning, all cores if zero (default: 0)\n");
+    fprintf(stderr, "  --memory-budget BYTES        bytes of labels thinned at once, unlimited if zero (default: 0)\n");
+    fprintf(stderr, "  --slab-depth N               z slices read at once (default: 16)\n");
+    fprintf(stderr, "  --statistics                 save the work done on every label to thinning-XxYxZ-statistics.bytes\n");
+    fprintf(stderr, "  --morton                     thin in a working volume of z-order bricks (faster for large labels)\n");
+    fprintf(stderr, "  --container                  write every output into the single file skeletons/PREFIX.container\n");
+    fprintf(stderr, "  --lookup-tables DIRECTORY    directory of lut_simple.dat and lut_isthmus.dat (default: next to the executable)\n");
+}
+
+
+
+// read an XxYxZ argument into z, y, x order
+template <typename T>
+static bool ParseDimensions(const char *argument, T dimensions[3])
+{
+    double x, y, z;
+    char trailing;
+    if (sscanf(argument, "%lfx%lfx%lf%c", &x, &y, &z, &trailing) != 3) return false;
+    if (x <= 0 || y <= 0 || z <= 0) return false;
+
+    dimensions[IB_Z] = (T) z;
+    dimensions[IB_Y] = (T) y;
+    dimensions[IB_X] = (T) x;
+
+    return true;
+}
+
+
+
+static bool MakeDirectory(const char *directory)
+{
+    if (!mkdir(directory, 0777) || errno == EEXIST) return true;
+
+    fprintf(stderr, "Failed to create %s\n", directory);
+    return false;
+}
+
+
+
+static double ElapsedSeconds(std::chrono::steady_clock::time_point start_time)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+
+
+// the input files hold consecutive z slices of the segmentation and are read one slab at a time
+typedef struct {
+    std::vector<std::string> filenames;
+    int64_t file_index;
+    FILE *fp;
+    int64_t slice_bytes;
+} SlabReader;
+
+
+
+static int64_t ReadSlab(SlabReader &reader, char *slab, int64_t max_slices)
+{
+    int64_t nslices = 0;
+    while (nslices < max_slices && reader.file_index < (int64_t)reader.filenames.size()) {
+        const char *filename = reader.filenames[reader.file_index].c_str();
+        if (!reader.fp) {
+            reader.fp = fopen(filename, "rb");
+            if (!reader.fp) { fprintf(stderr, "Failed to read %s\n", filename); return -1; }
+        }
+
+        int64_t nread = fread(slab + nslices * reader.slice_bytes, reader.slice_bytes, max_slices - nslices, reader.fp);
+        nslices += nread;
+
+        if (nslices < max_slices) {
+            // the next chunk continues where this one ends
+            if (ferror(reader.fp) || ftell(reader.fp) % reader.slice_bytes) { fprintf(stderr, "Failed to read %s\n", filename); return -1; }
+            fclose(reader.fp);
+            reader.fp = NULL;
+            reader.file_index++;
+        }
+    }
+
+    return nslices;
+}
+
+
+
+static bool DownsampleInput(const char *prefix, std::vector<std::string> &input_filenames, int64_t bytes_per_voxel, float input_resolution[3], int64_t skeleton_resolution[3], int64_t grid_size[3], int64_t slab_depth)
+{
+    DownsampleContext *context = CppNewDownsampleContext(prefix, input_resolution, skeleton_resolution, grid_size);
+
+    SlabReader reader;
+    reader.filenames = input_filenames;
+    reader.file_index = 0;
+    reader.fp = NULL;
+    reader.slice_bytes = grid_size[IB_Y] * grid_size[IB_X] * bytes_per_voxel;
+
+    // read the next slab while the current one is downsampled
+    std::vector<char> slabs[2];
+    slabs[0].resize(slab_depth * reader.slice_bytes);
+    slabs[1].resize(slab_depth * reader.slice_bytes);
+
+    int64_t nslices = ReadSlab(reader, slabs[0].data(), std::min(slab_depth, grid_size[IB_Z]));
+    int64_t total_slices = 0;
+    int64_t current = 0;
+    while (nslices > 0) {
+        int64_t next_nslices = 0;
+        int64_t max_slices = std::min(slab_depth, grid_size[IB_Z] - total_slices - nslices);
+        std::thread prefetch([&]() { next_nslices = max_slices > 0 ? ReadSlab(reader, slabs[1 - current].data(), max_slices) : 0; });
+
+        int downsampled = CppDownsampleSlab(context, slabs[current].data(), bytes_per_voxel, nslices, NULL);
+        prefetch.join();
+        if (!downsampled) { CppDeleteDownsampleContext(context); return false; }
+
+        total_slices += nslices;
+        nslices = next_nslices;
+        current = 1 - current;
+    }
+    if (reader.fp) fclose(reader.fp);
+
+    if (nslices < 0 || total_slices != grid_size[IB_Z]) {
+        fprintf(stderr, "Read %ld of %ld slices for %s\n", total_slices, grid_size[IB_Z], prefix);
+        CppDeleteDownsampleContext(context);
+        return false;
+    }
+
+    int finished = CppFinishDownsampleMapping(context, NULL);
+    CppDeleteDownsampleContext(context);
+
+    return finished;
+}
+
+
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> input_filenames;
+    const char *output_directory = NULL;
+    const char *prefix = "segmentation";
+    const char *lookup_table_directory = NULL;
+    int64_t grid_size[3] = { 0, 0, 0 };
+    float input_resolution[3] = { 0, 0, 0 };
+    int64_t skeleton_resolution[3] = { 80, 80, 80 };
+    int64_t bytes_per_voxel = 8;
+    int64_t num_threads = 0;
+    int64_t memory_budget = 0;
+    int64_t slab_depth = 16;
+    bool statistics = false;
+    bool morton = false;
+    bool container = false;
+
+    static struct option options[] = {
+        { "input", required_argument, NULL, 'i' },
+        { "grid-size", required_argument, NULL, 'g' },
+        { "resolution", required_argument, NULL, 'r' },
+        { "output", required_argument, NULL, 'o' },
+        { "prefix", required_argument, NULL, 'p' },
+        { "bytes-per-voxel", required_argument, NULL, 'b' },
+        { "skeleton-resolution", required_argument, NULL, 's' },
+        { "threads", required_argument, NULL, 't' },
+        { "memory-budget", required_argument, NULL, 'm' },
+        { "slab-depth", required_argument, NULL, 'z' },
+        { "lookup-tables", required_argument, NULL, 'l' },
+        { "statistics", no_argument, NULL, 'S' },
+        { "morton", no_argument, NULL, 'M' },
+        { "container", no_argument, NULL, 'C' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "i:g:r:o:p:b:s:t:m:z:l:SMCh", options, NULL)) != -1) {
+        bool valid = true;
+        if (option == 'i') {
+            // inputs are relative to the directory the executable started in
+            char path[PATH_MAX];
+            if (!realpath(optarg, path)) { fprintf(stderr, "Failed to read %s\n", optarg); return -1; }
+            input_filenames.push_back(path);
+        }
+        else if (option == 'g') valid = ParseDimensions(optarg, grid_size);
+        else if (option == 'r') valid = ParseDimensions(optarg, input_resolution);
+        else if (option == 'o') output_directory = optarg;
+        else if (option == 'p') prefix = optarg;
+        else if (option == 'b') valid = sscanf(optarg, "%ld", &bytes_per_voxel) == 1;
+        else if (option == 's') valid = ParseDimensions(optarg, skeleton_resolution);
+        else if (option == 't') valid = sscanf(optarg, "%ld", &num_threads) == 1 && num_threads >= 0;
+        else if (option == 'm') valid = sscanf(optarg, "%ld", &memory_budget) == 1 && memory_budget >= 0;
+        else if (option == 'z') valid = sscanf(optarg, "%ld", &slab_depth) == 1 && slab_depth > 0;
+        else if (option == 'l') lookup_table_directory = optarg;
+        else if (option == 'S') statistics = true;
+        else if (option == 'M') morton = true;
+        else if (option == 'C') container = true;
+        else if (option == 'h') { Usage(argv[0]); return 0; }
+        else valid = false;
+
+        if (!valid) { Usage(argv[0]); return -1; }
+    }
+
+    if (optind != argc || input_filenames.empty() || !output_directory || !grid_size[IB_Z] || !input_resolution[IB_Z]) { Usage(argv[0]); return -1; }
+    if (bytes_per_voxel != 1 && bytes_per_voxel != 2 && bytes_per_voxel != 4 && bytes_per_voxel != 8) { Usage(argv[0]); return -1; }
+
+    // the lookup tables are installed next to the executable
+    char executable_directory[PATH_MAX];
+    if (!lookup_table_directory) {
+        ssize_t length = readlink("/proc/self/exe", executable_directory, PATH_MAX - 1);
+        if (length < 0) { fprintf(stderr, "Failed to find the lookup tables (use --lookup-tables)\n"); return -1; }
+        executable_directory[length] = '\0';
+        *strrchr(executable_directory, '/') = '\0';
+        lookup_table_directory = executable_directory;
+    }
+
+    char lookup_table_path[PATH_MAX];
+    if (!realpath(lookup_table_directory, lookup_table_path)) { fprintf(stderr, "Failed to read %s\n", lookup_table_directory); return -1; }
+
+    // every stage writes to skeletons/{PREFIX} (or skeletons/{PREFIX}.container) in the working directory
+    if (!MakeDirectory(output_directory)) return -1;
+    if (chdir(output_directory)) { fprintf(stderr, "Failed to write to %s\n", output_directory); return -1; }
+
+    if (!MakeDirectory("skeletons")) return -1;
+    if (container && !CppCreateContainer(prefix)) return -1;
+    if (!container && !CppCreateDirectory(prefix)) return -1;
+
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point stage_time = start_time;
+
+    if (!DownsampleInput(prefix, input_filenames, bytes_per_voxel, input_resolution, skeleton_resolution, grid_size, slab_depth)) return -1;
+    printf("Downsampled %s to resolution %ldx%ldx%ld in %0.2f seconds.\n", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z], ElapsedSeconds(stage_time));
+    CppPrintPerfCounters("downsampling");
+
+    stage_time = std::chrono::steady_clock::now();
+    if (!CppTopologicalThinning(prefix, skeleton_resolution, lookup_table_path, num_threads, memory_budget, 0, ALL_LABELS, 0, 0, statistics, morton, NULL)) return -1;
+    printf("Thinned %s in %0.2f seconds.\n", prefix, ElapsedSeconds(stage_time));
+    CppPrintPerfCounters("thinning");
+
+    // upsampling and the endpoint vectors only use the mapping from the downsampled labels
+    stage_time = std::chrono::steady_clock::now();
+    if (!CppApplyUpsampleOperation(prefix, NULL, skeleton_resolution, input_resolution, 0, ALL_LABELS)) return -1;
+    printf("Upsampled %s in %0.2f seconds.\n", prefix, ElapsedSeconds(stage_time));
+
+    stage_time = std::chrono::steady_clock::now();
+    if (!CppFindEndpointVectors(prefix, skeleton_resolution, input_resolution, 0, ALL_LABELS)) return -1;
+    printf("Found endpoint vectors for %s in %0.2f seconds.\n", prefix, ElapsedSeconds(stage_time));
+
+    printf("Generated skeletons for %s in %0.2f seconds.\n", prefix, ElapsedSeconds(start_time));
+
+    return 0;
+}
@@ -0,0 +1,759 @@
+/* c++ file to store the outputs of a dataset as files in its directory or as entries of a single container */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "cpp-storage.h"
+
+
+
+static const char container_magic[8] = { 'S', 'K', 'E', 'L', 'C', 'T', 'R', '1' };
+
+// the first bytes of the container (the rest of the first alignment unit is zero)
+typedef struct {
+    char magic[8];
+    int64_t alignment;
+    int64_t chunk_bytes;
+    int64_t directory_offset;
+    int64_t directory_bytes;
+    uint64_t directory_hash;
+} ContainerHeader;
+
+// an entry is the concatenation of its chunks (file offset and length pairs)
+struct ContainerEntry {
+    int64_t size;
+    int64_t modified[2];
+    std::vector<int64_t> chunks;
+};
+
+typedef std::map<std::string, ContainerEntry> ContainerDirectory;
+
+// one descriptor per container and process (the mutex orders the threads of this process since flock only orders
+// the processes, and a forked process opens its own descriptor since it would share the flock of its parent)
+struct Container {
+    int fd;
+    pid_t pid;
+    std::mutex mutex;
+};
+
+// an open entry with the chunks that it had when opened or that were written since, and the written bytes that
+// do not fill a chunk yet
+struct ArtifactStream {
+    FILE *fp;
+    Container *container;
+    std::string name;
+    bool writable;
+    ContainerEntry entry;
+    std::vector<int64_t> starts;
+    std::vector<char> buffer;
+    int64_t position;
+};
+
+
+
+// the layout of every dataset is looked up once per process (NULL for the directory layout) and containers stay open
+// until the process exits
+static std::mutex containers_mutex;
+static std::map<std::string, Container *> containers;
+
+// streams by their file so that CppSyncArtifact and CppTruncateArtifact can find them
+static std::mutex streams_mutex;
+static std::map<FILE *, ArtifactStream *> streams;
+
+
+
+class ContainerLock {
+public:
+    ContainerLock(Container *container, int operation) : container(container), guard(container->mutex)
+    {
+        while (flock(container->fd, operation) && errno == EINTR);
+    }
+
+    ~ContainerLock()
+    {
+        flock(container->fd, LOCK_UN);
+    }
+
+private:
+    Container *container;
+    std::lock_guard<std::mutex> guard;
+};
+
+
+
+static uint64_t HashBytes(const char *bytes, int64_t nbytes)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (int64_t ib = 0; ib < nbytes; ++ib) {
+        hash ^= (uint8_t) bytes[ib];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+
+static bool ReadBytes(int fd, void *data, int64_t nbytes, int64_t offset)
+{
+    char *bytes = (char *) data;
+    while (nbytes > 0) {
+        ssize_t nread = pread(fd, bytes, nbytes, offset);
+        if (nread < 0 && errno == EINTR) continue;
+        if (nread <= 0) return false;
+
+        bytes += nread;
+        nbytes -= nread;
+        offset += nread;
+    }
+
+    return true;
+}
+
+
+
+static bool WriteBytes(int fd, const void *data, int64_t nbytes, int64_t offset)
+{
+    const char *bytes = (const char *) data;
+    while (nbytes > 0) {
+        ssize_t nwritten = pwrite(fd, bytes, nbytes, offset);
+        if (nwritten < 0 && errno == EINTR) continue;
+        if (nwritten <= 0) return false;
+
+        bytes += nwritten;
+        nbytes -= nwritten;
+        offset += nwritten;
+    }
+
+    return true;
+}
+
+
+
+static std::string ContainerFilename(const char *prefix)
+{
+    return std::string("skeletons/") + prefix + ".container";
+}
+
+
+
+static Container *OpenContainer(int fd)
+{
+    Container *container = new Container();
+    container->fd = fd;
+    container->pid = getpid();
+
+    return container;
+}
+
+
+
+// the container that holds skeletons/{prefix}/{name} (NULL for the directory layout); a dataset that was not created
+// by CppCreateContainer or CppCreateDirectory in this process uses its container if one exists when it is first used
+static Container *ArtifactContainer(const char *filename, std::string &name)
+{
+    if (strncmp(filename, "skeletons/", 10)) return NULL;
+    const char *separator = strchr(filename + 10, '/');
+    if (!separator) return NULL;
+
+    std::string prefix = std::string(filename + 10, separator - filename - 10);
+    name = separator + 1;
+
+    std::lock_guard<std::mutex> lock(containers_mutex);
+    std::map<std::string, Container *>::iterator it = containers.find(prefix);
+    if (it != containers.end() && (!it->second || it->second->pid == getpid())) return it->second;
+
+#if defined(__GLIBC__)
+    // containers that are only readable can still be read
+    std::string container_filename = ContainerFilename(prefix.c_str());
+    int fd = open(container_filename.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0 && errno == EACCES) fd = open(container_filename.c_str(), O_RDONLY | O_CLOEXEC);
+    containers[prefix] = fd < 0 ? NULL : OpenContainer(fd);
+#else
+    containers[prefix] = NULL;
+#endif
+
+    return containers[prefix];
+}
+
+
+
+// the latest directory table (call with the container locked)
+static bool ReadContainerDirectory(Container *container, ContainerDirectory &directory)
+{
+    directory.clear();
+
+    ContainerHeader header;
+    if (!ReadBytes(container->fd, &header, sizeof(ContainerHeader), 0)) return false;
+    if (memcmp(header.magic, container_magic, sizeof(container_magic)) || header.alignment != container_alignment) return false;
+    if (!header.directory_bytes) return true;
+
+    std::vector<int64_t> table = std::vector<int64_t>(header.directory_bytes / sizeof(int64_t));
+    if (!ReadBytes(container->fd, table.data(), header.directory_bytes, header.directory_offset)) return false;
+    if (HashBytes((const char *) table.data(), header.directory_bytes) != header.directory_hash) return false;
+
+    // number of entries followed by the name length, name (padded to whole words), size, time and chunks of each
+    uint64_t iw = 0;
+    int64_t nentries = table[iw++];
+    for (int64_t ie = 0; ie < nentries; ++ie) {
+        if (iw >= table.size()) return false;
+        int64_t name_bytes = table[iw++];
+        int64_t name_words = (name_bytes + sizeof(int64_t) - 1) / sizeof(int64_t);
+        if (iw + name_words + 4 > table.size()) return false;
+        std::string name = std::string((const char *) &(table[iw]), name_bytes);
+        iw += name_words;
+
+        ContainerEntry &entry = directory[name];
+        entry.size = table[iw++];
+        entry.modified[0] = table[iw++];
+        entry.modified[1] = table[iw++];
+        int64_t nchunks = table[iw++];
+        if (iw + 2 * nchunks > table.size()) return false;
+        entry.chunks.assign(table.begin() + iw, table.begin() + iw + 2 * nchunks);
+        iw += 2 * nchunks;
+    }
+
+    return true;
+}
+
+
+
+// room for nbytes at the next alignment boundary past the end of the container (call with the container locked)
+static int64_t ReserveContainerBytes(Container *container, int64_t nbytes)
+{
+    struct stat container_stat;
+    if (fstat(container->fd, &container_stat)) return -1;
+
+    int64_t offset = (container_stat.st_size + container_alignment - 1) / container_alignment * container_alignment;
+    int64_t reserved = (nbytes + container_alignment - 1) / container_alignment * container_alignment;
+    if (ftruncate(container->fd, offset + reserved)) return -1;
+
+    return offset;
+}
+
+
+
+// change the latest directory and append it as the new one (nothing is written when change returns false)
+static bool CommitContainerDirectory(Container *container, std::function<bool(ContainerDirectory &)> change)
+{
+    ContainerLock lock(container, LOCK_EX);
+
+    ContainerDirectory directory;
+    if (!ReadContainerDirectory(container, directory)) return false;
+    if (!change(directory)) return true;
+
+    std::vector<int64_t> table;
+    table.push_back(directory.size());
+    for (ContainerDirectory::iterator it = directory.begin(); it != directory.end(); ++it) {
+        const std::string &name = it->first;
+        ContainerEntry &entry = it->second;
+
+        int64_t name_words = (name.size() + sizeof(int64_t) - 1) / sizeof(int64_t);
+        table.push_back(name.size());
+        table.resize(table.size() + name_words, 0);
+        memcpy(&(table[table.size() - name_words]), name.data(), name.size());
+
+        table.push_back(entry.size);
+        table.push_back(entry.modified[0]);
+        table.push_back(entry.modified[1]);
+        table.push_back(entry.chunks.size() / 2);
+        table.insert(table.end(), entry.chunks.begin(), entry.chunks.end());
+    }
+
+    int64_t table_bytes = table.size() * sizeof(int64_t);
+    int64_t offset = ReserveContainerBytes(container, table_bytes);
+    if (offset < 0 || !WriteBytes(container->fd, table.data(), table_bytes, offset)) return false;
+
+    // the header only points to the table once it is written
+    ContainerHeader header;
+    memcpy(header.magic, container_magic, sizeof(container_magic));
+    header.alignment = container_alignment;
+    header.chunk_bytes = container_chunk_bytes;
+    header.directory_offset = offset;
+    header.directory_bytes = table_bytes;
+    header.directory_hash = HashBytes((const char *) table.data(), table_bytes);
+
+    return WriteBytes(container->fd, &header, sizeof(ContainerHeader), 0);
+}
+
+
+
+bool CppCreateContainer(const char *prefix)
+{
+    std::string container_filename = ContainerFilename(prefix);
+
+#if !defined(__GLIBC__)
+    // entries are opened with fopencookie
+    fprintf(stderr, "Failed to write %s (containers need glibc)\n", container_filename.c_str());
+    return false;
+#endif
+
+    // only the process that creates the file writes the empty header
+    int fd = open(container_filename.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        if (errno != EEXIST) { fprintf(stderr, "Failed to write %s\n", container_filename.c_str()); return false; }
+
+        fd = open(container_filename.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) { fprintf(stderr, "Failed to read %s\n", container_filename.c_str()); return false; }
+
+        Container *container = OpenContainer(fd);
+        ContainerDirectory directory;
+        bool valid;
+        {
+            ContainerLock lock(container, LOCK_SH);
+            valid = ReadContainerDirectory(container, directory);
+        }
+        if (!valid) { close(fd); delete container; fprintf(stderr, "Failed to read %s\n", container_filename.c_str()); return false; }
+
+        std::lock_guard<std::mutex> lock(containers_mutex);
+        containers[prefix] = container;
+
+        return true;
+    }
+
+    ContainerHeader header;
+    memset(&header, 0, sizeof(ContainerHeader));
+    memcpy(header.magic, container_magic, sizeof(container_magic));
+    header.alignment = container_alignment;
+    header.chunk_bytes = container_chunk_bytes;
+
+    bool written = !ftruncate(fd, container_alignment) && WriteBytes(fd, &header, sizeof(ContainerHeader), 0);
+    if (!written) { close(fd); fprintf(stderr, "Failed to write %s\n", container_filename.c_str()); return false; }
+
+    // a container that replaced an earlier one of this prefix is used from now on (the earlier one stays open since
+    // its streams might still be open)
+    std::lock_guard<std::mutex> lock(containers_mutex);
+    containers[prefix] = OpenContainer(fd);
+
+    return true;
+}
+
+
+
+bool CppCreateDirectory(const char *prefix)
+{
+    std::string directory = std::string("skeletons/") + prefix;
+
+    // the outputs of this run would otherwise go into the container that an earlier run left behind
+    std::string container_filename = ContainerFilename(prefix);
+    if (!access(container_filename.c_str(), F_OK)) { fprintf(stderr, "Failed to write %s (%s exists)\n", directory.c_str(), container_filename.c_str()); return false; }
+
+    if (mkdir(directory.c_str(), 0777) && errno != EEXIST) { fprintf(stderr, "Failed to write %s\n", directory.c_str()); return false; }
+
+    std::lock_guard<std::mutex> lock(containers_mutex);
+    containers[prefix] = NULL;
+
+    return true;
+}
+
+
+
+static bool AppendArtifactChunk(ArtifactStream *stream, const char *data, int64_t nbytes)
+{
+    if (!nbytes) return true;
+
+    int64_t offset;
+    {
+        ContainerLock lock(stream->container, LOCK_EX);
+        offset = ReserveContainerBytes(stream->container, nbytes);
+    }
+
+    // the chunk is only written after the lock is released since no directory refers to it yet
+    if (offset < 0 || !WriteBytes(stream->container->fd, data, nbytes, offset)) return false;
+
+    stream->starts.push_back(stream->entry.size);
+    stream->entry.chunks.push_back(offset);
+    stream->entry.chunks.push_back(nbytes);
+    stream->entry.size += nbytes;
+
+    return true;
+}
+
+
+
+static bool FlushArtifactBuffer(ArtifactStream *stream)
+{
+    if (!AppendArtifactChunk(stream, stream->buffer.data(), stream->buffer.size())) return false;
+    stream->buffer.clear();
+
+    return true;
+}
+
+
+
+static bool CommitArtifactStream(ArtifactStream *stream)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    stream->entry.modified[0] = now.tv_sec;
+    stream->entry.modified[1] = now.tv_nsec;
+
+    return CommitContainerDirectory(stream->container, [&](ContainerDirectory &directory) {
+        directory[stream->name] = stream->entry;
+        return true;
+    });
+}
+
+
+
+// streams of container entries need fopencookie, which only glibc has (elsewhere every dataset uses the directory
+// layout and CppCreateContainer fails)
+#if defined(__GLIBC__)
+
+static ssize_t ReadArtifactStream(void *cookie, char *data, size_t nbytes)
+{
+    ArtifactStream *stream = (ArtifactStream *) cookie;
+    int64_t size = stream->entry.size + stream->buffer.size();
+
+    size_t nread = 0;
+    while (nread < nbytes && stream->position < size) {
+        int64_t ncopy;
+        if (stream->position >= stream->entry.size) {
+            // written bytes that are not in a chunk yet
+            ncopy = std::min((int64_t) (nbytes - nread), size - stream->position);
+            memcpy(data + nread, &(stream->buffer[stream->position - stream->entry.size]), ncopy);
+        }
+        else {
+            int64_t ic = std::upper_bound(stream->starts.begin(), stream->starts.end(), stream->position) - stream->starts.begin() - 1;
+            int64_t chunk_offset = stream->position - stream->starts[ic];
+            ncopy = std::min((int64_t) (nbytes - nread), stream->entry.chunks[2 * ic + 1] - chunk_offset);
+            if (!ReadBytes(stream->container->fd, data + nread, ncopy, stream->entry.chunks[2 * ic] + chunk_offset)) return nread ? (ssize_t) nread : -1;
+        }
+
+        nread += ncopy;
+        stream->position += ncopy;
+    }
+
+    return nread;
+}
+
+
+
+static ssize_t WriteArtifactStream(void *cookie, const char *data, size_t nbytes)
+{
+    ArtifactStream *stream = (ArtifactStream *) cookie;
+
+    // entries are only written at their end
+    if (!stream->writable || stream->position != stream->entry.size + (int64_t) stream->buffer.size()) { errno = ESPIPE; return 0; }
+
+    size_t nwritten = 0;
+    while (nwritten < nbytes) {
+        int64_t ncopy = std::min((int64_t) (nbytes - nwritten), container_chunk_bytes - (int64_t) stream->buffer.size());
+
+        // whole chunks of large writes are not copied into the buffer
+        if (stream->buffer.empty() && ncopy == container_chunk_bytes) {
+            if (!AppendArtifactChunk(stream, data + nwritten, ncopy)) return 0;
+        }
+        else {
+            stream->buffer.insert(stream->buffer.end(), data + nwritten, data + nwritten + ncopy);
+            if ((int64_t) stream->buffer.size() == container_chunk_bytes && !FlushArtifactBuffer(stream)) return 0;
+        }
+
+        nwritten += ncopy;
+        stream->position += ncopy;
+    }
+
+    return nwritten;
+}
+
+
+
+static int SeekArtifactStream(void *cookie, off64_t *offset, int whence)
+{
+    ArtifactStream *stream = (ArtifactStream *) cookie;
+
+    int64_t position;
+    if (whence == SEEK_SET) position = *offset;
+    else if (whence == SEEK_CUR) position = stream->position + *offset;
+    else if (whence == SEEK_END) position = stream->entry.size + stream->buffer.size() + *offset;
+    else { errno = EINVAL; return -1; }
+    if (position < 0) { errno = EINVAL; return -1; }
+
+    stream->position = position;
+    *offset = position;
+
+    return 0;
+}
+
+
+
+static int CloseArtifactStream(void *cookie)
+{
+    ArtifactStream *stream = (ArtifactStream *) cookie;
+
+    // the entry replaces the previous one of that name once all of it is written
+    int result = 0;
+    if (stream->writable && (!FlushArtifactBuffer(stream) || !CommitArtifactStream(stream))) result = EOF;
+
+    {
+        std::lock_guard<std::mutex> lock(streams_mutex);
+        streams.erase(stream->fp);
+    }
+    delete stream;
+
+    return result;
+}
+
+
+
+// an entry of a container as a stream (stdio only calls the functions above through fopencookie)
+static FILE *OpenArtifactStream(Container *container, const std::string &name, const char *mode)
+{
+    bool writable = strchr(mode, 'w') || strchr(mode, 'a') || strchr(mode, '+');
+    bool existing = mode[0] == 'r' || mode[0] == 'a';
+
+    ArtifactStream *stream = new ArtifactStream();
+    stream->container = container;
+    stream->name = name;
+    stream->writable = writable;
+    stream->entry.size = 0;
+    stream->entry.modified[0] = 0;
+    stream->entry.modified[1] = 0;
+    stream->position = 0;
+
+    if (existing) {
+        ContainerDirectory directory;
+        {
+            ContainerLock lock(container, LOCK_SH);
+            if (!ReadContainerDirectory(container, directory)) { delete stream; errno = EIO; return NULL; }
+        }
+
+        ContainerDirectory::iterator it = directory.find(name);
+        if (it != directory.end()) stream->entry = it->second;
+        else if (mode[0] == 'r') { delete stream; errno = ENOENT; return NULL; }
+
+        int64_t start = 0;
+        for (uint64_t ic = 0; ic < stream->entry.chunks.size(); ic += 2) {
+            stream->starts.push_back(start);
+            start += stream->entry.chunks[ic + 1];
+        }
+        if (mode[0] == 'a') stream->position = stream->entry.size;
+    }
+
+    cookie_io_functions_t functions;
+    functions.read = ReadArtifactStream;
+    functions.write = WriteArtifactStream;
+    functions.seek = SeekArtifactStream;
+    functions.close = CloseArtifactStream;
+
+    std::lock_guard<std::mutex> lock(streams_mutex);
+    stream->fp = fopencookie(stream, mode, functions);
+    if (!stream->fp) { delete stream; return NULL; }
+    streams[stream->fp] = stream;
+
+    return stream->fp;
+}
+
+#else
+
+static FILE *OpenArtifactStream(Container *container, const std::string &name, const char *mode)
+{
+    errno = ENOTSUP;
+    return NULL;
+}
+
+#endif
+
+
+
+static ArtifactStream *FindArtifactStream(FILE *fp)
+{
+    std::lock_guard<std::mutex> lock(streams_mutex);
+    std::map<FILE *, ArtifactStream *>::iterator it = streams.find(fp);
+    if (it == streams.end()) return NULL;
+
+    return it->second;
+}
+
+
+
+FILE *CppOpenArtifact(const char *filename, const char *mode)
+{
+    std::string name;
+    Container *container = ArtifactContainer(filename, name);
+    if (!container) return fopen(filename, mode);
+
+    return OpenArtifactStream(container, name, mode);
+}
+
+
+
+int CppRemoveArtifact(const char *filename)
+{
+    std::string name;
+    Container *container = ArtifactContainer(filename, name);
+    if (!container) return remove(filename);
+
+    bool found = false;
+    if (!CommitContainerDirectory(container, [&](ContainerDirectory &directory) {
+        found = directory.erase(name) > 0;
+        return found;
+    })) { errno = EIO; return -1; }
+    if (!found) { errno = ENOENT; return -1; }
+
+    return 0;
+}
+
+
+
+int CppRenameArtifact(const char *old_filename, const char *new_filename)
+{
+    std::string old_name, new_name;
+    Container *container = ArtifactContainer(old_filename, old_name);
+    Container *new_container = ArtifactContainer(new_filename, new_name);
+    if (!container && !new_container) return rename(old_filename, new_filename);
+    if (container != new_container) { errno = EXDEV; return -1; }
+
+    bool found = false;
+    if (!CommitContainerDirectory(container, [&](ContainerDirectory &directory) {
+        ContainerDirectory::iterator it = directory.find(old_name);
+        found = it != directory.end();
+        if (!found) return false;
+
+        ContainerEntry entry = it->second;
+        directory.erase(it);
+        directory[new_name] = entry;
+
+        return true;
+    })) { errno = EIO; return -1; }
+    if (!found) { errno = ENOENT; return -1; }
+
+    return 0;
+}
+
+
+
+void CppDiscardArtifact(FILE *fp)
+{
+    // the stream no longer takes writes, so closing it neither appends the buffered bytes nor commits the entry
+    ArtifactStream *stream = FindArtifactStream(fp);
+    if (stream) stream->writable = false;
+
+    fclose(fp);
+}
+
+
+
+int CppSyncArtifact(FILE *fp)
+{
+    if (fflush(fp)) return -1;
+
+    ArtifactStream *stream = FindArtifactStream(fp);
+    if (!stream) return fsync(fileno(fp));
+    if (!stream->writable) return 0;
+
+    // the chunks are on disk before the directory that refers to them
+    if (!FlushArtifactBuffer(stream) || fdatasync(stream->container->fd)) return -1;
+    if (!CommitArtifactStream(stream) || fdatasync(stream->container->fd)) return -1;
+
+    return 0;
+}
+
+
+
+int CppTruncateArtifact(FILE *fp, int64_t size)
+{
+    if (fflush(fp)) return -1;
+
+    ArtifactStream *stream = FindArtifactStream(fp);
+    if (!stream) {
+        if (ftruncate(fileno(fp), size)) return -1;
+        return fseek(fp, size, SEEK_SET);
+    }
+
+    if (!stream->writable || size > stream->entry.size + (int64_t) stream->buffer.size()) { errno = EINVAL; return -1; }
+
+    if (size >= stream->entry.size) stream->buffer.resize(size - stream->entry.size);
+    else {
+        // the chunks past the new end stay in the container but are no longer part of the entry
+        stream->buffer.clear();
+        while (!stream->starts.empty() && stream->starts.back() >= size) {
+            stream->starts.pop_back();
+            stream->entry.chunks.resize(stream->entry.chunks.size() - 2);
+        }
+        if (!stream->starts.empty()) stream->entry.chunks.back() = size - stream->starts.back();
+        stream->entry.size = size;
+    }
+
+    return fseek(fp, size, SEEK_SET);
+}
+
+
+
+bool CppStatArtifact(const char *filename, int64_t *size, int64_t modified[2])
+{
+    std::string name;
+    Container *container = ArtifactContainer(filename, name);
+    if (!container) {
+        struct stat file_stat;
+        if (stat(filename, &file_stat)) return false;
+
+        *size = file_stat.st_size;
+        modified[0] = file_stat.st_mtim.tv_sec;
+        modified[1] = file_stat.st_mtim.tv_nsec;
+
+        return true;
+    }
+
+    ContainerDirectory directory;
+    {
+        ContainerLock lock(container, LOCK_SH);
+        if (!ReadContainerDirectory(container, directory)) return false;
+    }
+
+    ContainerDirectory::iterator it = directory.find(name);
+    if (it == directory.end()) return false;
+
+    *size = it->second.size;
+    modified[0] = it->second.modified[0];
+    modified[1] = it->second.modified[1];
+
+    return true;
+}
+
+
+
+bool CppGlobArtifacts(const char *pattern, std::vector<std::string> &filenames)
+{
+    filenames.clear();
+
+    std::string name_pattern;
+    Container *container = ArtifactContainer(pattern, name_pattern);
+    if (!container) {
+        glob_t matches;
+        int status = glob(pattern, 0, NULL, &matches);
+        if (!status) filenames.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        globfree(&matches);
+
+        return !status || status == GLOB_NOMATCH;
+    }
+
+    ContainerDirectory directory;
+    {
+        ContainerLock lock(container, LOCK_SH);
+        if (!ReadContainerDirectory(container, directory)) return false;
+    }
+
+    // the directory is sorted by name
+    std::string directory_name = std::string(pattern, strlen(pattern) - name_pattern.size());
+    for (ContainerDirectory::iterator it = directory.begin(); it != directory.end(); ++it) {
+        if (!fnmatch(name_pattern.c_str(), it->first.c_str(), 0)) filenames.push_back(directory_name + it->first);
+    }
+
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef __CPP_STORAGE__
+#define __CPP_STORAGE__
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+
+
+// every output of a dataset is named by its path skeletons/{prefix}/{name}. By default that is a file in the dataset
+// directory; once skeletons/{prefix}.container exists, every name of that dataset is instead an entry of that one file
+// (all resolutions, mappings, skeletons and vectors), so a run no longer creates many small files.
+
+// the container starts with a header of one alignment unit that points to the latest directory table. Data is
+// appended in chunks of at most container_chunk_bytes that start on an alignment boundary and an entry is the list of
+// its chunks. Closing a written entry appends a new directory table and only then updates the header, so readers
+// always see complete entries and nothing that was written is overwritten. Appends are locked with flock, so
+// several processes (for example label range shards) can write into the same container.
+static const int64_t container_alignment = 4096;
+static const int64_t container_chunk_bytes = 1 << 20;
+
+// choose the layout of a dataset for this process: create its container (an existing container is kept; needs glibc)
+// or its directory (fails when the dataset has a container, so that a directory run never writes into a container
+// that an earlier run left behind). Datasets that neither chose are looked up once on their first use.
+bool CppCreateContainer(const char *prefix);
+bool CppCreateDirectory(const char *prefix);
+
+// fopen, remove and rename for dataset outputs. Entries of a container are written sequentially ("wb", or "r+b"
+// after CppTruncateArtifact), and a written entry replaces the previous entry of that name when it is closed (so
+// writers check fclose, which fails when the entry cannot be committed).
+FILE *CppOpenArtifact(const char *filename, const char *mode);
+int CppRemoveArtifact(const char *filename);
+int CppRenameArtifact(const char *old_filename, const char *new_filename);
+
+// close an output on a failure path without replacing the previous entry of a container (what was last synced stays;
+// a file in the dataset directory keeps whatever was written)
+void CppDiscardArtifact(FILE *fp);
+
+// make everything written so far durable (and visible to readers for a container entry)
+int CppSyncArtifact(FILE *fp);
+
+// drop everything after the first size bytes and move the position there
+int CppTruncateArtifact(FILE *fp, int64_t size);
+
+// size and time of the last change (seconds and nanoseconds), false if there is no such output
+bool CppStatArtifact(const char *filename, int64_t *size, int64_t modified[2]);
+
+// the outputs that match a shell pattern (only the name part may contain wildcards for a container) in sorted order
+bool CppGlobArtifacts(const char *pattern, std::vector<std::string> &filenames);
+
+#endif
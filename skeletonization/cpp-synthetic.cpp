@@ -0,0 +1,491 @@
+/* c++ generator of synthetic segmentations for the benchmark */
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "cpp-generate_skeletons.h"
+#include "cpp-synthetic.h"
+
+
+
+// tubes and tree branches are drawn as capsules (points in z, y, x order)
+typedef struct {
+    int64_t label;
+    double start[3];
+    double end[3];
+    double radius;
+} Capsule;
+
+typedef struct {
+    int64_t label;
+    double center[3];
+    double radii[3];
+} Ellipsoid;
+
+// wavy sheet with the surface height + amplitude * xwave[ix] * ywave[iy] and a half thickness
+typedef struct {
+    int64_t label;
+    double height;
+    double amplitude;
+    double thickness;
+    int64_t ymin, ymax, xmin, xmax;
+    std::vector<double> xwave;
+    std::vector<double> ywave;
+} Sheet;
+
+struct SyntheticSegmentation {
+    int64_t size;
+    int64_t max_label;
+
+    // drawn in this order so later shapes cover earlier ones
+    std::vector<Ellipsoid> ellipsoids;
+    std::vector<Capsule> capsules;
+    std::vector<Sheet> sheets;
+
+    // densely packed neurons are the cells of a jittered grid elongated along z (no other shapes are drawn)
+    bool dense;
+    int64_t cell_size[3];
+    int64_t ncells[3];
+    std::vector<double> seeds;
+};
+
+
+
+// the generator avoids the standard distributions so that the labels do not depend on the c++ library
+static uint64_t NextRandom(uint64_t *state)
+{
+    uint64_t value = (*state += 0x9e3779b97f4a7c15ULL);
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+
+    return value ^ (value >> 31);
+}
+
+
+
+static double Uniform(uint64_t *state, double low, double high)
+{
+    return low + (high - low) * (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+
+static void AddCapsule(SyntheticSegmentation *segmentation, int64_t label, double start[3], double end[3], double radius)
+{
+    Capsule capsule;
+    capsule.label = label;
+    for (int dim = 0; dim < 3; ++dim) {
+        capsule.start[dim] = start[dim];
+        capsule.end[dim] = end[dim];
+    }
+    capsule.radius = radius;
+
+    segmentation->capsules.push_back(capsule);
+}
+
+
+
+// wavy tubes that cross the volume between two opposite faces
+static void AddTubes(SyntheticSegmentation *segmentation, uint64_t *state, int64_t ntubes)
+{
+    static const int64_t nsegments = 32;
+    double size = (double) segmentation->size;
+
+    for (int64_t it = 0; it < ntubes; ++it) {
+        int64_t label = ++segmentation->max_label;
+
+        int axis = (int) (NextRandom(state) % 3);
+        int wave_axis = (axis + 1 + (int) (NextRandom(state) % 2)) % 3;
+        double start[3], end[3];
+        for (int dim = 0; dim < 3; ++dim) {
+            start[dim] = Uniform(state, 0.1 * size, 0.9 * size);
+            end[dim] = Uniform(state, 0.1 * size, 0.9 * size);
+        }
+        start[axis] = -0.05 * size;
+        end[axis] = 1.05 * size;
+
+        double amplitude = Uniform(state, size / 24, size / 10);
+        double periods = Uniform(state, 0.5, 2.5);
+        double phase = Uniform(state, 0, 2 * M_PI);
+        double radius = std::max(1.5, Uniform(state, size / 96, size / 40));
+
+        double previous[3] = { 0, 0, 0 };
+        for (int64_t is = 0; is <= nsegments; ++is) {
+            double fraction = (double) is / nsegments;
+
+            double point[3];
+            for (int dim = 0; dim < 3; ++dim)
+                point[dim] = start[dim] + fraction * (end[dim] - start[dim]);
+            point[wave_axis] += amplitude * sin(2 * M_PI * periods * fraction + phase);
+
+            if (is) AddCapsule(segmentation, label, previous, point, radius);
+            for (int dim = 0; dim < 3; ++dim)
+                previous[dim] = point[dim];
+        }
+    }
+}
+
+
+
+static void AddBranch(SyntheticSegmentation *segmentation, uint64_t *state, int64_t label, double start[3], double direction[3], double length, double radius, int64_t depth)
+{
+    double end[3];
+    for (int dim = 0; dim < 3; ++dim)
+        end[dim] = start[dim] + length * direction[dim];
+    AddCapsule(segmentation, label, start, end, radius);
+
+    if (!depth) return;
+
+    // every branch splits in two thinner and shorter branches
+    for (int ic = 0; ic < 2; ++ic) {
+        double child_direction[3];
+        double norm = 0;
+        for (int dim = 0; dim < 3; ++dim) {
+            child_direction[dim] = direction[dim] + Uniform(state, -0.8, 0.8);
+            norm += child_direction[dim] * child_direction[dim];
+        }
+        norm = sqrt(norm);
+        for (int dim = 0; dim < 3; ++dim)
+            child_direction[dim] /= norm;
+
+        AddBranch(segmentation, state, label, end, child_direction, 0.75 * length, std::max(1.0, 0.7 * radius), depth - 1);
+    }
+}
+
+
+
+// branching trees that grow from the bottom of the volume (one label per tree)
+static void AddTrees(SyntheticSegmentation *segmentation, uint64_t *state, int64_t ntrees)
+{
+    double size = (double) segmentation->size;
+
+    for (int64_t it = 0; it < ntrees; ++it) {
+        int64_t label = ++segmentation->max_label;
+
+        double root[3] = { 0, Uniform(state, 0.25 * size, 0.75 * size), Uniform(state, 0.25 * size, 0.75 * size) };
+        double direction[3] = { 1, 0, 0 };
+        AddBranch(segmentation, state, label, root, direction, size / 3, std::max(1.5, size / 40), 5);
+    }
+}
+
+
+
+static void AddSheets(SyntheticSegmentation *segmentation, uint64_t *state, int64_t nsheets)
+{
+    int64_t size = segmentation->size;
+
+    for (int64_t is = 0; is < nsheets; ++is) {
+        Sheet sheet;
+        sheet.label = ++segmentation->max_label;
+        sheet.height = size * (is + Uniform(state, 0.3, 0.7)) / nsheets;
+        sheet.amplitude = Uniform(state, size / 32.0, size / 12.0);
+        sheet.thickness = std::max(1.0, Uniform(state, size / 96.0, size / 48.0));
+        sheet.ymin = (int64_t) Uniform(state, 0, 0.2 * size);
+        sheet.ymax = size - (int64_t) Uniform(state, 0, 0.2 * size);
+        sheet.xmin = (int64_t) Uniform(state, 0, 0.2 * size);
+        sheet.xmax = size - (int64_t) Uniform(state, 0, 0.2 * size);
+
+        double xwavelength = Uniform(state, size / 4.0, (double) size);
+        double ywavelength = Uniform(state, size / 4.0, (double) size);
+        double xphase = Uniform(state, 0, 2 * M_PI);
+        double yphase = Uniform(state, 0, 2 * M_PI);
+        sheet.xwave.resize(size);
+        sheet.ywave.resize(size);
+        for (int64_t index = 0; index < size; ++index) {
+            sheet.xwave[index] = sin(2 * M_PI * index / xwavelength + xphase);
+            sheet.ywave[index] = cos(2 * M_PI * index / ywavelength + yphase);
+        }
+
+        segmentation->sheets.push_back(sheet);
+    }
+}
+
+
+
+static void AddEllipsoid(SyntheticSegmentation *segmentation, int64_t label, double center[3], double radii[3])
+{
+    Ellipsoid ellipsoid;
+    ellipsoid.label = label;
+    for (int dim = 0; dim < 3; ++dim) {
+        ellipsoid.center[dim] = center[dim];
+        ellipsoid.radii[dim] = radii[dim];
+    }
+
+    segmentation->ellipsoids.push_back(ellipsoid);
+}
+
+
+
+static void AddBlobs(SyntheticSegmentation *segmentation, uint64_t *state, int64_t nblobs)
+{
+    double size = (double) segmentation->size;
+
+    for (int64_t ib = 0; ib < nblobs; ++ib) {
+        double center[3], radii[3];
+        for (int dim = 0; dim < 3; ++dim) {
+            center[dim] = Uniform(state, 0, size);
+            radii[dim] = std::max(1.5, Uniform(state, size / 24, size / 8));
+        }
+
+        AddEllipsoid(segmentation, ++segmentation->max_label, center, radii);
+    }
+}
+
+
+
+// pareto distributed radii give many tiny labels and a few huge ones (the largest are drawn first so that the
+// small ones stay visible)
+static void AddHeavyTailedBlobs(SyntheticSegmentation *segmentation, uint64_t *state, int64_t nblobs)
+{
+    static const double minimum_radius = 1.5;
+    static const double alpha = 1.2;
+    double size = (double) segmentation->size;
+
+    std::vector<double> radii(nblobs);
+    for (int64_t ib = 0; ib < nblobs; ++ib)
+        radii[ib] = std::min(size / 6, minimum_radius * pow(1.0 - Uniform(state, 0, 1), -1.0 / alpha));
+    std::sort(radii.begin(), radii.end(), std::greater<double>());
+
+    for (int64_t ib = 0; ib < nblobs; ++ib) {
+        double center[3], axes[3];
+        for (int dim = 0; dim < 3; ++dim) {
+            center[dim] = Uniform(state, 0, size);
+            axes[dim] = std::max(1.0, radii[ib] * Uniform(state, 0.7, 1.3));
+        }
+
+        AddEllipsoid(segmentation, ++segmentation->max_label, center, axes);
+    }
+}
+
+
+
+static void AddDenseNeurons(SyntheticSegmentation *segmentation, uint64_t *state)
+{
+    static const int64_t cell_size[3] = { 48, 16, 16 };
+
+    segmentation->dense = true;
+    for (int dim = 0; dim < 3; ++dim) {
+        segmentation->cell_size[dim] = std::min(cell_size[dim], segmentation->size);
+        segmentation->ncells[dim] = (segmentation->size + segmentation->cell_size[dim] - 1) / segmentation->cell_size[dim];
+    }
+
+    int64_t ncells = segmentation->ncells[IB_Z] * segmentation->ncells[IB_Y] * segmentation->ncells[IB_X];
+    segmentation->seeds.resize(3 * ncells);
+    for (int64_t iz = 0, index = 0; iz < segmentation->ncells[IB_Z]; ++iz) {
+        for (int64_t iy = 0; iy < segmentation->ncells[IB_Y]; ++iy) {
+            for (int64_t ix = 0; ix < segmentation->ncells[IB_X]; ++ix, ++index) {
+                int64_t cell[3] = { iz, iy, ix };
+                for (int dim = 0; dim < 3; ++dim)
+                    segmentation->seeds[3 * index + dim] = (cell[dim] + Uniform(state, 0.2, 0.8)) * segmentation->cell_size[dim];
+            }
+        }
+    }
+
+    segmentation->max_label = ncells;
+}
+
+
+
+SyntheticSegmentation *CppNewSyntheticSegmentation(const char *shape, int64_t size, uint64_t seed)
+{
+    SyntheticSegmentation *segmentation = new SyntheticSegmentation();
+    segmentation->size = size;
+    segmentation->max_label = 0;
+    segmentation->dense = false;
+
+    uint64_t state = seed;
+    int64_t nvoxels = size * size * size;
+
+    if (!strcmp(shape, "tubes")) AddTubes(segmentation, &state, 16);
+    else if (!strcmp(shape, "trees")) AddTrees(segmentation, &state, 4);
+    else if (!strcmp(shape, "sheets")) AddSheets(segmentation, &state, 6);
+    else if (!strcmp(shape, "blobs")) AddBlobs(segmentation, &state, 24);
+    else if (!strcmp(shape, "dense")) AddDenseNeurons(segmentation, &state);
+    else if (!strcmp(shape, "heavy-tailed")) AddHeavyTailedBlobs(segmentation, &state, std::max((int64_t) 32, nvoxels / 32768));
+    else if (!strcmp(shape, "sparse-ids")) {
+        // the heavy tailed blobs with one in every 64 label ids used
+        static const int64_t label_stride = 64;
+
+        AddHeavyTailedBlobs(segmentation, &state, std::max((int64_t) 32, nvoxels / 32768));
+        for (uint64_t ie = 0; ie < segmentation->ellipsoids.size(); ++ie) {
+            int64_t label = segmentation->ellipsoids[ie].label;
+            segmentation->ellipsoids[ie].label = (label - 1) * label_stride + 1 + (int64_t) (NextRandom(&state) % label_stride);
+        }
+        segmentation->max_label *= label_stride;
+    }
+    else { delete segmentation; return NULL; }
+
+    return segmentation;
+}
+
+
+
+void CppDeleteSyntheticSegmentation(SyntheticSegmentation *segmentation)
+{
+    delete segmentation;
+}
+
+
+
+int64_t CppSyntheticMaxLabel(SyntheticSegmentation *segmentation)
+{
+    return segmentation->max_label;
+}
+
+
+
+static void DenseSlice(SyntheticSegmentation *segmentation, int64_t iz, int64_t *slice)
+{
+    // voxels about as close to two seeds are background between the neurons
+    static const double membrane = 0.06;
+    int64_t size = segmentation->size;
+
+    for (int64_t iy = 0; iy < size; ++iy) {
+        for (int64_t ix = 0; ix < size; ++ix) {
+            double point[3] = { (double) iz, (double) iy, (double) ix };
+
+            // seeds of the cell of this voxel and of the closest neighboring cell along every axis
+            int64_t cells[3][2];
+            for (int dim = 0; dim < 3; ++dim) {
+                double position = point[dim] / segmentation->cell_size[dim];
+                cells[dim][0] = (int64_t) position;
+                cells[dim][1] = cells[dim][0] + (position - cells[dim][0] < 0.5 ? -1 : 1);
+                if (cells[dim][1] < 0 || cells[dim][1] >= segmentation->ncells[dim]) cells[dim][1] = cells[dim][0];
+            }
+
+            double closest = INFINITY;
+            double second = INFINITY;
+            int64_t label = 0;
+            for (int candidate = 0; candidate < 8; ++candidate) {
+                int64_t cz = cells[IB_Z][(candidate >> 2) & 1];
+                int64_t cy = cells[IB_Y][(candidate >> 1) & 1];
+                int64_t cx = cells[IB_X][candidate & 1];
+                int64_t index = (cz * segmentation->ncells[IB_Y] + cy) * segmentation->ncells[IB_X] + cx;
+                if (index + 1 == label) continue;
+
+                // distances in cell units make the neurons elongated along z
+                double distance = 0;
+                for (int dim = 0; dim < 3; ++dim) {
+                    double offset = (point[dim] - segmentation->seeds[3 * index + dim]) / segmentation->cell_size[dim];
+                    distance += offset * offset;
+                }
+                distance = sqrt(distance);
+
+                if (distance < closest) {
+                    second = closest;
+                    closest = distance;
+                    label = index + 1;
+                }
+                else if (distance < second) second = distance;
+            }
+
+            slice[iy * size + ix] = (second - closest < membrane) ? 0 : label;
+        }
+    }
+}
+
+
+
+void CppSyntheticSlice(SyntheticSegmentation *segmentation, int64_t iz, int64_t *slice)
+{
+    int64_t size = segmentation->size;
+    memset(slice, 0, size * size * sizeof(int64_t));
+
+    if (segmentation->dense) { DenseSlice(segmentation, iz, slice); return; }
+
+    for (uint64_t ie = 0; ie < segmentation->ellipsoids.size(); ++ie) {
+        Ellipsoid &ellipsoid = segmentation->ellipsoids[ie];
+
+        double dz = (iz - ellipsoid.center[IB_Z]) / ellipsoid.radii[IB_Z];
+        if (dz * dz > 1) continue;
+
+        double yradius = ellipsoid.radii[IB_Y] * sqrt(1 - dz * dz);
+        int64_t ymin = std::max((int64_t) 0, (int64_t) ceil(ellipsoid.center[IB_Y] - yradius));
+        int64_t ymax = std::min(size - 1, (int64_t) floor(ellipsoid.center[IB_Y] + yradius));
+        for (int64_t iy = ymin; iy <= ymax; ++iy) {
+            double dy = (iy - ellipsoid.center[IB_Y]) / ellipsoid.radii[IB_Y];
+            double remaining = 1 - dz * dz - dy * dy;
+            if (remaining < 0) continue;
+
+            // every row of an ellipsoid is one run of voxels
+            double xradius = ellipsoid.radii[IB_X] * sqrt(remaining);
+            int64_t xmin = std::max((int64_t) 0, (int64_t) ceil(ellipsoid.center[IB_X] - xradius));
+            int64_t xmax = std::min(size - 1, (int64_t) floor(ellipsoid.center[IB_X] + xradius));
+            for (int64_t ix = xmin; ix <= xmax; ++ix)
+                slice[iy * size + ix] = ellipsoid.label;
+        }
+    }
+
+    for (uint64_t ic = 0; ic < segmentation->capsules.size(); ++ic) {
+        Capsule &capsule = segmentation->capsules[ic];
+
+        double zmin = std::min(capsule.start[IB_Z], capsule.end[IB_Z]) - capsule.radius;
+        double zmax = std::max(capsule.start[IB_Z], capsule.end[IB_Z]) + capsule.radius;
+        if (iz < zmin || iz > zmax) continue;
+
+        int64_t ymin = std::max((int64_t) 0, (int64_t) ceil(std::min(capsule.start[IB_Y], capsule.end[IB_Y]) - capsule.radius));
+        int64_t ymax = std::min(size - 1, (int64_t) floor(std::max(capsule.start[IB_Y], capsule.end[IB_Y]) + capsule.radius));
+        int64_t xmin = std::max((int64_t) 0, (int64_t) ceil(std::min(capsule.start[IB_X], capsule.end[IB_X]) - capsule.radius));
+        int64_t xmax = std::min(size - 1, (int64_t) floor(std::max(capsule.start[IB_X], capsule.end[IB_X]) + capsule.radius));
+
+        double axis[3];
+        double length = 0;
+        for (int dim = 0; dim < 3; ++dim) {
+            axis[dim] = capsule.end[dim] - capsule.start[dim];
+            length += axis[dim] * axis[dim];
+        }
+
+        for (int64_t iy = ymin; iy <= ymax; ++iy) {
+            for (int64_t ix = xmin; ix <= xmax; ++ix) {
+                double offset[3] = { iz - capsule.start[IB_Z], iy - capsule.start[IB_Y], ix - capsule.start[IB_X] };
+
+                // closest point on the axis of the capsule
+                double fraction = length > 0 ? (offset[0] * axis[0] + offset[1] * axis[1] + offset[2] * axis[2]) / length : 0;
+                fraction = std::max(0.0, std::min(1.0, fraction));
+
+                double distance = 0;
+                for (int dim = 0; dim < 3; ++dim) {
+                    double difference = offset[dim] - fraction * axis[dim];
+                    distance += difference * difference;
+                }
+
+                if (distance <= capsule.radius * capsule.radius) slice[iy * size + ix] = capsule.label;
+            }
+        }
+    }
+
+    for (uint64_t is = 0; is < segmentation->sheets.size(); ++is) {
+        Sheet &sheet = segmentation->sheets[is];
+
+        if (fabs(iz - sheet.height) > sheet.amplitude + sheet.thickness) continue;
+
+        for (int64_t iy = sheet.ymin; iy < sheet.ymax; ++iy) {
+            for (int64_t ix = sheet.xmin; ix < sheet.xmax; ++ix) {
+                double surface = sheet.height + sheet.amplitude * sheet.xwave[ix] * sheet.ywave[iy];
+                if (fabs(iz - surface) <= sheet.thickness) slice[iy * size + ix] = sheet.label;
+            }
+        }
+    }
+}
+
+
+
+void CppSyntheticSlab(SyntheticSegmentation *segmentation, int64_t iz, int64_t nslices, int64_t *slab, int64_t num_threads)
+{
+    if (!num_threads) num_threads = std::max(1, (int) std::thread::hardware_concurrency());
+    num_threads = std::min(num_threads, nslices);
+
+    int64_t slice_size = segmentation->size * segmentation->size;
+
+    std::vector<std::thread> threads;
+    for (int64_t it = 0; it < num_threads; ++it) {
+        threads.push_back(std::thread([=]() {
+            for (int64_t is = it; is < nslices; is += num_threads)
+                CppSyntheticSlice(segmentation, iz + is, slab + is * slice_size);
+        }));
+    }
+    for (uint64_t it = 0; it < threads.size(); ++it)
+        threads[it].join();
+}
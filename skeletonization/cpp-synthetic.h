@@ -0,0 +1,23 @@
+#ifndef __CPP_SYNTHETIC__
+#define __CPP_SYNTHETIC__
+
+#include <inttypes.h>
+
+
+
+// parametric segmentations of size x size x size voxels for benchmarks (the same shape, size and seed always give the
+// same labels); slices are generated one at a time so that the largest sizes never have to fit in memory
+struct SyntheticSegmentation;
+
+// shapes are tubes, trees, sheets, blobs, dense, heavy-tailed and sparse-ids (NULL for any other name)
+SyntheticSegmentation *CppNewSyntheticSegmentation(const char *shape, int64_t size, uint64_t seed);
+void CppDeleteSyntheticSegmentation(SyntheticSegmentation *segmentation);
+int64_t CppSyntheticMaxLabel(SyntheticSegmentation *segmentation);
+
+// write the size x size labels of slice iz in y, x order
+void CppSyntheticSlice(SyntheticSegmentation *segmentation, int64_t iz, int64_t *slice);
+
+// write nslices consecutive slices starting at iz (one slice per thread, all cores if num_threads is zero)
+void CppSyntheticSlab(SyntheticSegmentation *segmentation, int64_t iz, int64_t nslices, int64_t *slab, int64_t num_threads);
+
+#endif
@@ -2,7 +2,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
 #include "cpp-generate_skeletons.h"
+#include "cpp-perf.h"
+#include "cpp-pipeline.h"
+#include "cpp-storage.h"
 
 
 
@@ -17,77 +25,144 @@ static const int SOUTH = 3;
 static const int EAST = 4;
 static const int WEST = 5;
 
+// seconds between the checkpoints of a thinning run
+static const double journal_interval = 60.0;
 
+// the morton layout stores the working volume in bricks of 8 x 8 x 8 voxels (one brick is 512 bytes)
+static const int64_t morton_brick_bits = 3;
+static const int64_t morton_brick_size = 1 << morton_brick_bits;
 
-// lookup tables
 
-static unsigned char *lut_simple;
-static unsigned char *lut_isthmus;
 
+// mask variables for bitwise operations
 
+static const int64_t long_mask[26] = {
+    0x00000001, 0x00000002, 0x00000004, 0x00000008, 0x00000010, 0x00000020, 0x00000040, 0x00000080,
+    0x00000100, 0x00000200, 0x00000400, 0x00000800, 0x00001000, 0x00002000, 0x00004000, 0x00008000,
+    0x00010000, 0x00020000, 0x00040000, 0x00080000, 0x00100000, 0x00200000, 0x00400000, 0x00800000,
+    0x01000000, 0x02000000
+};
 
-// global variables
+static const unsigned char char_mask[8] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
 
-static int64_t grid_size[3];
-static int64_t nentries;
-static int64_t sheet_size;
-static int64_t row_size;
-static unsigned char *segmentation = NULL;
 
 
 
-// mask variables for bitwise operations
+// very simple double linked list data structure
+
+typedef struct {
+    int64_t iv, ix, iy, iz;
+    void *next;
+    void *prev;
+} ListElement;
+
+typedef struct {
+    void *first;
+    void *last;
+} List;
+
+typedef struct {
+    int64_t iv, ix, iy, iz;
+} Voxel;
+
+typedef struct {
+    Voxel v;
+    ListElement *ptr;
+    void *next;
+} Cell;
+
+typedef struct {
+    Cell *head;
+    Cell *tail;
+    int length;
+} PointList;
+
+typedef struct {
+    ListElement *first;
+    ListElement *last;
+} DoubleList;
+
+
+
+// a surface voxel added during thinning pass (iteration * NTHINNING_DIRECTIONS + direction) by deleting parent
+// (both in volume indices; the initial surface voxels have pass and parent -1)
+
+typedef struct {
+    int64_t element;
+    int64_t parent;
+    int64_t pass;
+} SurfaceRecord;
+
+
+
+// all of the state for thinning one volume (no globals so that contexts can run concurrently)
+
+struct ThinningContext {
+    // lookup tables (worker contexts share the tables of the context that read them)
+    unsigned char *lut_simple;
+    unsigned char *lut_isthmus;
+    bool owns_lookup_tables;
+
+    // size of the downsampled volume that the elements index into
+    int64_t volume_grid_size[3];
+
+    // working volume around the bounding box of the current segment with one voxel of padding on every side
+    int64_t grid_size[3];
+    int64_t nentries;
+    int64_t sheet_size;
+    int64_t row_size;
+    int64_t offsets[26];
+    unsigned char *segmentation;
+
+    // the morton layout orders bricks by z, y and x and the voxels within a brick along the z-order curve; bricks
+    // are aligned to the volume so that every working volume visits voxels in the same order, and the index of a
+    // voxel is the sum of the parts of its z, y and x coordinates
+    bool morton;
+    int64_t morton_origin[3];
+    int64_t morton_bricks[3];
+    std::vector<int64_t> morton_parts[3];
+    int64_t segmentation_capacity;
+
+    // voxels on the boundary of the current segment
+    List surface_voxels;
 
-static int64_t long_mask[26];
-static unsigned char char_mask[8];
-static int64_t offsets[26];
-
-
-
-static void set_long_mask(void)
-{
-    long_mask[ 0] = 0x00000001;
-    long_mask[ 1] = 0x00000002;
-    long_mask[ 2] = 0x00000004;
-    long_mask[ 3] = 0x00000008;
-    long_mask[ 4] = 0x00000010;
-    long_mask[ 5] = 0x00000020;
-    long_mask[ 6] = 0x00000040;
-    long_mask[ 7] = 0x00000080;
-    long_mask[ 8] = 0x00000100;
-    long_mask[ 9] = 0x00000200;
-    long_mask[10] = 0x00000400;
-    long_mask[11] = 0x00000800;
-    long_mask[12] = 0x00001000;
-    long_mask[13] = 0x00002000;
-    long_mask[14] = 0x00004000;
-    long_mask[15] = 0x00008000;
-    long_mask[16] = 0x00010000;
-    long_mask[17] = 0x00020000;
-    long_mask[18] = 0x00040000;
-    long_mask[19] = 0x00080000;
-    long_mask[20] = 0x00100000;
-    long_mask[21] = 0x00200000;
-    long_mask[22] = 0x00400000;
-    long_mask[23] = 0x00800000;
-    long_mask[24] = 0x01000000;
-    long_mask[25] = 0x02000000;
-}
-
-static void set_char_mask(void)
-{
-    char_mask[0] = 0x01;
-    char_mask[1] = 0x02;
-    char_mask[2] = 0x04;
-    char_mask[3] = 0x08;
-    char_mask[4] = 0x10;
-    char_mask[5] = 0x20;
-    char_mask[6] = 0x40;
-    char_mask[7] = 0x80;
-}
-
-static void PopulateOffsets(void)
+    // bounding box of the current segment in the volume
+    int64_t bounding_box[6];
+
+    // order in which surface voxels were added (only recorded when thinning one component of a larger segment)
+    std::vector<SurfaceRecord> *history;
+    int64_t pass;
+
+    // iterations and seconds each segment may thin for (unlimited if zero), and the time at which the current segment
+    // runs out of seconds (checked within the passes as well since a single pass over a large segment can be long)
+    int64_t max_iterations;
+    double max_seconds;
+    std::chrono::steady_clock::time_point deadline;
+    bool interrupted;
+
+    // progress on the current segment (the direction and changes of the current iteration allow it to be resumed)
+    bool converged;
+    int64_t iterations;
+    int direction;
+    int64_t iteration_changed;
+
+    // remaining voxels of the last segment that did not converge (see CppThinningState)
+    std::vector<int64_t> state;
+
+    // work done on the current segment (see CppThinningStatistics)
+    int64_t deleted[NTHINNING_DIRECTIONS];
+    int64_t isthmuses;
+    double detect_seconds;
+    double delete_seconds;
+};
+
+
+
+static void PopulateOffsets(ThinningContext *context)
 {
+    int64_t *offsets = context->offsets;
+    int64_t *grid_size = context->grid_size;
+
     offsets[0] = -1 * grid_size[IB_Y] * grid_size[IB_X] - grid_size[IB_X] - 1;
     offsets[1] = -1 * grid_size[IB_Y] * grid_size[IB_X] - grid_size[IB_X];
     offsets[2] = -1 * grid_size[IB_Y] * grid_size[IB_X] - grid_size[IB_X] + 1;
@@ -120,63 +195,49 @@ static void PopulateOffsets(void)
 
 
 
-static void IndexToIndices(int64_t iv, int64_t &ix, int64_t &iy, int64_t &iz)
+static int64_t IndicesToIndex(ThinningContext *context, int64_t ix, int64_t iy, int64_t iz)
 {
-    iz = iv / sheet_size;
-    iy = (iv - iz * sheet_size) / row_size;
-    ix = iv % row_size;
+    if (context->morton) return context->morton_parts[IB_Z][iz] + context->morton_parts[IB_Y][iy] + context->morton_parts[IB_X][ix];
+
+    return iz * context->sheet_size + iy * context->row_size + ix;
 }
 
 
 
-static int64_t IndicesToIndex(int64_t ix, int64_t iy, int64_t iz)
+// spread the low three bits of a coordinate to every third bit
+static int64_t MortonSpread(int64_t coordinate)
 {
-    return iz * sheet_size + iy * row_size + ix;
+    return (coordinate & 1) | ((coordinate & 2) << 2) | ((coordinate & 4) << 4);
 }
 
 
 
+static int64_t WorkingToVolumeIndex(ThinningContext *context, int64_t ix, int64_t iy, int64_t iz)
+{
+    int64_t *volume_grid_size = context->volume_grid_size;
 
-// very simple double linked list data structure
-
-typedef struct {
-    int64_t iv, ix, iy, iz;
-    void *next;
-    void *prev;
-} ListElement;
-
-typedef struct {
-    void *first;
-    void *last;
-} List;
-
-typedef struct {
-    int64_t iv, ix, iy, iz;
-} Voxel;
-
-typedef struct {
-    Voxel v;
-    ListElement *ptr;
-    void *next;
-} Cell;
-
-typedef struct {
-    Cell *head;
-    Cell *tail;
-    int length;
-} PointList;
-
-typedef struct {
-    ListElement *first;
-    ListElement *last;
-} DoubleList;
+    // remove the padding and the offset of the bounding box
+    iz = iz - 1 + context->bounding_box[IB_Z];
+    iy = iy - 1 + context->bounding_box[IB_Y];
+    ix = ix - 1 + context->bounding_box[IB_X];
 
-List surface_voxels;
+    return iz * volume_grid_size[IB_Y] * volume_grid_size[IB_X] + iy * volume_grid_size[IB_X] + ix;
+}
 
 
 
-static void NewSurfaceVoxel(int64_t iv, int64_t ix, int64_t iy, int64_t iz)
+static void NewSurfaceVoxel(ThinningContext *context, int64_t iv, int64_t ix, int64_t iy, int64_t iz, int64_t parent)
 {
+    List *surface_voxels = &(context->surface_voxels);
+
+    if (context->history) {
+        SurfaceRecord record;
+        record.element = WorkingToVolumeIndex(context, ix, iy, iz);
+        record.parent = parent;
+        record.pass = context->pass;
+        context->history->push_back(record);
+    }
+
     ListElement *LE = new ListElement();
     LE->iv = iv;
     LE->ix = ix;
@@ -184,20 +245,22 @@ static void NewSurfaceVoxel(int64_t iv, int64_t ix, int64_t iy, int64_t iz)
     LE->iz = iz;
 
     LE->next = NULL;
-    LE->prev = surface_voxels.last;
+    LE->prev = surface_voxels->last;
 
-    if (surface_voxels.last != NULL) ((ListElement *) surface_voxels.last)->next = LE;
-    surface_voxels.last = LE;
-    if (surface_voxels.first == NULL) surface_voxels.first = LE;
+    if (surface_voxels->last != NULL) ((ListElement *) surface_voxels->last)->next = LE;
+    surface_voxels->last = LE;
+    if (surface_voxels->first == NULL) surface_voxels->first = LE;
 }
 
 
 
-static void RemoveSurfaceVoxel(ListElement *LE)
+static void RemoveSurfaceVoxel(ThinningContext *context, ListElement *LE)
 {
+    List *surface_voxels = &(context->surface_voxels);
+
     ListElement *LE2;
-    if (surface_voxels.first == LE) surface_voxels.first = LE->next;
-    if (surface_voxels.last == LE) surface_voxels.last = LE->prev;
+    if (surface_voxels->first == LE) surface_voxels->first = LE->next;
+    if (surface_voxels->last == LE) surface_voxels->last = LE->prev;
 
     if (LE->next != NULL) {
         LE2 = (ListElement *)(LE->next);
@@ -276,63 +339,84 @@ static void DestroyPointList(PointList *s) {
 
 
 
-static void InitializeLookupTables(const char *lookup_table_directory)
+static bool InitializeLookupTables(ThinningContext *context, const char *lookup_table_directory)
 {
     char lut_filename[4096];
     FILE *lut_file;
 
     // read the simple lookup table
     sprintf(lut_filename, "%s/lut_simple.dat", lookup_table_directory);
-    lut_simple = new unsigned char[lookup_table_size];
+    context->lut_simple = new unsigned char[lookup_table_size];
     lut_file = fopen(lut_filename, "rb");
-    if (!lut_file) {
-        fprintf(stderr, "Failed to read %s\n", lut_filename);
-        exit(-1);
-    }
-    if (fread(lut_simple, 1, lookup_table_size, lut_file) != lookup_table_size) {
-        fprintf(stderr, "Failed to read %s\n", lut_filename);
-        exit(-1);
-    }
+    if (!lut_file) { fprintf(stderr, "Failed to read %s\n", lut_filename); return false; }
+    if (fread(context->lut_simple, 1, lookup_table_size, lut_file) != lookup_table_size) { fprintf(stderr, "Failed to read %s\n", lut_filename); fclose(lut_file); return false; }
     fclose(lut_file);
 
     // read the isthmus lookup table
     sprintf(lut_filename, "%s/lut_isthmus.dat", lookup_table_directory);
-    lut_isthmus = new unsigned char[lookup_table_size];
+    context->lut_isthmus = new unsigned char[lookup_table_size];
     lut_file = fopen(lut_filename, "rb");
-    if (!lut_file) {
-        fprintf(stderr, "Failed to read %s\n", lut_filename);
-        exit(-1);
-    }
-    if (fread(lut_isthmus, 1, lookup_table_size, lut_file) != lookup_table_size) {
-        fprintf(stderr, "Failed to read %s\n", lut_filename);
-        exit(-1);
-    }
+    if (!lut_file) { fprintf(stderr, "Failed to read %s\n", lut_filename); return false; }
+    if (fread(context->lut_isthmus, 1, lookup_table_size, lut_file) != lookup_table_size) { fprintf(stderr, "Failed to read %s\n", lut_filename); fclose(lut_file); return false; }
     fclose(lut_file);
 
-    // set the mask variables
-    set_char_mask();
-    set_long_mask();
+    return true;
 }
 
 
 
-static void CollectSurfaceVoxels(void)
+static void CollectSurfaceVoxel(ThinningContext *context, int64_t ix, int64_t iy, int64_t iz)
 {
-    for (int64_t iz = 1; iz < grid_size[IB_Z] - 1; ++iz) {
-        for (int64_t iy = 1; iy < grid_size[IB_Y] - 1; ++iy) {
-            for (int64_t ix = 1; ix < grid_size[IB_X] - 1; ++ix) {
-                int64_t iv = IndicesToIndex(ix, iy, iz);
-                if (segmentation[iv]) {
-                    if (!segmentation[IndicesToIndex(ix, iy, iz - 1)] ||
-                            !segmentation[IndicesToIndex(ix, iy, iz + 1)] ||
-                            !segmentation[IndicesToIndex(ix, iy - 1, iz)] ||
-                            !segmentation[IndicesToIndex(ix, iy + 1, iz)] ||
-                            !segmentation[IndicesToIndex(ix - 1, iy, iz)] ||
-                            !segmentation[IndicesToIndex(ix + 1, iy, iz)])
-                    {
-                        segmentation[iv] = 2;
-                        NewSurfaceVoxel(iv, ix, iy, iz);
-                    }
+    unsigned char *segmentation = context->segmentation;
+
+    int64_t iv = IndicesToIndex(context, ix, iy, iz);
+    if (segmentation[iv]) {
+        if (!segmentation[IndicesToIndex(context, ix, iy, iz - 1)] ||
+                !segmentation[IndicesToIndex(context, ix, iy, iz + 1)] ||
+                !segmentation[IndicesToIndex(context, ix, iy - 1, iz)] ||
+                !segmentation[IndicesToIndex(context, ix, iy + 1, iz)] ||
+                !segmentation[IndicesToIndex(context, ix - 1, iy, iz)] ||
+                !segmentation[IndicesToIndex(context, ix + 1, iy, iz)])
+        {
+            segmentation[iv] = 2;
+            NewSurfaceVoxel(context, iv, ix, iy, iz, -1);
+        }
+    }
+}
+
+
+
+// the surface list starts in the order of the working volume so that consecutive voxels share their neighborhoods
+static void CollectSurfaceVoxels(ThinningContext *context)
+{
+    int64_t *grid_size = context->grid_size;
+
+    if (!context->morton) {
+        for (int64_t iz = 1; iz < grid_size[IB_Z] - 1; ++iz)
+            for (int64_t iy = 1; iy < grid_size[IB_Y] - 1; ++iy)
+                for (int64_t ix = 1; ix < grid_size[IB_X] - 1; ++ix)
+                    CollectSurfaceVoxel(context, ix, iy, iz);
+
+        return;
+    }
+
+    // the bricks are in memory order so only the voxels of the segment are decoded (the padding is always zero)
+    int64_t *origin = context->morton_origin;
+    int64_t *bricks = context->morton_bricks;
+    int64_t brick_entries = morton_brick_size * morton_brick_size * morton_brick_size;
+    int64_t index = 0;
+    for (int64_t bz = 0; bz < bricks[IB_Z]; ++bz) {
+        for (int64_t by = 0; by < bricks[IB_Y]; ++by) {
+            for (int64_t bx = 0; bx < bricks[IB_X]; ++bx) {
+                for (int64_t code = 0; code < brick_entries; ++code, ++index) {
+                    if (!context->segmentation[index]) continue;
+
+                    // working coordinates of this voxel of the brick
+                    int64_t iz = (((origin[IB_Z] >> morton_brick_bits) + bz) << morton_brick_bits) + (((code >> 2) & 1) | ((code >> 4) & 2) | ((code >> 6) & 4)) - origin[IB_Z];
+                    int64_t iy = (((origin[IB_Y] >> morton_brick_bits) + by) << morton_brick_bits) + (((code >> 1) & 1) | ((code >> 3) & 2) | ((code >> 5) & 4)) - origin[IB_Y];
+                    int64_t ix = (((origin[IB_X] >> morton_brick_bits) + bx) << morton_brick_bits) + ((code & 1) | ((code >> 2) & 2) | ((code >> 4) & 4)) - origin[IB_X];
+
+                    CollectSurfaceVoxel(context, ix, iy, iz);
                 }
             }
         }
@@ -341,13 +425,37 @@ static void CollectSurfaceVoxels(void)
 
 
 
-static unsigned int Collect26Neighbors(int64_t ix, int64_t iy, int64_t iz)
+static unsigned int Collect26Neighbors(ThinningContext *context, int64_t ix, int64_t iy, int64_t iz)
 {
+    PERF_SCOPE(PERF_COLLECT_NEIGHBORS);
+
     unsigned int neighbors = 0;
-    int64_t index = IndicesToIndex(ix, iy, iz);
+
+    if (context->morton) {
+        // the neighbors in the order of the offsets from the parts of the three coordinates on either side
+        const int64_t *zparts = &(context->morton_parts[IB_Z][iz - 1]);
+        const int64_t *yparts = &(context->morton_parts[IB_Y][iy - 1]);
+        const int64_t *xparts = &(context->morton_parts[IB_X][ix - 1]);
+
+        int64_t iv = 0;
+        for (int64_t iw = 0; iw < 3; ++iw) {
+            for (int64_t iu = 0; iu < 3; ++iu) {
+                int64_t zyindex = zparts[iw] + yparts[iu];
+                for (int64_t it = 0; it < 3; ++it) {
+                    if (iw == 1 && iu == 1 && it == 1) continue;
+                    if (context->segmentation[zyindex + xparts[it]]) neighbors |= long_mask[iv];
+                    iv++;
+                }
+            }
+        }
+
+        return neighbors;
+    }
+
+    int64_t index = IndicesToIndex(context, ix, iy, iz);
 
     for (int64_t iv = 0; iv < 26; ++iv) {
-        if (segmentation[index + offsets[iv]]) neighbors |= long_mask[iv];
+        if (context->segmentation[index + context->offsets[iv]]) neighbors |= long_mask[iv];
     }
 
     return neighbors;
@@ -355,24 +463,47 @@ static unsigned int Collect26Neighbors(int64_t ix, int64_t iy, int64_t iz)
 
 
 
-static bool Simple26_6(unsigned int neighbors)
+static bool Simple26_6(ThinningContext *context, unsigned int neighbors)
 {
-    return lut_simple[(neighbors >> 3)] & char_mask[neighbors % 8];
+    PERF_SCOPE(PERF_SIMPLE_LOOKUP);
+
+    return context->lut_simple[(neighbors >> 3)] & char_mask[neighbors % 8];
 }
 
 
 
-static bool Isthmus(unsigned int neighbors)
+static bool Isthmus(ThinningContext *context, unsigned int neighbors)
 {
-    return lut_isthmus[(neighbors >> 3)] & char_mask[neighbors % 8];
+    PERF_SCOPE(PERF_ISTHMUS_LOOKUP);
+
+    return context->lut_isthmus[(neighbors >> 3)] & char_mask[neighbors % 8];
 }
 
 
 
-static void DetectSimpleBorderPoints(PointList *deletable_points, int direction)
+// whether the current segment ran out of seconds (the clock is only read once every 1024 calls)
+static bool DeadlinePassed(ThinningContext *context, int64_t &ncalls)
 {
-    ListElement *LE = (ListElement *)surface_voxels.first;
+    if (context->max_seconds <= 0 || (++ncalls & 1023)) return false;
+    if (std::chrono::steady_clock::now() < context->deadline) return false;
+
+    context->interrupted = true;
+    return true;
+}
+
+
+
+static void DetectSimpleBorderPoints(ThinningContext *context, PointList *deletable_points, int direction)
+{
+    PERF_SCOPE(PERF_DETECT_BORDER_POINTS);
+
+    unsigned char *segmentation = context->segmentation;
+    int64_t ncalls = 0;
+
+    ListElement *LE = (ListElement *)context->surface_voxels.first;
     while (LE != NULL) {
+        if (DeadlinePassed(context, ncalls)) return;
+
         int64_t iv = LE->iv;
         int64_t ix = LE->ix;
         int64_t iy = LE->iy;
@@ -383,37 +514,37 @@ static void DetectSimpleBorderPoints(PointList *deletable_points, int direction)
             int64_t value = 0;
             switch (direction) {
             case UP: {
-                value = segmentation[IndicesToIndex(ix, iy - 1, iz)];
+                value = segmentation[IndicesToIndex(context, ix, iy - 1, iz)];
                 break;
             }
             case DOWN: {
-                value = segmentation[IndicesToIndex(ix, iy + 1, iz)];
+                value = segmentation[IndicesToIndex(context, ix, iy + 1, iz)];
                 break;
             }
             case NORTH: {
-                value = segmentation[IndicesToIndex(ix, iy, iz - 1)];
+                value = segmentation[IndicesToIndex(context, ix, iy, iz - 1)];
                 break;
             }
             case SOUTH: {
-                value = segmentation[IndicesToIndex(ix, iy, iz + 1)];
+                value = segmentation[IndicesToIndex(context, ix, iy, iz + 1)];
                 break;
             }
             case EAST: {
-                value = segmentation[IndicesToIndex(ix + 1, iy, iz)];
+                value = segmentation[IndicesToIndex(context, ix + 1, iy, iz)];
                 break;
             }
             case WEST: {
-                value = segmentation[IndicesToIndex(ix - 1, iy, iz)];
+                value = segmentation[IndicesToIndex(context, ix - 1, iy, iz)];
                 break;
             }
             }
 
             // see if the required point belongs to a different segment
             if (!value) {
-                unsigned int neighbors = Collect26Neighbors(ix, iy, iz);
+                unsigned int neighbors = Collect26Neighbors(context, ix, iy, iz);
 
                 // deletable point
-                if (Simple26_6(neighbors)) {
+                if (Simple26_6(context, neighbors)) {
                     Voxel voxel;
                     voxel.iv = iv;
                     voxel.ix = ix;
@@ -422,8 +553,9 @@ static void DetectSimpleBorderPoints(PointList *deletable_points, int direction)
                     AddToList(deletable_points, voxel, LE);
                 }
                 else {
-                    if (Isthmus(neighbors)) {
+                    if (Isthmus(context, neighbors)) {
                         segmentation[iv] = 3;
+                        context->isthmuses++;
                     }
                 }
             }
@@ -434,65 +566,84 @@ static void DetectSimpleBorderPoints(PointList *deletable_points, int direction)
 
 
 
-static int64_t ThinningIterationStep(void)
+static int64_t ThinningDirectionStep(ThinningContext *context, int direction)
 {
+    unsigned char *segmentation = context->segmentation;
     int64_t changed = 0;
 
-    // iterate through every direction
-    for (int direction = 0; direction < NTHINNING_DIRECTIONS; ++direction) {
-        PointList deletable_points;
-        ListElement *ptr;
+    context->pass++;
 
-        CreatePointList(&deletable_points);
-        DetectSimpleBorderPoints(&deletable_points, direction);
+    PointList deletable_points;
+    ListElement *ptr;
 
-        while (deletable_points.length) {
-            Voxel voxel = GetFromList(&deletable_points, &ptr);
+    std::chrono::steady_clock::time_point detect_time = std::chrono::steady_clock::now();
 
-            int64_t iv = voxel.iv;
-            int64_t ix = voxel.ix;
-            int64_t iy = voxel.iy;
-            int64_t iz = voxel.iz;
+    CreatePointList(&deletable_points);
+    DetectSimpleBorderPoints(context, &deletable_points, direction);
 
-            unsigned int neighbors = Collect26Neighbors(ix, iy, iz);
-            if (Simple26_6(neighbors)) {
-                // delete the simple point
-                segmentation[iv] = 0;
+    std::chrono::steady_clock::time_point delete_time = std::chrono::steady_clock::now();
+    context->detect_seconds += std::chrono::duration<double>(delete_time - detect_time).count();
 
-                // add the new surface voxels
-                if (segmentation[IndicesToIndex(ix - 1, iy, iz)] == 1) {
-                    NewSurfaceVoxel(IndicesToIndex(ix - 1, iy, iz), ix - 1, iy, iz);
-                    segmentation[IndicesToIndex(ix - 1, iy, iz)] = 2;
-                }
-                if (segmentation[IndicesToIndex(ix + 1, iy, iz)] == 1) {
-                    NewSurfaceVoxel(IndicesToIndex(ix + 1, iy, iz), ix + 1, iy, iz);
-                    segmentation[IndicesToIndex(ix + 1, iy, iz)] = 2;
-                }
-                if (segmentation[IndicesToIndex(ix, iy - 1, iz)] == 1) {
-                    NewSurfaceVoxel(IndicesToIndex(ix, iy - 1, iz), ix, iy - 1, iz);
-                    segmentation[IndicesToIndex(ix, iy - 1, iz)] = 2;
-                }
-                if (segmentation[IndicesToIndex(ix, iy + 1, iz)] == 1) {
-                    NewSurfaceVoxel(IndicesToIndex(ix, iy + 1, iz), ix, iy + 1, iz);
-                    segmentation[IndicesToIndex(ix, iy + 1, iz)] = 2;
-                }
-                if (segmentation[IndicesToIndex(ix, iy, iz - 1)] == 1) {
-                    NewSurfaceVoxel(IndicesToIndex(ix, iy, iz - 1), ix, iy, iz - 1);
-                    segmentation[IndicesToIndex(ix, iy, iz - 1)] = 2;
-                }
-                if (segmentation[IndicesToIndex(ix, iy, iz + 1)] == 1) {
-                    NewSurfaceVoxel(IndicesToIndex(ix, iy, iz + 1), ix, iy, iz + 1);
-                    segmentation[IndicesToIndex(ix, iy, iz + 1)] = 2;
-                }
+    // the isthmuses found so far stay marked and nothing else changed, so detecting this direction again continues
+    // exactly where the detection stopped
+    if (context->interrupted) {
+        DestroyPointList(&deletable_points);
+        return 0;
+    }
 
-                // remove this from the surface voxels
-                RemoveSurfaceVoxel(ptr);
-                changed += 1;
+    int64_t ncalls = 0;
+    while (deletable_points.length) {
+        // every deletion keeps the topology so the segment can stop after any of them
+        if (DeadlinePassed(context, ncalls)) break;
+
+        Voxel voxel = GetFromList(&deletable_points, &ptr);
+
+        int64_t iv = voxel.iv;
+        int64_t ix = voxel.ix;
+        int64_t iy = voxel.iy;
+        int64_t iz = voxel.iz;
+
+        unsigned int neighbors = Collect26Neighbors(context, ix, iy, iz);
+        if (Simple26_6(context, neighbors)) {
+            // delete the simple point
+            segmentation[iv] = 0;
+            int64_t parent = context->history ? WorkingToVolumeIndex(context, ix, iy, iz) : -1;
+
+            // add the new surface voxels
+            if (segmentation[IndicesToIndex(context, ix - 1, iy, iz)] == 1) {
+                NewSurfaceVoxel(context, IndicesToIndex(context, ix - 1, iy, iz), ix - 1, iy, iz, parent);
+                segmentation[IndicesToIndex(context, ix - 1, iy, iz)] = 2;
+            }
+            if (segmentation[IndicesToIndex(context, ix + 1, iy, iz)] == 1) {
+                NewSurfaceVoxel(context, IndicesToIndex(context, ix + 1, iy, iz), ix + 1, iy, iz, parent);
+                segmentation[IndicesToIndex(context, ix + 1, iy, iz)] = 2;
+            }
+            if (segmentation[IndicesToIndex(context, ix, iy - 1, iz)] == 1) {
+                NewSurfaceVoxel(context, IndicesToIndex(context, ix, iy - 1, iz), ix, iy - 1, iz, parent);
+                segmentation[IndicesToIndex(context, ix, iy - 1, iz)] = 2;
+            }
+            if (segmentation[IndicesToIndex(context, ix, iy + 1, iz)] == 1) {
+                NewSurfaceVoxel(context, IndicesToIndex(context, ix, iy + 1, iz), ix, iy + 1, iz, parent);
+                segmentation[IndicesToIndex(context, ix, iy + 1, iz)] = 2;
             }
+            if (segmentation[IndicesToIndex(context, ix, iy, iz - 1)] == 1) {
+                NewSurfaceVoxel(context, IndicesToIndex(context, ix, iy, iz - 1), ix, iy, iz - 1, parent);
+                segmentation[IndicesToIndex(context, ix, iy, iz - 1)] = 2;
+            }
+            if (segmentation[IndicesToIndex(context, ix, iy, iz + 1)] == 1) {
+                NewSurfaceVoxel(context, IndicesToIndex(context, ix, iy, iz + 1), ix, iy, iz + 1, parent);
+                segmentation[IndicesToIndex(context, ix, iy, iz + 1)] = 2;
+            }
+
+            // remove this from the surface voxels
+            RemoveSurfaceVoxel(context, ptr);
+            changed += 1;
         }
-        DestroyPointList(&deletable_points);
     }
+    DestroyPointList(&deletable_points);
 
+    context->deleted[direction] += changed;
+    context->delete_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - delete_time).count();
 
     // return the number of changes
     return changed;
@@ -500,30 +651,71 @@ static int64_t ThinningIterationStep(void)
 
 
 
-static void SequentialThinning(void)
+// thin until an iteration through every direction changes nothing or the iteration or time budget of the context
+// runs out (iterations are checked before every direction so that the state is resumed from the next direction;
+// seconds are checked within the directions as well and a direction that was interrupted is resumed from its start,
+// which only matches an uninterrupted run exactly when it stopped before deleting anything)
+static void ContinueThinning(ThinningContext *context)
 {
-    // create a vector of surface voxels
-    CollectSurfaceVoxels();
-    int iteration = 0;
-    int64_t changed = 0;
-    do {
-        changed = ThinningIterationStep();
-        iteration++;
-    } while (changed);
+    context->deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(context->max_seconds));
+    context->interrupted = false;
+
+    context->converged = false;
+    while (true) {
+        if (!context->direction && context->max_iterations > 0 && context->iterations >= context->max_iterations) break;
+        if (context->max_seconds > 0 && std::chrono::steady_clock::now() >= context->deadline) break;
+
+        if (!context->direction) {
+            context->iterations++;
+            context->iteration_changed = 0;
+        }
+
+        context->iteration_changed += ThinningDirectionStep(context, context->direction);
+        if (context->interrupted) break;
+        context->direction = (context->direction + 1) % NTHINNING_DIRECTIONS;
+
+        if (!context->direction && !context->iteration_changed) {
+            context->converged = true;
+            break;
+        }
+    }
+}
+
+
+
+static void ResetThinningStatistics(ThinningContext *context)
+{
+    for (int direction = 0; direction < NTHINNING_DIRECTIONS; ++direction)
+        context->deleted[direction] = 0;
+    context->isthmuses = 0;
+    context->detect_seconds = 0.0;
+    context->delete_seconds = 0.0;
 }
 
 
-static bool IsEndpoint(int64_t iv)
+
+static void SequentialThinning(ThinningContext *context)
 {
-    int64_t ix, iy, iz;
-    IndexToIndices(iv, ix, iy, iz);
+    // create a vector of surface voxels
+    context->pass = -1;
+    CollectSurfaceVoxels(context);
+
+    ResetThinningStatistics(context);
+    context->iterations = 0;
+    context->direction = 0;
+    context->iteration_changed = 0;
+    ContinueThinning(context);
+}
+
 
+static bool IsEndpoint(ThinningContext *context, int64_t ix, int64_t iy, int64_t iz)
+{
     short nnneighbors = 0;
     for (int64_t iw = iz - 1; iw <= iz + 1; ++iw) {
         for (int64_t iv = iy - 1; iv <= iy + 1; ++iv) {
             for (int64_t iu = ix - 1; iu <= ix + 1; ++iu) {
-                int64_t linear_index = IndicesToIndex(iu, iv, iw);
-                if (segmentation[linear_index]) nnneighbors++;
+                int64_t linear_index = IndicesToIndex(context, iu, iv, iw);
+                if (context->segmentation[linear_index]) nnneighbors++;
             }
         }
     }
@@ -535,122 +727,1155 @@ static bool IsEndpoint(int64_t iv)
 
 
 
-void CppTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory)
+static ThinningContext *AllocateThinningContext(void)
+{
+    ThinningContext *context = new ThinningContext();
+    context->lut_simple = NULL;
+    context->lut_isthmus = NULL;
+    context->owns_lookup_tables = true;
+    context->segmentation = NULL;
+    context->segmentation_capacity = 0;
+    context->surface_voxels.first = NULL;
+    context->surface_voxels.last = NULL;
+    context->morton = false;
+    context->history = NULL;
+    context->pass = -1;
+    context->max_iterations = 0;
+    context->max_seconds = 0;
+    context->converged = true;
+    context->iterations = 0;
+    context->direction = 0;
+    context->iteration_changed = 0;
+    ResetThinningStatistics(context);
+
+    return context;
+}
+
+
+
+ThinningContext *CppNewThinningContext(const char *lookup_table_directory)
+{
+    ThinningContext *context = AllocateThinningContext();
+
+    // initialize all of the lookup tables
+    if (!InitializeLookupTables(context, lookup_table_directory)) {
+        CppDeleteThinningContext(context);
+        return NULL;
+    }
+
+    return context;
+}
+
+
+
+ThinningContext *CppNewWorkerThinningContext(ThinningContext *context)
+{
+    ThinningContext *worker = AllocateThinningContext();
+
+    // the lookup tables are only read so every worker can use the same copy
+    worker->lut_simple = context->lut_simple;
+    worker->lut_isthmus = context->lut_isthmus;
+    worker->owns_lookup_tables = false;
+
+    worker->max_iterations = context->max_iterations;
+    worker->max_seconds = context->max_seconds;
+    worker->morton = context->morton;
+
+    worker->volume_grid_size[IB_Z] = context->volume_grid_size[IB_Z];
+    worker->volume_grid_size[IB_Y] = context->volume_grid_size[IB_Y];
+    worker->volume_grid_size[IB_X] = context->volume_grid_size[IB_X];
+
+    return worker;
+}
+
+
+
+void CppDeleteThinningContext(ThinningContext *context)
+{
+    // remove any remaining surface voxels
+    while (context->surface_voxels.first != NULL)
+        RemoveSurfaceVoxel(context, (ListElement *) context->surface_voxels.first);
+
+    delete[] context->segmentation;
+    if (context->owns_lookup_tables) {
+        delete[] context->lut_simple;
+        delete[] context->lut_isthmus;
+    }
+    delete context;
+}
+
+
+
+void CppSetThinningGridSize(ThinningContext *context, int64_t grid_size[3])
+{
+    context->volume_grid_size[IB_Z] = grid_size[IB_Z];
+    context->volume_grid_size[IB_Y] = grid_size[IB_Y];
+    context->volume_grid_size[IB_X] = grid_size[IB_X];
+}
+
+
+
+void CppSetThinningLayout(ThinningContext *context, bool morton)
+{
+    context->morton = morton;
+}
+
+
+
+void CppSetThinningBudget(ThinningContext *context, int64_t max_iterations, double max_seconds)
+{
+    context->max_iterations = max_iterations;
+    context->max_seconds = max_seconds;
+}
+
+
+
+bool CppThinningConverged(ThinningContext *context)
+{
+    return context->converged;
+}
+
+
+
+int64_t CppThinningIterations(ThinningContext *context)
+{
+    return context->iterations;
+}
+
+
+
+std::vector<int64_t> &CppThinningState(ThinningContext *context)
+{
+    return context->state;
+}
+
+
+
+void CppThinningStatistics(ThinningContext *context, ThinningStatistics *statistics)
+{
+    statistics->iterations = context->iterations;
+    for (int direction = 0; direction < NTHINNING_DIRECTIONS; ++direction)
+        statistics->deleted[direction] = context->deleted[direction];
+    statistics->isthmuses = context->isthmuses;
+    statistics->detect_seconds = context->detect_seconds;
+    statistics->delete_seconds = context->delete_seconds;
+}
+
+
+
+static void SetWorkingVolume(ThinningContext *context, int64_t bounding_box[6])
+{
+    // add padding around each segment (only way that populate offsets works!!)
+    context->grid_size[IB_Z] = bounding_box[3 + IB_Z] - bounding_box[IB_Z] + 2;
+    context->grid_size[IB_Y] = bounding_box[3 + IB_Y] - bounding_box[IB_Y] + 2;
+    context->grid_size[IB_X] = bounding_box[3 + IB_X] - bounding_box[IB_X] + 2;
+
+    // set indexing parameters
+    context->nentries = context->grid_size[IB_Z] * context->grid_size[IB_Y] * context->grid_size[IB_X];
+    context->sheet_size = context->grid_size[IB_Y] * context->grid_size[IB_X];
+    context->row_size = context->grid_size[IB_X];
+    PopulateOffsets(context);
+
+    if (context->morton) {
+        // working coordinate zero is one voxel before the bounding box (shifted by one so that it is not negative)
+        int64_t brick_entries = morton_brick_size * morton_brick_size * morton_brick_size;
+        int64_t strides[3];
+        strides[IB_X] = brick_entries;
+        for (int dim = IB_X; dim >= IB_Z; --dim) {
+            int64_t origin = bounding_box[dim];
+            context->morton_origin[dim] = origin;
+            context->morton_bricks[dim] = ((origin + context->grid_size[dim] - 1) >> morton_brick_bits) - (origin >> morton_brick_bits) + 1;
+            if (dim > IB_Z) strides[dim - 1] = strides[dim] * context->morton_bricks[dim];
+
+            // x takes the lowest bit of every group of three bits within a brick, then y, then z
+            std::vector<int64_t> &parts = context->morton_parts[dim];
+            parts.resize(context->grid_size[dim]);
+            for (int64_t index = 0; index < context->grid_size[dim]; ++index) {
+                int64_t coordinate = origin + index;
+                int64_t brick = (coordinate >> morton_brick_bits) - (origin >> morton_brick_bits);
+                parts[index] = brick * strides[dim] + (MortonSpread(coordinate & (morton_brick_size - 1)) << (IB_X - dim));
+            }
+        }
+
+        context->nentries = context->morton_bricks[IB_Z] * strides[IB_Z];
+    }
+
+    // the working volume only grows so that it is reused for most labels
+    if (context->nentries > context->segmentation_capacity) {
+        delete[] context->segmentation;
+        context->segmentation = new unsigned char[context->nentries];
+        context->segmentation_capacity = context->nentries;
+    }
+    memset(context->segmentation, 0, context->nentries);
+}
+
+
+
+void CppSegmentBoundingBox(int64_t grid_size[3], int64_t *elements, int64_t nelements, int64_t bounding_box[6])
+{
+    bounding_box[IB_Z] = grid_size[IB_Z];
+    bounding_box[IB_Y] = grid_size[IB_Y];
+    bounding_box[IB_X] = grid_size[IB_X];
+    bounding_box[3 + IB_Z] = 0;
+    bounding_box[3 + IB_Y] = 0;
+    bounding_box[3 + IB_X] = 0;
+
+    for (int64_t iv = 0; iv < nelements; ++iv) {
+        int64_t element = elements[iv];
+
+        int64_t iz = element / (grid_size[IB_Y] * grid_size[IB_X]);
+        int64_t iy = (element - iz * grid_size[IB_Y] * grid_size[IB_X]) / grid_size[IB_X];
+        int64_t ix = element % grid_size[IB_X];
+
+        if (iz < bounding_box[IB_Z]) bounding_box[IB_Z] = iz;
+        if (iy < bounding_box[IB_Y]) bounding_box[IB_Y] = iy;
+        if (ix < bounding_box[IB_X]) bounding_box[IB_X] = ix;
+        if (iz + 1 > bounding_box[3 + IB_Z]) bounding_box[3 + IB_Z] = iz + 1;
+        if (iy + 1 > bounding_box[3 + IB_Y]) bounding_box[3 + IB_Y] = iy + 1;
+        if (ix + 1 > bounding_box[3 + IB_X]) bounding_box[3 + IB_X] = ix + 1;
+    }
+
+    // empty segments get an empty box
+    if (!nelements) {
+        for (int dim = 0; dim < 6; ++dim)
+            bounding_box[dim] = 0;
+    }
+}
+
+
+
+// save the remaining voxels of a segment that did not converge with their values (the surface voxels in the order
+// of the surface list and then the interior voxels) after the direction and changes of the interrupted iteration and
+// the layout (resuming in the same layout continues exactly as an uninterrupted run)
+static void SaveThinningState(ThinningContext *context)
+{
+    std::vector<int64_t> &state = context->state;
+    state.clear();
+    state.push_back(context->direction);
+    state.push_back(context->iteration_changed);
+    state.push_back(context->morton);
+
+    ListElement *LE = (ListElement *) context->surface_voxels.first;
+    while (LE != NULL) {
+        state.push_back(WorkingToVolumeIndex(context, LE->ix, LE->iy, LE->iz));
+        state.push_back(context->segmentation[LE->iv]);
+        LE = (ListElement *) LE->next;
+    }
+
+    int64_t *grid_size = context->grid_size;
+    for (int64_t iz = 1; iz < grid_size[IB_Z] - 1; ++iz) {
+        for (int64_t iy = 1; iy < grid_size[IB_Y] - 1; ++iy) {
+            for (int64_t ix = 1; ix < grid_size[IB_X] - 1; ++ix) {
+                if (context->segmentation[IndicesToIndex(context, ix, iy, iz)] != 1) continue;
+
+                state.push_back(WorkingToVolumeIndex(context, ix, iy, iz));
+                state.push_back(1);
+            }
+        }
+    }
+}
+
+
+
+// write the remaining surface voxels as the skeleton and empty the surface list (the surface of a segment that did not
+// converge is not a skeleton yet and is flagged by the convergence of the segment; its state keeps the interior
+// voxels as well so that it can be resumed)
+static int64_t CollectSkeleton(ThinningContext *context, int64_t *skeleton)
+{
+    if (!context->converged) SaveThinningState(context);
+    else context->state.clear();
+
+    // the skeleton can never have more points than the segment
+    int64_t nskeleton = 0;
+    while (context->surface_voxels.first != NULL) {
+        // get the surface voxels
+        ListElement *LE = (ListElement *) context->surface_voxels.first;
+
+        // get the coordinates for this skeleton point in the non-cropped segmentation
+        int64_t iv = WorkingToVolumeIndex(context, LE->ix, LE->iy, LE->iz);
+
+        // endpoints are written as negatives
+        if (IsEndpoint(context, LE->ix, LE->iy, LE->iz)) iv = -1 * iv;
+        skeleton[nskeleton++] = iv;
+
+        // remove this voxel
+        RemoveSurfaceVoxel(context, LE);
+    }
+
+    return nskeleton;
+}
+
+
+
+int64_t CppThinSegment(ThinningContext *context, int64_t *elements, int64_t nelements, int64_t *skeleton)
+{
+    int64_t *volume_grid_size = context->volume_grid_size;
+
+    // thin within the bounding box of this segment rather than the entire volume
+    int64_t *bounding_box = context->bounding_box;
+    CppSegmentBoundingBox(volume_grid_size, elements, nelements, bounding_box);
+    SetWorkingVolume(context, bounding_box);
+
+    unsigned char *segmentation = context->segmentation;
+    for (int64_t iv = 0; iv < nelements; ++iv) {
+        int64_t element = elements[iv];
+
+        // convert the element to non-cropped iz, iy, ix
+        int64_t iz = element / (volume_grid_size[IB_X] * volume_grid_size[IB_Y]);
+        int64_t iy = (element - iz * volume_grid_size[IB_X] * volume_grid_size[IB_Y]) / volume_grid_size[IB_X];
+        int64_t ix = element % volume_grid_size[IB_X];
+
+        // update the element based on the bounding box and the padding
+        element = IndicesToIndex(context, ix - bounding_box[IB_X] + 1, iy - bounding_box[IB_Y] + 1, iz - bounding_box[IB_Z] + 1);
+        segmentation[element] = 1;
+    }
+
+    // call the sequential thinning algorithm
+    SequentialThinning(context);
+
+    return CollectSkeleton(context, skeleton);
+}
+
+
+
+int64_t CppResumeThinSegment(ThinningContext *context, int64_t *state, int64_t nstate, int64_t *skeleton)
+{
+    int64_t *volume_grid_size = context->volume_grid_size;
+
+    // the state has the direction and changes of the interrupted iteration and the layout followed by voxels and
+    // their values
+    int64_t nvoxels = (nstate - 3) / 2;
+    std::vector<int64_t> elements = std::vector<int64_t>(nvoxels);
+    for (int64_t iv = 0; iv < nvoxels; ++iv)
+        elements[iv] = state[3 + 2 * iv];
+
+    context->morton = state[2];
+    int64_t *bounding_box = context->bounding_box;
+    CppSegmentBoundingBox(volume_grid_size, elements.data(), nvoxels, bounding_box);
+    SetWorkingVolume(context, bounding_box);
+
+    // the surface voxels come first in the order of the surface list
+    for (int64_t iv = 0; iv < nvoxels; ++iv) {
+        int64_t element = elements[iv];
+
+        int64_t iz = element / (volume_grid_size[IB_X] * volume_grid_size[IB_Y]) - bounding_box[IB_Z] + 1;
+        int64_t iy = (element % (volume_grid_size[IB_X] * volume_grid_size[IB_Y])) / volume_grid_size[IB_X] - bounding_box[IB_Y] + 1;
+        int64_t ix = element % volume_grid_size[IB_X] - bounding_box[IB_X] + 1;
+        int64_t index = IndicesToIndex(context, ix, iy, iz);
+
+        context->segmentation[index] = state[3 + 2 * iv + 1];
+        if (context->segmentation[index] > 1) NewSurfaceVoxel(context, index, ix, iy, iz, -1);
+    }
+
+    context->pass = -1;
+    ResetThinningStatistics(context);
+    context->iterations = 0;
+    context->direction = state[0];
+    context->iteration_changed = state[1];
+    ContinueThinning(context);
+
+    return CollectSkeleton(context, skeleton);
+}
+
+
+
+// split the elements of a segment into its 26-connected components
+static void SegmentComponents(int64_t grid_size[3], std::vector<int64_t> &elements, std::vector<std::vector<int64_t> > &components)
+{
+    int64_t sheet_size = grid_size[IB_Y] * grid_size[IB_X];
+    int64_t row_size = grid_size[IB_X];
+
+    // component of every element (-1 until it is reached)
+    std::unordered_map<int64_t, int64_t> component_of;
+    component_of.reserve(elements.size());
+    for (uint64_t ie = 0; ie < elements.size(); ++ie)
+        component_of[elements[ie]] = -1;
+
+    std::vector<int64_t> stack;
+    for (uint64_t ie = 0; ie < elements.size(); ++ie) {
+        if (component_of[elements[ie]] != -1) continue;
+
+        int64_t component = components.size();
+        components.push_back(std::vector<int64_t>());
+        component_of[elements[ie]] = component;
+        stack.push_back(elements[ie]);
+
+        while (stack.size()) {
+            int64_t element = stack.back();
+            stack.pop_back();
+            components[component].push_back(element);
+
+            int64_t iz = element / sheet_size;
+            int64_t iy = (element - iz * sheet_size) / row_size;
+            int64_t ix = element % row_size;
+
+            for (int64_t iw = std::max(iz - 1, (int64_t) 0); iw <= std::min(iz + 1, grid_size[IB_Z] - 1); ++iw) {
+                for (int64_t iv = std::max(iy - 1, (int64_t) 0); iv <= std::min(iy + 1, grid_size[IB_Y] - 1); ++iv) {
+                    for (int64_t iu = std::max(ix - 1, (int64_t) 0); iu <= std::min(ix + 1, grid_size[IB_X] - 1); ++iu) {
+                        std::unordered_map<int64_t, int64_t>::iterator neighbor = component_of.find(iw * sheet_size + iv * row_size + iu);
+                        if (neighbor == component_of.end() || neighbor->second != -1) continue;
+
+                        neighbor->second = component;
+                        stack.push_back(neighbor->first);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+// thin one component of a segment and record the order in which it added surface voxels
+static int64_t ThinSegmentComponent(ThinningContext *context, std::vector<int64_t> &elements, std::vector<SurfaceRecord> &history)
+{
+    context->history = &history;
+    int64_t nskeleton = CppThinSegment(context, elements.data(), elements.size(), elements.data());
+    context->history = NULL;
+
+    return nskeleton;
+}
+
+
+
+// position of a volume element in the order of the morton layout (bricks by z, y and x with up to 2^18 bricks along
+// every axis, then the z-order curve within the brick) with the coordinates shifted by the padding like the layout
+static uint64_t MortonKey(int64_t grid_size[3], int64_t element)
+{
+    int64_t iz = element / (grid_size[IB_Y] * grid_size[IB_X]) + 1;
+    int64_t iy = (element / grid_size[IB_X]) % grid_size[IB_Y] + 1;
+    int64_t ix = element % grid_size[IB_X] + 1;
+
+    uint64_t brick = ((iz >> morton_brick_bits) << 36) | ((iy >> morton_brick_bits) << 18) | (ix >> morton_brick_bits);
+    int64_t mask = morton_brick_size - 1;
+
+    return (brick << 9) | (MortonSpread(iz & mask) << 2) | (MortonSpread(iy & mask) << 1) | MortonSpread(ix & mask);
+}
+
+
+
+// merge the skeletons of the components into the order of thinning the entire segment at once: the components
+// never share a 26-neighborhood so they delete the same voxels in the same passes and only the order of the
+// surface list, which is the order of the skeleton, depends on the other components
+static void MergeComponentSkeletons(int64_t grid_size[3], bool morton, std::vector<std::vector<int64_t> > &skeletons, std::vector<std::vector<SurfaceRecord> > &histories, std::vector<int64_t> &skeleton)
+{
+    // position of every surface voxel in the surface list of the entire segment
+    std::unordered_map<int64_t, int64_t> rank;
+    std::vector<SurfaceRecord> records;
+    std::vector<uint64_t> cursors = std::vector<uint64_t>(histories.size(), 0);
+
+    for (int64_t pass = -1; ; ++pass) {
+        records.clear();
+        int64_t next_pass = -1;
+        for (uint64_t ic = 0; ic < histories.size(); ++ic) {
+            while (cursors[ic] < histories[ic].size() && histories[ic][cursors[ic]].pass == pass)
+                records.push_back(histories[ic][cursors[ic]++]);
+            if (cursors[ic] < histories[ic].size() && (next_pass == -1 || histories[ic][cursors[ic]].pass < next_pass))
+                next_pass = histories[ic][cursors[ic]].pass;
+        }
+
+        // the initial surface is collected in the order of the layout and later voxels are added in the order of the
+        // voxels deleted in the pass (the neighbors of a single deleted voxel all come from one component in order)
+        if (pass == -1 && morton) std::sort(records.begin(), records.end(), [&](const SurfaceRecord &a, const SurfaceRecord &b) { return MortonKey(grid_size, a.element) < MortonKey(grid_size, b.element); });
+        else if (pass == -1) std::sort(records.begin(), records.end(), [](const SurfaceRecord &a, const SurfaceRecord &b) { return a.element < b.element; });
+        else std::stable_sort(records.begin(), records.end(), [&](const SurfaceRecord &a, const SurfaceRecord &b) { return rank[a.parent] < rank[b.parent]; });
+
+        for (uint64_t ir = 0; ir < records.size(); ++ir) {
+            int64_t position = rank.size();
+            rank[records[ir].element] = position;
+        }
+
+        if (next_pass == -1) break;
+        pass = next_pass - 1;
+    }
+
+    skeleton.clear();
+    for (uint64_t ic = 0; ic < skeletons.size(); ++ic)
+        skeleton.insert(skeleton.end(), skeletons[ic].begin(), skeletons[ic].end());
+
+    // endpoints are negative
+    std::sort(skeleton.begin(), skeleton.end(), [&](int64_t a, int64_t b) { return rank[a < 0 ? -1 * a : a] < rank[b < 0 ? -1 * b : b]; });
+}
+
+
+
+// estimated bytes needed to thin a segment: the padded working volume plus the element and surface lists
+int64_t CppThinningMemoryCost(int64_t nelements, int64_t bounding_box[6], bool morton)
+{
+    int64_t nentries = (bounding_box[3 + IB_Z] - bounding_box[IB_Z] + 2) * (bounding_box[3 + IB_Y] - bounding_box[IB_Y] + 2) * (bounding_box[3 + IB_X] - bounding_box[IB_X] + 2);
+
+    // the morton layout rounds the padded volume out to whole bricks (as in SetWorkingVolume)
+    if (morton) {
+        nentries = morton_brick_size * morton_brick_size * morton_brick_size;
+        for (int dim = 0; dim < 3; ++dim) {
+            int64_t origin = bounding_box[dim];
+            int64_t size = bounding_box[3 + dim] - bounding_box[dim] + 2;
+            nentries *= ((origin + size - 1) >> morton_brick_bits) - (origin >> morton_brick_bits) + 1;
+        }
+    }
+
+    return nentries + nelements * (2 * sizeof(int64_t) + sizeof(ListElement));
+}
+
+
+
+// get the size and bounding box of every label from the manifest written with the downsampled file
+bool CppReadLabelManifest(const char *prefix, int64_t skeleton_resolution[3], int64_t max_label, std::vector<int64_t> &nelements, std::vector<int64_t> &bounding_boxes)
+{
+    char manifest_filename[4096];
+    sprintf(manifest_filename, "skeletons/%s/manifest-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    FILE *mfp = CppOpenArtifact(manifest_filename, "rb");
+    if (!mfp) return false;
+
+    int64_t header[4];
+    if (fread(header, sizeof(int64_t), 4, mfp) != 4 || header[3] != max_label) { fclose(mfp); return false; }
+
+    nelements.resize(max_label);
+    bounding_boxes.resize(6 * max_label);
+    for (int64_t label = 0; label < max_label; ++label) {
+        int64_t nvoxels;
+        if (fread(&(nelements[label]), sizeof(int64_t), 1, mfp) != 1) { fclose(mfp); return false; }
+        if (fread(&nvoxels, sizeof(int64_t), 1, mfp) != 1) { fclose(mfp); return false; }
+        if (fread(&(bounding_boxes[6 * label]), sizeof(int64_t), 6, mfp) != 6) { fclose(mfp); return false; }
+    }
+    fclose(mfp);
+
+    return true;
+}
+
+
+
+// without a manifest the sizes and bounding boxes come from one pass over the downsampled file
+static bool ScanLabelSizes(FILE *rfp, int64_t grid_size[3], int64_t max_label, std::vector<int64_t> &nelements, std::vector<int64_t> &bounding_boxes)
+{
+    nelements.resize(max_label);
+    bounding_boxes.resize(6 * max_label);
+    for (int64_t label = 0; label < max_label; ++label) {
+        if (fread(&(nelements[label]), sizeof(int64_t), 1, rfp) != 1) return false;
+
+        std::vector<int64_t> elements = std::vector<int64_t>(nelements[label]);
+        if (fread(elements.data(), sizeof(int64_t), nelements[label], rfp) != (uint64_t)nelements[label]) return false;
+        CppSegmentBoundingBox(grid_size, elements.data(), nelements[label], &(bounding_boxes[6 * label]));
+    }
+
+    return true;
+}
+
+
+
+// elements of a single label and of its 26-connected components (if there is more than one) passed between the stages
+struct LabelComponents {
+    int64_t label;
+    std::vector<int64_t> elements;
+    std::vector<std::vector<int64_t> > components;
+    std::vector<std::vector<SurfaceRecord> > histories;
+
+    // progress of a label thinned with a budget
+    int64_t converged;
+    int64_t iterations;
+    std::vector<int64_t> state;
+
+    // work done on the label and on each of its components
+    ThinningStatistics statistics;
+    std::vector<ThinningStatistics> component_statistics;
+};
+
+
+
+// write whether a label converged and its state if it did not (with a budget every label has both)
+static bool WriteThinningProgress(FILE *cfp, FILE *sfp, LabelComponents &item)
+{
+    if (fwrite(&(item.converged), sizeof(int64_t), 1, cfp) != 1) return false;
+    if (fwrite(&(item.iterations), sizeof(int64_t), 1, cfp) != 1) return false;
+
+    int64_t nstate = item.state.size();
+    if (fwrite(&nstate, sizeof(int64_t), 1, sfp) != 1) return false;
+    if (fwrite(item.state.data(), sizeof(int64_t), nstate, sfp) != (uint64_t)nstate) return false;
+
+    return true;
+}
+
+
+
+// checkpoint of a thinning run: the arguments and input of the run, the next label to write and the size of every
+// output up to that label (skeletons, convergence, state and statistics in that order)
+static const int NJOURNAL_IDENTITY = 13;
+static const int NJOURNAL_OUTPUTS = 4;
+
+typedef struct {
+    int64_t identity[NJOURNAL_IDENTITY];
+    int64_t next_label;
+    int64_t offsets[NJOURNAL_OUTPUTS];
+} ThinningJournal;
+
+
+
+static bool ThinningJournalIdentity(const char *input_filename, int64_t grid_size[3], int64_t max_label, int64_t label_start, int64_t label_end, int64_t max_iterations, double max_seconds, bool statistics, bool morton, int64_t identity[NJOURNAL_IDENTITY])
+{
+    // a downsampled file that was rewritten since the checkpoint invalidates it
+    int64_t input_size;
+    int64_t input_modified[2];
+    if (!CppStatArtifact(input_filename, &input_size, input_modified)) return false;
+
+    identity[0] = grid_size[IB_Z];
+    identity[1] = grid_size[IB_Y];
+    identity[2] = grid_size[IB_X];
+    identity[3] = max_label;
+    identity[4] = label_start;
+    identity[5] = label_end;
+    identity[6] = max_iterations;
+    memcpy(&(identity[7]), &max_seconds, sizeof(int64_t));
+    identity[8] = input_size;
+    identity[9] = input_modified[0];
+    identity[10] = input_modified[1];
+    identity[11] = statistics;
+    identity[12] = morton;
+
+    return true;
+}
+
+
+
+static bool ReadThinningJournal(const char *journal_filename, ThinningJournal &journal)
+{
+    FILE *jfp = CppOpenArtifact(journal_filename, "rb");
+    if (!jfp) return false;
+
+    bool read = fread(&journal, sizeof(ThinningJournal), 1, jfp) == 1;
+    fclose(jfp);
+
+    return read;
+}
+
+
+
+// the journal is replaced at once so that it always describes a complete checkpoint
+static bool WriteThinningJournal(const char *journal_filename, ThinningJournal &journal)
+{
+    char partial_filename[4096];
+    sprintf(partial_filename, "%s.partial", journal_filename);
+
+    FILE *jfp = CppOpenArtifact(partial_filename, "wb");
+    if (!jfp) return false;
+
+    if (fwrite(&journal, sizeof(ThinningJournal), 1, jfp) != 1) { CppDiscardArtifact(jfp); return false; }
+    if (CppSyncArtifact(jfp)) { CppDiscardArtifact(jfp); return false; }
+    if (fclose(jfp)) return false;
+
+    return !CppRenameArtifact(partial_filename, journal_filename);
+}
+
+
+
+// make sure that an output holds exactly the labels [first_label, next_label) at the checkpoint (records either have
+// record_size int64s or a count followed by that many int64s if record_size is zero)
+static bool ValidateJournalOutput(const char *filename, int64_t grid_size[3], int64_t max_label, int64_t label_start, int64_t label_end, int64_t first_label, int64_t next_label, int64_t record_size, int64_t offset)
+{
+    FILE *fp = CppOpenArtifact(filename, "rb");
+    if (!fp) return false;
+
+    int64_t output_grid_size[3];
+    int64_t output_max_label;
+    bool valid = CppReadSkeletonHeader(fp, output_grid_size, &output_max_label, label_start, label_end) && output_max_label == max_label;
+    for (int dim = 0; dim < 3; ++dim)
+        if (output_grid_size[dim] != grid_size[dim]) valid = false;
+
+    for (int64_t label = first_label; valid && label < next_label; ++label) {
+        int64_t nentries = record_size;
+        if (!record_size && fread(&nentries, sizeof(int64_t), 1, fp) != 1) valid = false;
+        if (valid && fseek(fp, nentries * sizeof(int64_t), SEEK_CUR)) valid = false;
+    }
+
+    // a record that was cut short puts the position past the end of the file
+    if (valid && ftell(fp) != offset) valid = false;
+    if (valid && (fseek(fp, 0, SEEK_END) || ftell(fp) < offset)) valid = false;
+    fclose(fp);
+
+    return valid;
+}
+
+
+
+// continue writing an output after the last checkpointed label
+static FILE *ReopenJournalOutput(const char *filename, int64_t offset)
+{
+    FILE *fp = CppOpenArtifact(filename, "r+b");
+    if (!fp) return NULL;
+
+    if (CppTruncateArtifact(fp, offset)) { CppDiscardArtifact(fp); return NULL; }
+
+    return fp;
+}
+
+
+
+// flush every output to disk and record how far the run got
+static bool CheckpointThinning(const char *journal_filename, ThinningJournal &journal, FILE *fps[NJOURNAL_OUTPUTS], int64_t next_label)
+{
+    for (int io = 0; io < NJOURNAL_OUTPUTS; ++io) {
+        journal.offsets[io] = 0;
+        if (!fps[io]) continue;
+
+        if (CppSyncArtifact(fps[io])) return false;
+        journal.offsets[io] = ftell(fps[io]);
+    }
+    journal.next_label = next_label;
+
+    return WriteThinningJournal(journal_filename, journal);
+}
+
+
+
+int CppTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget, int64_t label_start, int64_t label_end, int64_t max_iterations, double max_seconds, bool statistics, bool morton, ProgressContext *progress)
 {
     // initialize all of the lookup tables
-    InitializeLookupTables(lookup_table_directory);
+    ThinningContext *context = CppNewThinningContext(lookup_table_directory);
+    if (!context) return 0;
+
+    // every error path closes the files opened so far and frees the contexts
+    FILE *rfp = NULL, *wfp = NULL, *cfp = NULL, *sfp = NULL, *tfp = NULL;
+    std::vector<ThinningContext *> workers;
+    std::function<int()> fail = [&]() {
+        if (rfp) fclose(rfp);
+        if (wfp) CppDiscardArtifact(wfp);
+        if (cfp) CppDiscardArtifact(cfp);
+        if (sfp) CppDiscardArtifact(sfp);
+        if (tfp) CppDiscardArtifact(tfp);
+        for (uint64_t thread = 0; thread < workers.size(); ++thread)
+            CppDeleteThinningContext(workers[thread]);
+        CppDeleteThinningContext(context);
+        return 0;
+    };
+
+    // with a budget the labels that run out of iterations or time keep the voxels that remain
+    bool budgeted = max_iterations > 0 || max_seconds > 0;
+    CppSetThinningBudget(context, max_iterations, max_seconds);
+    CppSetThinningLayout(context, morton);
 
     // read the topologically downsampled file
     char input_filename[4096];
     sprintf(input_filename, "skeletons/%s/downsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
 
     // open the input file
-    FILE *rfp = fopen(input_filename, "rb");
-    if (!rfp) { fprintf(stderr, "Failed to read %s\n", input_filename); exit(-1); }
+    rfp = CppOpenArtifact(input_filename, "rb");
+    if (!rfp) { fprintf(stderr, "Failed to read %s\n", input_filename); return fail(); }
 
     // read the size and number of segments
-    if (fread(&(grid_size[IB_Z]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); exit(-1); }
-    if (fread(&(grid_size[IB_Y]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); exit(-1); }
-    if (fread(&(grid_size[IB_X]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); exit(-1); }
+    int64_t grid_size[3];
+    int64_t max_label;
+    if (!CppReadSkeletonHeader(rfp, grid_size, &max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", input_filename); return fail(); }
+
+    // a shard only thins the labels in its range
+    int64_t first_label, last_label;
+    if (!CppLabelRange(max_label, &label_start, &label_end, &first_label, &last_label)) return fail();
 
     // open the output filename
     char output_filename[4096];
-    sprintf(output_filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-downsample-skeleton.pts", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+    CppSkeletonFilename(output_filename, prefix, skeleton_resolution, "downsample-skeleton", "pts", label_start, label_end);
 
-    FILE *wfp = fopen(output_filename, "wb");
-    if (!wfp) { fprintf(stderr, "Failed to write to %s\n", output_filename); exit(-1); }
+    // the outputs no longer match the hashes saved by an incremental run
+    char cache_filename[4096];
+    CppSkeletonFilename(cache_filename, prefix, skeleton_resolution, "cache", "bytes", 0, ALL_LABELS);
+    CppRemoveArtifact(cache_filename);
 
-    // go through all labels
-    int64_t max_label;
-    if (fread(&max_label, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); exit(-1); }
+    // which labels converged and the state to resume the others from
+    char convergence_filename[4096];
+    CppSkeletonFilename(convergence_filename, prefix, skeleton_resolution, "convergence", "bytes", label_start, label_end);
 
-    // write the header for the output file
-    if (fwrite(&(grid_size[IB_Z]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); exit(-1); }
-    if (fwrite(&(grid_size[IB_Y]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); exit(-1); }
-    if (fwrite(&(grid_size[IB_X]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); exit(-1); }
-    if (fwrite(&max_label, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); exit(-1); }
+    char state_filename[4096];
+    CppSkeletonFilename(state_filename, prefix, skeleton_resolution, "state", "bytes", label_start, label_end);
 
-    // add padding around each segment (only way that populate offsets works!!)
-    grid_size[IB_Z] += 2;
-    grid_size[IB_Y] += 2;
-    grid_size[IB_X] += 2;
+    // the work done on every label (fixed size records of ThinningStatistics)
+    char statistics_filename[4096];
+    CppSkeletonFilename(statistics_filename, prefix, skeleton_resolution, "statistics", "bytes", label_start, label_end);
+
+    // a run that was interrupted after a checkpoint continues from the next label of the same outputs
+    char journal_filename[4096];
+    CppSkeletonFilename(journal_filename, prefix, skeleton_resolution, "journal", "bytes", label_start, label_end);
+
+    ThinningJournal journal, previous_journal;
+    if (!ThinningJournalIdentity(input_filename, grid_size, max_label, label_start, label_end, max_iterations, max_seconds, statistics, morton, journal.identity)) { fprintf(stderr, "Failed to read %s\n", input_filename); return fail(); }
+
+    bool resume = ReadThinningJournal(journal_filename, previous_journal) && !memcmp(journal.identity, previous_journal.identity, sizeof(journal.identity));
+    if (resume) resume = first_label <= previous_journal.next_label && previous_journal.next_label <= last_label;
+    if (resume) resume = ValidateJournalOutput(output_filename, grid_size, max_label, label_start, label_end, first_label, previous_journal.next_label, 0, previous_journal.offsets[0]);
+    if (resume && budgeted) resume = ValidateJournalOutput(convergence_filename, grid_size, max_label, label_start, label_end, first_label, previous_journal.next_label, 2, previous_journal.offsets[1]);
+    if (resume && budgeted) resume = ValidateJournalOutput(state_filename, grid_size, max_label, label_start, label_end, first_label, previous_journal.next_label, 0, previous_journal.offsets[2]);
+    if (resume && statistics) resume = ValidateJournalOutput(statistics_filename, grid_size, max_label, label_start, label_end, first_label, previous_journal.next_label, sizeof(ThinningStatistics) / sizeof(int64_t), previous_journal.offsets[3]);
+
+    if (resume) {
+        wfp = ReopenJournalOutput(output_filename, previous_journal.offsets[0]);
+        if (!wfp) { fprintf(stderr, "Failed to write to %s\n", output_filename); return fail(); }
+
+        if (budgeted) {
+            cfp = ReopenJournalOutput(convergence_filename, previous_journal.offsets[1]);
+            if (!cfp) { fprintf(stderr, "Failed to write to %s\n", convergence_filename); return fail(); }
+
+            sfp = ReopenJournalOutput(state_filename, previous_journal.offsets[2]);
+            if (!sfp) { fprintf(stderr, "Failed to write to %s\n", state_filename); return fail(); }
+        }
+
+        if (statistics) {
+            tfp = ReopenJournalOutput(statistics_filename, previous_journal.offsets[3]);
+            if (!tfp) { fprintf(stderr, "Failed to write to %s\n", statistics_filename); return fail(); }
+        }
 
-    // set global indexing parameters
-    nentries = grid_size[IB_Z] * grid_size[IB_Y] * grid_size[IB_X];
-    sheet_size = grid_size[IB_Y] * grid_size[IB_X];
-    row_size = grid_size[IB_X];
-    PopulateOffsets();
+        first_label = previous_journal.next_label;
+    }
+    else {
+        wfp = CppOpenArtifact(output_filename, "wb");
+        if (!wfp) { fprintf(stderr, "Failed to write to %s\n", output_filename); return fail(); }
+
+        // write the header for the output file
+        if (!CppWriteSkeletonHeader(wfp, grid_size, max_label, label_start, label_end)) { fprintf(stderr, "Failed to write to %s\n", output_filename); return fail(); }
+
+        if (budgeted) {
+            cfp = CppOpenArtifact(convergence_filename, "wb");
+            if (!cfp) { fprintf(stderr, "Failed to write to %s\n", convergence_filename); return fail(); }
+
+            sfp = CppOpenArtifact(state_filename, "wb");
+            if (!sfp) { fprintf(stderr, "Failed to write to %s\n", state_filename); return fail(); }
+
+            if (!CppWriteSkeletonHeader(cfp, grid_size, max_label, label_start, label_end)) { fprintf(stderr, "Failed to write to %s\n", convergence_filename); return fail(); }
+            if (!CppWriteSkeletonHeader(sfp, grid_size, max_label, label_start, label_end)) { fprintf(stderr, "Failed to write to %s\n", state_filename); return fail(); }
+        }
+        else {
+            CppRemoveArtifact(convergence_filename);
+            CppRemoveArtifact(state_filename);
+        }
 
+        if (statistics) {
+            tfp = CppOpenArtifact(statistics_filename, "wb");
+            if (!tfp) { fprintf(stderr, "Failed to write to %s\n", statistics_filename); return fail(); }
+
+            if (!CppWriteSkeletonHeader(tfp, grid_size, max_label, label_start, label_end)) { fprintf(stderr, "Failed to write to %s\n", statistics_filename); return fail(); }
+        }
+        else CppRemoveArtifact(statistics_filename);
+    }
+
+    FILE *journal_fps[NJOURNAL_OUTPUTS] = { wfp, cfp, sfp, tfp };
+    std::chrono::steady_clock::time_point checkpoint_time = std::chrono::steady_clock::now();
+
+    // get the cost of every label from the manifest (older downsampled files need an extra pass)
+    std::vector<int64_t> nelements, bounding_boxes;
+    if (!CppReadLabelManifest(prefix, skeleton_resolution, max_label, nelements, bounding_boxes)) {
+        if (!ScanLabelSizes(rfp, grid_size, max_label, nelements, bounding_boxes)) { fprintf(stderr, "Failed to read %s\n", input_filename); return fail(); }
+    }
+
+    // labels are stored consecutively so the manifest gives the location of each label in the file
+    std::vector<int64_t> label_offsets = std::vector<int64_t>(max_label);
+    std::vector<int64_t> memory_costs = std::vector<int64_t>(max_label);
+    std::vector<int64_t> order;
+    int64_t offset = 4 * sizeof(int64_t);
     for (int64_t label = 0; label < max_label; ++label) {
-        // get the number of points for this label
-        int64_t num;
-        if (fread(&num, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); exit(-1); }
+        label_offsets[label] = offset;
+        offset += (1 + nelements[label]) * sizeof(int64_t);
 
-        // create array for this label
-        segmentation = new unsigned char[nentries];
-        for (int64_t iv = 0; iv < nentries; ++iv)
-            segmentation[iv] = 0;
+        memory_costs[label] = CppThinningMemoryCost(nelements[label], &(bounding_boxes[6 * label]), morton);
+        if (first_label <= label && label < last_label) order.push_back(label);
+    }
 
-        // read all of the downsampled locations
-        int64_t *elements = new int64_t[num];
-        if (fread(elements, sizeof(int64_t), num, rfp) != (uint64_t)num) { fprintf(stderr, "Failed to read %s\n", input_filename); exit(-1); }
+    // thin the largest labels first so that no single large label is left running alone at the end
+    std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b) { return nelements[a] > nelements[b]; });
 
-        for (int64_t iv = 0; iv < num; ++iv) {
-            int64_t element = elements[iv];
+    // progress counts the labels of this run and their downsampled voxels
+    int64_t nvoxels = 0;
+    for (uint64_t il = 0; il < order.size(); ++il)
+        nvoxels += nelements[order[il]];
+    CppStartProgress(progress, "thinning", order.size(), nvoxels);
+    bool cancelled = false;
 
-            // convert the element to non-cropped iz, iy, ix
-            int64_t iz = element / ((grid_size[IB_X] - 2) * (grid_size[IB_Y] - 2));
-            int64_t iy = (element - iz * (grid_size[IB_X] - 2) * (grid_size[IB_Y] - 2)) / (grid_size[IB_X] - 2);
-            int64_t ix = element % (grid_size[IB_X] - 2);
+    // every worker gets its own working volume
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    CppSetThinningGridSize(context, grid_size);
+    workers = std::vector<ThinningContext *>(num_threads);
+    for (int64_t thread = 0; thread < num_threads; ++thread)
+        workers[thread] = CppNewWorkerThinningContext(context);
+
+    std::function<bool(int64_t, LabelComponents &)> read = [&](int64_t label, LabelComponents &item) {
+        // get the number of points for this label
+        int64_t num;
+        if (fseek(rfp, label_offsets[label], SEEK_SET)) { fprintf(stderr, "Failed to read %s\n", input_filename); return false; }
+        if (fread(&num, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return false; }
 
-            // update the element based on the padding
-            element = (iz + 1) * sheet_size + (iy + 1) * row_size + ix + 1;
-            segmentation[element] = 1;
+        // read all of the downsampled locations
+        item.label = label;
+        item.elements.resize(num);
+        if (fread(item.elements.data(), sizeof(int64_t), num, rfp) != (uint64_t)num) { fprintf(stderr, "Failed to read %s\n", input_filename); return false; }
+
+        // every component is thinned in its own bounding box by any of the workers (a label thinned with a budget
+        // stays whole so that its state can be resumed)
+        item.converged = 1;
+        item.iterations = 0;
+        if (!budgeted) SegmentComponents(grid_size, item.elements, item.components);
+        if (item.components.size() > 1) {
+            item.elements.clear();
+            item.histories.resize(item.components.size());
+            item.component_statistics.resize(item.components.size());
+        }
+        else item.components.clear();
+
+        return true;
+    };
+
+    std::function<int64_t(LabelComponents &)> nparts = [&](LabelComponents &item) {
+        return (int64_t) item.components.size();
+    };
+
+    std::function<void(int64_t, LabelComponents &, int64_t)> process = [&](int64_t thread, LabelComponents &item, int64_t part) {
+        // thin this segment in place (the skeleton gives back the memory of the input since labels wait for the
+        // writer with their skeletons reserved in the memory budget)
+        if (item.components.empty()) {
+            int64_t num = CppThinSegment(workers[thread], item.elements.data(), item.elements.size(), item.elements.data());
+            item.elements.resize(num);
+            std::vector<int64_t>(item.elements).swap(item.elements);
+
+            item.converged = CppThinningConverged(workers[thread]);
+            item.iterations = CppThinningIterations(workers[thread]);
+            item.state.swap(CppThinningState(workers[thread]));
+            CppThinningStatistics(workers[thread], &(item.statistics));
+        }
+        else {
+            int64_t num = ThinSegmentComponent(workers[thread], item.components[part], item.histories[part]);
+            item.components[part].resize(num);
+            std::vector<int64_t>(item.components[part]).swap(item.components[part]);
+            CppThinningStatistics(workers[thread], &(item.component_statistics[part]));
+        }
+    };
+
+    std::function<void(LabelComponents &)> merge = [&](LabelComponents &item) {
+        if (item.components.empty()) return;
+
+        // the skeleton is the same as if the label was thinned at once
+        MergeComponentSkeletons(grid_size, morton, item.components, item.histories, item.elements);
+        item.components.clear();
+        item.histories.clear();
+
+        // the label converges in the iteration that its last component converges in
+        item.statistics = item.component_statistics[0];
+        for (uint64_t ic = 1; ic < item.component_statistics.size(); ++ic) {
+            ThinningStatistics &component = item.component_statistics[ic];
+            item.statistics.iterations = std::max(item.statistics.iterations, component.iterations);
+            for (int direction = 0; direction < NTHINNING_DIRECTIONS; ++direction)
+                item.statistics.deleted[direction] += component.deleted[direction];
+            item.statistics.isthmuses += component.isthmuses;
+            item.statistics.detect_seconds += component.detect_seconds;
+            item.statistics.delete_seconds += component.delete_seconds;
+        }
+        item.component_statistics.clear();
+    };
+
+    std::function<bool(LabelComponents &)> write = [&](LabelComponents &item) {
+        // write the number of elements and the skeleton
+        int64_t num = item.elements.size();
+        if (fwrite(&num, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); return false; }
+        if (fwrite(item.elements.data(), sizeof(int64_t), num, wfp) != (uint64_t)num) { fprintf(stderr, "Failed to write to %s\n", output_filename); return false; }
+        int64_t bytes = (1 + num) * sizeof(int64_t);
+
+        if (budgeted && !WriteThinningProgress(cfp, sfp, item)) { fprintf(stderr, "Failed to write to %s\n", state_filename); return false; }
+        if (budgeted) bytes += (3 + item.state.size()) * sizeof(int64_t);
+
+        if (statistics) {
+            item.statistics.label = item.label;
+            item.statistics.nvoxels = nelements[item.label];
+            for (int dim = 0; dim < 6; ++dim)
+                item.statistics.bounding_box[dim] = bounding_boxes[6 * item.label + dim];
+            item.statistics.nskeleton = num;
+
+            if (fwrite(&(item.statistics), sizeof(ThinningStatistics), 1, tfp) != 1) { fprintf(stderr, "Failed to write to %s\n", statistics_filename); return false; }
+            bytes += sizeof(ThinningStatistics);
         }
 
-        // call the sequential thinning algorithm
-        SequentialThinning();
+        // a cancelled run stops after this label with a checkpoint so that the same call continues from there
+        cancelled = CppReportProgress(progress, 1, nelements[item.label], bytes);
 
-        // count the number of remaining points
-        num = 0;
-        ListElement *LE = (ListElement *) surface_voxels.first;
-        while (LE != NULL) {
-            num++;
-            LE = (ListElement *)LE->next;
+        // labels are written in increasing order so every label before the next one is complete
+        if (cancelled || std::chrono::duration<double>(std::chrono::steady_clock::now() - checkpoint_time).count() >= journal_interval) {
+            if (!CheckpointThinning(journal_filename, journal, journal_fps, item.label + 1)) { fprintf(stderr, "Failed to write to %s\n", journal_filename); cancelled = false; return false; }
+            checkpoint_time = std::chrono::steady_clock::now();
         }
 
-        // write the number of elements
-        if (fwrite(&num, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); exit(-1); }
+        return !cancelled;
+    };
+
+    std::function<int64_t(LabelComponents &)> result_bytes = [&](LabelComponents &item) {
+        return (int64_t) ((item.elements.capacity() + item.state.capacity()) * sizeof(int64_t));
+    };
 
-        while (surface_voxels.first != NULL) {
-            // get the surface voxels
-            ListElement *LE = (ListElement *) surface_voxels.first;
+    if (!RunPartitionedPipeline(order, memory_costs, memory_budget, num_threads, read, nparts, process, merge, write, result_bytes) && !cancelled) return fail();
 
-            // get the coordinates for this skeleton point in the non-cropped segmentation
-            int64_t iz = LE->iz - 1;
-            int64_t iy = LE->iy - 1;
-            int64_t ix = LE->ix - 1;
-            int64_t iv = iz * (grid_size[IB_X] - 2) * (grid_size[IB_Y] - 2) + iy * (grid_size[IB_X] - 2) + ix;
+    // close the I/O files (an output that fails to close leaves the journal for the next call)
+    std::function<bool(FILE *&, const char *)> close = [&](FILE *&fp, const char *filename) {
+        bool closed = !fclose(fp);
+        fp = NULL;
+        if (!closed) fprintf(stderr, "Failed to write to %s\n", filename);
+        return closed;
+    };
+
+    fclose(rfp);
+    rfp = NULL;
+    if (!close(wfp, output_filename)) return fail();
+    if (cfp && !close(cfp, convergence_filename)) return fail();
+    if (sfp && !close(sfp, state_filename)) return fail();
+    if (tfp && !close(tfp, statistics_filename)) return fail();
 
-            // endpoints are written as negatives
-            if (IsEndpoint(LE->iv)) iv = -1 * iv;
-            if (fwrite(&iv, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); exit(-1); }
+    // the outputs are complete
+    if (!cancelled) CppRemoveArtifact(journal_filename);
 
-            // remove this voxel
-            RemoveSurfaceVoxel(LE);
+    CppFinishProgress(progress);
+
+    for (int64_t thread = 0; thread < num_threads; ++thread)
+        CppDeleteThinningContext(workers[thread]);
+    CppDeleteThinningContext(context);
+
+    return 1;
+}
+
+
+
+// continue thinning the labels that did not converge within the budget of CppTopologicalThinning (with a new budget
+// or until they converge, each in the layout that its state was saved in) and replace their skeletons; the statistics
+// file is not rewritten and keeps describing the first pass
+int CppResumeTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t max_iterations, double max_seconds)
+{
+    // initialize all of the lookup tables
+    ThinningContext *context = CppNewThinningContext(lookup_table_directory);
+    if (!context) return 0;
+
+    CppSetThinningBudget(context, max_iterations, max_seconds);
+
+    char input_filenames[3][4096];
+    CppSkeletonFilename(input_filenames[0], prefix, skeleton_resolution, "downsample-skeleton", "pts", 0, ALL_LABELS);
+    CppSkeletonFilename(input_filenames[1], prefix, skeleton_resolution, "convergence", "bytes", 0, ALL_LABELS);
+    CppSkeletonFilename(input_filenames[2], prefix, skeleton_resolution, "state", "bytes", 0, ALL_LABELS);
+
+    // the new files replace the previous ones once they are complete
+    char output_filenames[3][4096];
+    FILE *rfps[3] = { NULL, NULL, NULL }, *wfps[3] = { NULL, NULL, NULL };
+    std::vector<ThinningContext *> workers;
+
+    // every error path closes the files opened so far (the previous files stay as they were) and frees the contexts
+    std::function<int()> fail = [&]() {
+        for (int ifile = 0; ifile < 3; ++ifile) {
+            if (rfps[ifile]) fclose(rfps[ifile]);
+            if (wfps[ifile]) CppDiscardArtifact(wfps[ifile]);
         }
+        for (uint64_t thread = 0; thread < workers.size(); ++thread)
+            CppDeleteThinningContext(workers[thread]);
+        CppDeleteThinningContext(context);
+        return 0;
+    };
+    int64_t grid_size[3];
+    int64_t max_label = 0;
+    for (int ifile = 0; ifile < 3; ++ifile) {
+        rfps[ifile] = CppOpenArtifact(input_filenames[ifile], "rb");
+        if (!rfps[ifile]) { fprintf(stderr, "Failed to read %s\n", input_filenames[ifile]); return fail(); }
+
+        int64_t file_grid_size[3];
+        int64_t file_max_label;
+        if (!CppReadSkeletonHeader(rfps[ifile], file_grid_size, &file_max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to read %s\n", input_filenames[ifile]); return fail(); }
+        if (!ifile) {
+            grid_size[IB_Z] = file_grid_size[IB_Z];
+            grid_size[IB_Y] = file_grid_size[IB_Y];
+            grid_size[IB_X] = file_grid_size[IB_X];
+            max_label = file_max_label;
+        }
+        else if (file_max_label != max_label) { fprintf(stderr, "Labels of %s do not match %s\n", input_filenames[ifile], input_filenames[0]); return fail(); }
+
+        sprintf(output_filenames[ifile], "%s.partial", input_filenames[ifile]);
+        wfps[ifile] = CppOpenArtifact(output_filenames[ifile], "wb");
+        if (!wfps[ifile]) { fprintf(stderr, "Failed to write to %s\n", output_filenames[ifile]); return fail(); }
+        if (!CppWriteSkeletonHeader(wfps[ifile], grid_size, max_label, 0, ALL_LABELS)) { fprintf(stderr, "Failed to write to %s\n", output_filenames[ifile]); return fail(); }
+    }
+
+    // the outputs no longer match the hashes saved by an incremental run
+    char cache_filename[4096];
+    CppSkeletonFilename(cache_filename, prefix, skeleton_resolution, "cache", "bytes", 0, ALL_LABELS);
+    CppRemoveArtifact(cache_filename);
 
-        // free memory
-        delete[] segmentation;
+    // every worker gets its own working volume
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
 
-        // reset global variables
-        segmentation = NULL;
+    CppSetThinningGridSize(context, grid_size);
+    workers = std::vector<ThinningContext *>(num_threads);
+    for (int64_t thread = 0; thread < num_threads; ++thread)
+        workers[thread] = CppNewWorkerThinningContext(context);
+
+    std::vector<int64_t> order = std::vector<int64_t>(max_label);
+    for (int64_t label = 0; label < max_label; ++label)
+        order[label] = label;
+    std::vector<int64_t> memory_costs = std::vector<int64_t>(max_label, 0);
+
+    std::function<bool(int64_t, LabelComponents &)> read = [&](int64_t label, LabelComponents &item) {
+        item.label = label;
+
+        int64_t num;
+        if (fread(&num, sizeof(int64_t), 1, rfps[0]) != 1) { fprintf(stderr, "Failed to read %s\n", input_filenames[0]); return false; }
+        item.elements.resize(num);
+        if (fread(item.elements.data(), sizeof(int64_t), num, rfps[0]) != (uint64_t)num) { fprintf(stderr, "Failed to read %s\n", input_filenames[0]); return false; }
+
+        if (fread(&(item.converged), sizeof(int64_t), 1, rfps[1]) != 1) { fprintf(stderr, "Failed to read %s\n", input_filenames[1]); return false; }
+        if (fread(&(item.iterations), sizeof(int64_t), 1, rfps[1]) != 1) { fprintf(stderr, "Failed to read %s\n", input_filenames[1]); return false; }
+
+        int64_t nstate;
+        if (fread(&nstate, sizeof(int64_t), 1, rfps[2]) != 1) { fprintf(stderr, "Failed to read %s\n", input_filenames[2]); return false; }
+        // states without the layout come from an older format
+        if (nstate && (nstate < 3 || (nstate - 3) % 2)) { fprintf(stderr, "Failed to read %s\n", input_filenames[2]); return false; }
+        item.state.resize(nstate);
+        if (fread(item.state.data(), sizeof(int64_t), nstate, rfps[2]) != (uint64_t)nstate) { fprintf(stderr, "Failed to read %s\n", input_filenames[2]); return false; }
+
+        return true;
+    };
+
+    std::function<void(int64_t, LabelComponents &)> process = [&](int64_t thread, LabelComponents &item) {
+        if (item.converged) return;
+
+        // the skeleton can never have more points than the saved voxels
+        item.elements.resize((item.state.size() - 3) / 2);
+        int64_t num = CppResumeThinSegment(workers[thread], item.state.data(), item.state.size(), item.elements.data());
+        item.elements.resize(num);
+
+        item.converged = CppThinningConverged(workers[thread]);
+        item.iterations += CppThinningIterations(workers[thread]);
+        item.state.swap(CppThinningState(workers[thread]));
+    };
+
+    std::function<bool(LabelComponents &)> write = [&](LabelComponents &item) {
+        int64_t num = item.elements.size();
+        if (fwrite(&num, sizeof(int64_t), 1, wfps[0]) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filenames[0]); return false; }
+        if (fwrite(item.elements.data(), sizeof(int64_t), num, wfps[0]) != (uint64_t)num) { fprintf(stderr, "Failed to write to %s\n", output_filenames[0]); return false; }
+
+        if (!WriteThinningProgress(wfps[1], wfps[2], item)) { fprintf(stderr, "Failed to write to %s\n", output_filenames[2]); return false; }
+
+        return true;
+    };
+
+    std::function<int64_t(LabelComponents &)> result_bytes = [&](LabelComponents &item) {
+        return (int64_t) ((item.elements.capacity() + item.state.capacity()) * sizeof(int64_t));
+    };
+
+    if (!RunScheduledPipeline(order, memory_costs, 0, num_threads, read, process, write, result_bytes)) return fail();
+
+    // close the I/O files and replace the previous ones
+    for (int ifile = 0; ifile < 3; ++ifile) {
+        fclose(rfps[ifile]);
+        rfps[ifile] = NULL;
+    }
+    for (int ifile = 0; ifile < 3; ++ifile) {
+        int closed = !fclose(wfps[ifile]);
+        wfps[ifile] = NULL;
+        if (!closed) { fprintf(stderr, "Failed to write to %s\n", output_filenames[ifile]); return fail(); }
     }
 
-    // close the I/O files
-    fclose(rfp);
-    fclose(wfp);
+    // the previous files are only replaced once all of the new ones are written
+    for (int ifile = 0; ifile < 3; ++ifile)
+        if (CppRenameArtifact(output_filenames[ifile], input_filenames[ifile])) { fprintf(stderr, "Failed to write to %s\n", input_filenames[ifile]); return fail(); }
+
+    for (int64_t thread = 0; thread < num_threads; ++thread)
+        CppDeleteThinningContext(workers[thread]);
+    CppDeleteThinningContext(context);
 
-    delete[] lut_simple;
-    delete[] lut_isthmus;
+    return 1;
 }
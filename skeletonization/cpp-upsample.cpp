@@ -1,96 +1,140 @@
 /* c++ file to upsample the skeletons to full resolution */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <map>
 #include <set>
 #include <vector>
 #include "cpp-generate_skeletons.h"
+#include "cpp-pipeline.h"
+#include "cpp-storage.h"
 
 
 
-// global variables for upsampling operation
+// all of the state for the upsampling operations (no globals so that contexts can run concurrently)
 
-static std::map<int64_t, int64_t> *down_to_up;
-static int64_t *segmentation;
-static unsigned char *skeleton;
-static std::set<std::pair<int64_t, int64_t> > connected_joints;
+struct UpsampleContext {
+    std::map<int64_t, int64_t> *down_to_up;
+    int64_t *segmentation;
+    unsigned char *skeleton;
 
+    // convenient variables for moving between high and low resolutions
+    float zdown;
+    float ydown;
+    float xdown;
 
-// convenient variables for moving between high and low resolutions
+    float up_resolution[3];
 
-static float zdown;
-static float ydown;
-static float xdown;
+    int64_t up_grid_size[3];
+    int64_t up_nentries;
+    int64_t up_sheet_size;
+    int64_t up_row_size;
 
-static int64_t up_grid_size[3];
-static int64_t up_nentries;
-static int64_t up_sheet_size;
-static int64_t up_row_size;
+    int64_t down_grid_size[3];
+    int64_t down_nentries;
+    int64_t down_sheet_size;
+    int64_t down_row_size;
 
-static int64_t down_grid_size[3];
-static int64_t down_nentries;
-static int64_t down_sheet_size;
-static int64_t down_row_size;
+    // labels [first_label, last_label) have mappings (the range of a shard is [label_start, label_end))
+    int64_t max_label;
+    int64_t label_start;
+    int64_t label_end;
+    int64_t first_label;
+    int64_t last_label;
+};
+
+
+
+// endpoints of a single skeleton with their vectors passed between the pipeline stages
+struct EndpointVectors {
+    int64_t label;
+    std::vector<int64_t> down_elements;
+    std::vector<int64_t> up_endpoints;
+    std::vector<double> vectors;
+};
 
 
 
 // conver the index to indices
-static void IndexToIndices(int64_t iv, int64_t &ix, int64_t &iy, int64_t &iz)
+static void IndexToIndices(UpsampleContext *context, int64_t iv, int64_t &ix, int64_t &iy, int64_t &iz)
 {
-    iz = iv / down_sheet_size;
-    iy = (iv - iz * down_sheet_size) / down_row_size;
-    ix = iv % down_row_size;
+    iz = iv / context->down_sheet_size;
+    iy = (iv - iz * context->down_sheet_size) / context->down_row_size;
+    ix = iv % context->down_row_size;
 }
 
 
 
 
-static int MapDown2Up(const char *prefix, int64_t skeleton_resolution[3])
+static int MapDown2Up(UpsampleContext *context, const char *prefix, int64_t skeleton_resolution[3], int64_t label_start, int64_t label_end)
 {
+    int64_t *down_grid_size = context->down_grid_size;
+    int64_t *up_grid_size = context->up_grid_size;
+
     // get the downsample filename
     char downsample_filename[4096];
     sprintf(downsample_filename, "skeletons/%s/downsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
 
-    FILE *dfp = fopen(downsample_filename, "rb");
+    FILE *dfp = CppOpenArtifact(downsample_filename, "rb");
     if (!dfp) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return 0; }
 
     // get the upsample filename
     char upsample_filename[4096];
     sprintf(upsample_filename, "skeletons/%s/upsample-%03ldx%03ldx%03ld.bytes", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
 
-    FILE *ufp = fopen(upsample_filename, "rb");
-    if (!ufp) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return 0; }
+    FILE *ufp = CppOpenArtifact(upsample_filename, "rb");
+    if (!ufp) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); return 0; }
 
     // read downsample header
     int64_t down_max_segment;
-    if (fread(&(down_grid_size[IB_Z]), sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return 0; }
-    if (fread(&(down_grid_size[IB_Y]), sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return 0; }
-    if (fread(&(down_grid_size[IB_X]), sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return 0; }
-    if (fread(&down_max_segment, sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return 0; }
+    if (fread(&(down_grid_size[IB_Z]), sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return 0; }
+    if (fread(&(down_grid_size[IB_Y]), sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return 0; }
+    if (fread(&(down_grid_size[IB_X]), sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return 0; }
+    if (fread(&down_max_segment, sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return 0; }
 
     // read upsample header
     int64_t up_max_segment;
-    if (fread(&(up_grid_size[IB_Z]), sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return 0; }
-    if (fread(&(up_grid_size[IB_Y]), sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return 0; }
-    if (fread(&(up_grid_size[IB_X]), sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return 0; }
-    if (fread(&up_max_segment, sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return 0; }
+    if (fread(&(up_grid_size[IB_Z]), sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return 0; }
+    if (fread(&(up_grid_size[IB_Y]), sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return 0; }
+    if (fread(&(up_grid_size[IB_X]), sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return 0; }
+    if (fread(&up_max_segment, sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return 0; }
+
+    // only the labels in this shard need a mapping
+    if (!CppLabelRange(up_max_segment, &label_start, &label_end, &(context->first_label), &(context->last_label))) { fclose(dfp); fclose(ufp); return 0; }
+    context->max_label = up_max_segment;
+    context->label_start = label_start;
+    context->label_end = label_end;
 
-    down_to_up = new std::map<int64_t, int64_t>[up_max_segment];
-    for (int64_t label = 0; label < up_max_segment; ++label) {
-        down_to_up[label] = std::map<int64_t, int64_t>();
+    context->down_to_up = new std::map<int64_t, int64_t>[up_max_segment];
+    for (int64_t label = 0; label < context->last_label; ++label) {
+        context->down_to_up[label] = std::map<int64_t, int64_t>();
 
         int64_t down_nelements, up_nelements;
-        if (fread(&down_nelements, sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return 0; }
-        if (fread(&up_nelements, sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return 0; }
+        if (fread(&down_nelements, sizeof(int64_t), 1, dfp) != 1) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return 0; }
+        if (fread(&up_nelements, sizeof(int64_t), 1, ufp) != 1) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return 0; }
+
+        // skip over the labels before this shard
+        if (label < context->first_label) {
+            if (fseek(dfp, down_nelements * sizeof(int64_t), SEEK_CUR)) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return 0; }
+            if (fseek(ufp, up_nelements * sizeof(int64_t), SEEK_CUR)) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return 0; }
+            continue;
+        }
 
-        int64_t *down_elements = new int64_t[down_nelements];
-        int64_t *up_elements = new int64_t[up_nelements];
-        if (fread(down_elements, sizeof(int64_t), down_nelements, dfp) != (uint64_t)down_nelements) { fprintf(stderr, "Failed to read %s\n", downsample_filename); return 0; }
-        if (fread(up_elements, sizeof(int64_t), up_nelements, ufp) != (uint64_t)up_nelements) { fprintf(stderr, "Failed to read %s\n", upsample_filename); return 0; }
+        std::vector<int64_t> down_elements = std::vector<int64_t>(down_nelements);
+        std::vector<int64_t> up_elements = std::vector<int64_t>(up_nelements);
+        if (fread(down_elements.data(), sizeof(int64_t), down_nelements, dfp) != (uint64_t)down_nelements) { fprintf(stderr, "Failed to read %s\n", downsample_filename); fclose(dfp); fclose(ufp); return 0; }
+        if (fread(up_elements.data(), sizeof(int64_t), up_nelements, ufp) != (uint64_t)up_nelements) { fprintf(stderr, "Failed to read %s\n", upsample_filename); fclose(dfp); fclose(ufp); return 0; }
 
         for (int64_t ie = 0; ie < down_nelements; ++ie)
-            down_to_up[label][down_elements[ie]] = up_elements[ie];
+            context->down_to_up[label][down_elements[ie]] = up_elements[ie];
     }
 
     fclose(dfp);
@@ -101,8 +145,61 @@ static int MapDown2Up(const char *prefix, int64_t skeleton_resolution[3])
 
 
 
-static void FindEndpointVector(int64_t index, double &vx, double &vy, double &vz)
+static UpsampleContext *NewUpsampleContext(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3], int64_t label_start, int64_t label_end)
 {
+    UpsampleContext *context = new UpsampleContext();
+    context->down_to_up = NULL;
+    context->skeleton = NULL;
+
+    // get the mapping from downsampled locations to upsampled ones
+    if (!MapDown2Up(context, prefix, skeleton_resolution, label_start, label_end)) {
+        delete[] context->down_to_up;
+        delete context;
+        return NULL;
+    }
+
+    // get a list of labels for each downsampled index
+    context->segmentation = input_segmentation;
+
+    // get downsample ratios
+    context->zdown = ((float) skeleton_resolution[IB_Z]) / output_resolution[IB_Z];
+    context->ydown = ((float) skeleton_resolution[IB_Y]) / output_resolution[IB_Y];
+    context->xdown = ((float) skeleton_resolution[IB_X]) / output_resolution[IB_X];
+
+    context->up_resolution[IB_Z] = output_resolution[IB_Z];
+    context->up_resolution[IB_Y] = output_resolution[IB_Y];
+    context->up_resolution[IB_X] = output_resolution[IB_X];
+
+    // set indexing variables
+    int64_t *up_grid_size = context->up_grid_size;
+    context->up_nentries = up_grid_size[IB_Z] * up_grid_size[IB_Y] * up_grid_size[IB_X];
+    context->up_sheet_size = up_grid_size[IB_Y] * up_grid_size[IB_X];
+    context->up_row_size = up_grid_size[IB_X];
+
+    int64_t *down_grid_size = context->down_grid_size;
+    context->down_nentries = down_grid_size[IB_Z] * down_grid_size[IB_Y] * down_grid_size[IB_X];
+    context->down_sheet_size = down_grid_size[IB_Y] * down_grid_size[IB_X];
+    context->down_row_size = down_grid_size[IB_X];
+
+    return context;
+}
+
+
+
+static void DeleteUpsampleContext(UpsampleContext *context)
+{
+    delete[] context->down_to_up;
+    delete[] context->skeleton;
+    delete context;
+}
+
+
+
+static void FindEndpointVector(UpsampleContext *context, int64_t index, double &vx, double &vy, double &vz)
+{
+    int64_t *down_grid_size = context->down_grid_size;
+    unsigned char *skeleton = context->skeleton;
+
     std::vector<int64_t> path_from_endpoint = std::vector<int64_t>();
     path_from_endpoint.push_back(index);
 
@@ -111,7 +208,7 @@ static void FindEndpointVector(int64_t index, double &vx, double &vy, double &vz
         int64_t only_neighbor = -1;
 
         int64_t ix, iy, iz;
-        IndexToIndices(index, ix, iy, iz);
+        IndexToIndices(context, index, ix, iy, iz);
 
         for (int64_t iw = iz - 1; iw <= iz + 1; ++iw) {
             if (iw < 0 || iw >= down_grid_size[IB_Z]) continue;
@@ -162,8 +259,8 @@ static void FindEndpointVector(int64_t index, double &vx, double &vy, double &vz
     }
     else {
         int64_t ix, iy, iz, ii, ij, ik;
-        IndexToIndices(path_from_endpoint[0], ix, iy, iz);
-        IndexToIndices(path_from_endpoint[path_from_endpoint.size() - 1], ii, ij, ik);
+        IndexToIndices(context, path_from_endpoint[0], ix, iy, iz);
+        IndexToIndices(context, path_from_endpoint[path_from_endpoint.size() - 1], ii, ij, ik);
 
         vx = ix - ii;
         vy = iy - ij;
@@ -182,190 +279,595 @@ static void FindEndpointVector(int64_t index, double &vx, double &vy, double &vz
 
 
 
-void CppFindEndpointVectors(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3])
+// follow the skeleton from an endpoint for up to three steps (the same walk as FindEndpointVector but over the
+// skeleton points of one label so that the downsampled volume is never allocated)
+static void SkeletonEndpointVector(std::unordered_set<int64_t> &skeleton, int64_t grid_size[3], int64_t index, double &vx, double &vy, double &vz)
 {
-    // get the mapping from downsampled locations to upsampled ones
-    if (!MapDown2Up(prefix, skeleton_resolution)) return;
+    int64_t sheet_size = grid_size[IB_Y] * grid_size[IB_X];
+    int64_t row_size = grid_size[IB_X];
 
-    // get downsample ratios
-    zdown = ((float) skeleton_resolution[IB_Z]) / output_resolution[IB_Z];
-    ydown = ((float) skeleton_resolution[IB_Y]) / output_resolution[IB_Y];
-    xdown = ((float) skeleton_resolution[IB_X]) / output_resolution[IB_X];
+    std::vector<int64_t> path_from_endpoint = std::vector<int64_t>();
+    path_from_endpoint.push_back(index);
+
+    while (path_from_endpoint.size() < 4) {
+        short nneighbors = 0;
+        int64_t only_neighbor = -1;
+
+        int64_t iz = index / sheet_size;
+        int64_t iy = (index - iz * sheet_size) / row_size;
+        int64_t ix = index % row_size;
+
+        for (int64_t iw = iz - 1; iw <= iz + 1; ++iw) {
+            if (iw < 0 || iw >= grid_size[IB_Z]) continue;
+            for (int64_t iv = iy - 1; iv <= iy + 1; ++iv) {
+                if (iv < 0 || iv >= grid_size[IB_Y]) continue;
+                for (int64_t iu = ix - 1; iu <= ix + 1; ++iu) {
+                    if (iu < 0 || iu >= grid_size[IB_X]) continue;
+
+                    int64_t neighbor_index = iw * sheet_size + iv * row_size + iu;
+                    if (neighbor_index == index || !skeleton.count(neighbor_index)) continue;
+
+                    nneighbors += 1;
+                    only_neighbor = neighbor_index;
+                }
+            }
+        }
+
+        // stop at the end of the skeleton or at a split
+        if (nneighbors != 1) break;
+
+        // mask out this skeleton point so next iteration works
+        skeleton.erase(index);
+        index = only_neighbor;
+        path_from_endpoint.push_back(index);
+    }
+
+    // reset the skeleton
+    for (uint64_t iv = 0; iv < path_from_endpoint.size(); ++iv)
+        skeleton.insert(path_from_endpoint[iv]);
+
+    // cannot normalize
+    if (path_from_endpoint.size() == 1) { vx = 0.0; vy = 0.0; vz = 0.0; return; }
 
-    // set global variables
-    up_nentries = up_grid_size[IB_Z] * up_grid_size[IB_Y] * up_grid_size[IB_X];
-    up_sheet_size = up_grid_size[IB_Y] * up_grid_size[IB_X];
-    up_row_size = up_grid_size[IB_X];
+    int64_t first = path_from_endpoint[0];
+    int64_t last = path_from_endpoint[path_from_endpoint.size() - 1];
 
-    down_nentries = down_grid_size[IB_Z] * down_grid_size[IB_Y] * down_grid_size[IB_X];
-    down_sheet_size = down_grid_size[IB_Y] * down_grid_size[IB_X];
-    down_row_size = down_grid_size[IB_X];
+    vz = first / sheet_size - last / sheet_size;
+    vy = (first % sheet_size) / row_size - (last % sheet_size) / row_size;
+    vx = first % row_size - last % row_size;
+
+    double normalization = sqrt(vx * vx + vy * vy + vz * vz);
+    vx = vx / normalization;
+    vy = vy / normalization;
+    vz = vz / normalization;
+}
+
+
+
+// find the endpoint vectors of one thinned label from its own elements and upsample its skeleton in place (endpoints
+// remain negative); the down and up elements give the upsampled location of every downsampled element
+void CppUpsampleLabelSkeleton(int64_t grid_size[3], std::vector<int64_t> &down_elements, std::vector<int64_t> &up_elements, std::vector<int64_t> &skeleton, std::vector<int64_t> &up_endpoints, std::vector<double> &vectors)
+{
+    std::unordered_map<int64_t, int64_t> down_to_up;
+    for (uint64_t ie = 0; ie < down_elements.size(); ++ie)
+        down_to_up[down_elements[ie]] = up_elements[ie];
+
+    std::unordered_set<int64_t> skeleton_points;
+    for (uint64_t ie = 0; ie < skeleton.size(); ++ie)
+        skeleton_points.insert(skeleton[ie] < 0 ? -1 * skeleton[ie] : skeleton[ie]);
+
+    for (uint64_t ie = 0; ie < skeleton.size(); ++ie) {
+        if (skeleton[ie] >= 0) {
+            skeleton[ie] = down_to_up[skeleton[ie]];
+            continue;
+        }
+
+        double vx, vy, vz;
+        SkeletonEndpointVector(skeleton_points, grid_size, -1 * skeleton[ie], vx, vy, vz);
+
+        int64_t up_endpoint = down_to_up[-1 * skeleton[ie]];
+        up_endpoints.push_back(up_endpoint);
+        vectors.push_back(vz);
+        vectors.push_back(vy);
+        vectors.push_back(vx);
+
+        skeleton[ie] = -1 * up_endpoint;
+    }
+}
+
+
+
+int CppFindEndpointVectors(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3], int64_t label_start, int64_t label_end)
+{
+    // get the mapping from downsampled locations to upsampled ones
+    UpsampleContext *context = NewUpsampleContext(prefix, NULL, skeleton_resolution, output_resolution, label_start, label_end);
+    if (!context) return 0;
+
+    int64_t *up_grid_size = context->up_grid_size;
 
     // I/O filenames
     char input_filename[4096];
-    sprintf(input_filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-downsample-skeleton.pts", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+    CppSkeletonFilename(input_filename, prefix, skeleton_resolution, "downsample-skeleton", "pts", context->label_start, context->label_end);
 
     char output_filename[4096];
-    sprintf(output_filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-endpoint-vectors.vec", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+    CppSkeletonFilename(output_filename, prefix, skeleton_resolution, "endpoint-vectors", "vec", context->label_start, context->label_end);
 
     // open files for read/write
-    FILE *rfp = fopen(input_filename, "rb");
-    if (!rfp) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
+    FILE *rfp = CppOpenArtifact(input_filename, "rb");
+    if (!rfp) { fprintf(stderr, "Failed to read %s\n", input_filename); DeleteUpsampleContext(context); return 0; }
 
-    FILE *wfp = fopen(output_filename, "wb");
-    if (!wfp) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
+    FILE *wfp = CppOpenArtifact(output_filename, "wb");
+    if (!wfp) { fprintf(stderr, "Failed to write %s\n", output_filename); fclose(rfp); DeleteUpsampleContext(context); return 0; }
 
     // read header
     int64_t max_label;
     int64_t input_grid_size[3];
-    if (fread(&(input_grid_size[IB_Z]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
-    if (fread(&(input_grid_size[IB_Y]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
-    if (fread(&(input_grid_size[IB_X]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
-    if (fread(&max_label, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
+    if (!CppReadSkeletonHeader(rfp, input_grid_size, &max_label, context->label_start, context->label_end)) { fprintf(stderr, "Failed to read %s\n", input_filename); fclose(rfp); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
 
     // write the header
-    if (fwrite(&(up_grid_size[IB_Z]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
-    if (fwrite(&(up_grid_size[IB_Y]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
-    if (fwrite(&(up_grid_size[IB_X]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
-    if (fwrite(&max_label, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
+    if (!CppWriteSkeletonHeader(wfp, up_grid_size, max_label, context->label_start, context->label_end)) { fprintf(stderr, "Failed to write %s\n", output_filename); fclose(rfp); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
 
-    for (int64_t label = 0; label < max_label; ++label) {
-        int64_t nelements;
-        if (fread(&nelements, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
+    // the skeleton volume is reused for every label
+    context->skeleton = new unsigned char[context->down_nentries];
 
-        skeleton = new unsigned char[down_nentries];
-        for (int64_t iv = 0; iv < down_nentries; ++iv) skeleton[iv] = 0;
+    // read the next skeleton while finding vectors for this one and writing the previous one
+    std::function<bool(int64_t, EndpointVectors &)> read = [&](int64_t label, EndpointVectors &item) {
+        int64_t nelements;
+        if (fread(&nelements, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return false; }
 
         // find all of the downsampled elements
-        int64_t *down_elements = new int64_t[nelements];
-        if (fread(down_elements, sizeof(int64_t), nelements, rfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
+        item.label = label;
+        item.down_elements.resize(nelements);
+        if (fread(item.down_elements.data(), sizeof(int64_t), nelements, rfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to read %s\n", input_filename); return false; }
+
+        return true;
+    };
+
+    std::function<void(EndpointVectors &)> process = [&](EndpointVectors &item) {
+        std::vector<int64_t> &down_elements = item.down_elements;
+        int64_t nelements = down_elements.size();
+
+        unsigned char *skeleton = context->skeleton;
+        for (int64_t iv = 0; iv < context->down_nentries; ++iv) skeleton[iv] = 0;
 
-        int64_t nendpoints = 0;
         for (int64_t ie = 0; ie < nelements; ++ie) {
-            if (down_elements[ie] < 0) {
-                skeleton[-1 * down_elements[ie]] = 1;
-                nendpoints++;
-            }
+            if (down_elements[ie] < 0) skeleton[-1 * down_elements[ie]] = 1;
             else skeleton[down_elements[ie]] = 1;
         }
-        if (fwrite(&nendpoints, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); return; }
 
         // go through all down elements to find endpoints
         for (int64_t ie = 0; ie < nelements; ++ie) {
             if (down_elements[ie] >= 0) continue;
 
             double vx, vy, vz;
-            FindEndpointVector(-1 * down_elements[ie], vx, vy, vz);
+            FindEndpointVector(context, -1 * down_elements[ie], vx, vy, vz);
 
             // get the corresponding up element for this endpoint
-            int64_t up_element = down_to_up[label][-1 * down_elements[ie]];
+            item.up_endpoints.push_back(context->down_to_up[item.label][-1 * down_elements[ie]]);
+            item.vectors.push_back(vz);
+            item.vectors.push_back(vy);
+            item.vectors.push_back(vx);
+        }
+    };
 
-            // save the up element with the vector
-            if (fwrite(&up_element, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); return; }
-            if (fwrite(&vz, sizeof(double), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); return; }
-            if (fwrite(&vy, sizeof(double), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); return; }
-            if (fwrite(&vx, sizeof(double), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); return; }
+    std::function<bool(EndpointVectors &)> write = [&](EndpointVectors &item) {
+        int64_t nendpoints = item.up_endpoints.size();
+        if (fwrite(&nendpoints, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); return false; }
+
+        // save the up element with the vector
+        for (int64_t ie = 0; ie < nendpoints; ++ie) {
+            if (fwrite(&(item.up_endpoints[ie]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write to %s\n", output_filename); return false; }
+            if (fwrite(&(item.vectors[3 * ie]), sizeof(double), 3, wfp) != 3) { fprintf(stderr, "Failed to write to %s\n", output_filename); return false; }
         }
 
+        return true;
+    };
 
-        delete[] skeleton;
-    }
+    if (!RunLabelPipeline(context->first_label, context->last_label, read, process, write)) { fclose(rfp); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
+
+    DeleteUpsampleContext(context);
 
     // close the file
     fclose(rfp);
-    fclose(wfp);
+    if (fclose(wfp)) { fprintf(stderr, "Failed to write %s\n", output_filename); return 0; }
 
-    delete[] down_to_up;
+    return 1;
 }
 
 
 
 // operation that takes skeletons and
-void CppApplyUpsampleOperation(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3])
+int CppApplyUpsampleOperation(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3], int64_t label_start, int64_t label_end)
 {
     // get the mapping from downsampled locations to upsampled ones
-    if (!MapDown2Up(prefix, skeleton_resolution)) return;
-
-    // get a list of labels for each downsampled index
-    segmentation = input_segmentation;
+    UpsampleContext *context = NewUpsampleContext(prefix, input_segmentation, skeleton_resolution, output_resolution, label_start, label_end);
+    if (!context) return 0;
 
-    // get downsample ratios
-    zdown = ((float) skeleton_resolution[IB_Z]) / output_resolution[IB_Z];
-    ydown = ((float) skeleton_resolution[IB_Y]) / output_resolution[IB_Y];
-    xdown = ((float) skeleton_resolution[IB_X]) / output_resolution[IB_X];
-
-    // set global variables
-    up_nentries = up_grid_size[IB_Z] * up_grid_size[IB_Y] * up_grid_size[IB_X];
-    up_sheet_size = up_grid_size[IB_Y] * up_grid_size[IB_X];
-    up_row_size = up_grid_size[IB_X];
-
-    down_nentries = down_grid_size[IB_Z] * down_grid_size[IB_Y] * down_grid_size[IB_X];
-    down_sheet_size = down_grid_size[IB_Y] * down_grid_size[IB_X];
-    down_row_size = down_grid_size[IB_X];
+    int64_t *up_grid_size = context->up_grid_size;
 
     // I/O filenames
     char input_filename[4096];
-    sprintf(input_filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-downsample-skeleton.pts", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+    CppSkeletonFilename(input_filename, prefix, skeleton_resolution, "downsample-skeleton", "pts", context->label_start, context->label_end);
 
 
     char output_filename[4096];
-    sprintf(output_filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-upsample-skeleton.pts", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+    CppSkeletonFilename(output_filename, prefix, skeleton_resolution, "upsample-skeleton", "pts", context->label_start, context->label_end);
 
     // open files for read/write
-    FILE *rfp = fopen(input_filename, "rb");
-    if (!rfp) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
+    FILE *rfp = CppOpenArtifact(input_filename, "rb");
+    if (!rfp) { fprintf(stderr, "Failed to read %s\n", input_filename); DeleteUpsampleContext(context); return 0; }
 
-    FILE *wfp = fopen(output_filename, "wb");
-    if (!wfp) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
+    FILE *wfp = CppOpenArtifact(output_filename, "wb");
+    if (!wfp) { fprintf(stderr, "Failed to write %s\n", output_filename); fclose(rfp); DeleteUpsampleContext(context); return 0; }
 
     // read header
     int64_t max_label;
     int64_t input_grid_size[3];
-    if (fread(&(input_grid_size[IB_Z]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
-    if (fread(&(input_grid_size[IB_Y]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
-    if (fread(&(input_grid_size[IB_X]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
-    if (fread(&max_label, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
+    if (!CppReadSkeletonHeader(rfp, input_grid_size, &max_label, context->label_start, context->label_end)) { fprintf(stderr, "Failed to read %s\n", input_filename); fclose(rfp); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
 
     // write the header
-    if (fwrite(&(up_grid_size[IB_Z]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
-    if (fwrite(&(up_grid_size[IB_Y]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
-    if (fwrite(&(up_grid_size[IB_X]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
-    if (fwrite(&max_label, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
+    if (!CppWriteSkeletonHeader(wfp, up_grid_size, max_label, context->label_start, context->label_end)) { fprintf(stderr, "Failed to write %s\n", output_filename); fclose(rfp); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
 
-    // go through all skeletons
-    for (int64_t label = 0; label < max_label; ++label) {
+    // read the next skeleton while upsampling this one and writing the previous one
+    std::function<bool(int64_t, LabelElements &)> read = [&](int64_t label, LabelElements &item) {
         int64_t nelements;
-        if (fread(&nelements, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
-        if (fwrite(&nelements, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
+        if (fread(&nelements, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); return false; }
 
-        // just run naive method where endpoints in downsampled are transfered
-        int64_t *down_elements = new int64_t[nelements];
-        if (fread(down_elements, sizeof(int64_t), nelements, rfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to read %s\n", input_filename); return; }
+        item.label = label;
+        item.elements.resize(nelements);
+        if (fread(item.elements.data(), sizeof(int64_t), nelements, rfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to read %s\n", input_filename); return false; }
 
-        int64_t *up_elements = new int64_t[nelements];
-        for (int64_t ie = 0; ie < nelements; ++ie) {
-            int64_t down_index = down_elements[ie];
+        return true;
+    };
+
+    // just run naive method where endpoints in downsampled are transfered
+    std::function<void(LabelElements &)> process = [&](LabelElements &item) {
+        std::map<int64_t, int64_t> &label_down_to_up = context->down_to_up[item.label];
+
+        for (uint64_t ie = 0; ie < item.elements.size(); ++ie) {
+            int64_t down_index = item.elements[ie];
 
             if (down_index < 0) {
                 down_index = -1 * down_index;
-                up_elements[ie] = -1 * down_to_up[label][down_index];
+                item.elements[ie] = -1 * label_down_to_up[down_index];
             }
             else {
-                up_elements[ie] = down_to_up[label][down_index];
+                item.elements[ie] = label_down_to_up[down_index];
             }
         }
+    };
 
-        if (fwrite(up_elements, sizeof(int64_t), nelements, wfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to write %s\n", output_filename); return; }
+    std::function<bool(LabelElements &)> write = [&](LabelElements &item) {
+        int64_t nelements = item.elements.size();
+        if (fwrite(&nelements, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); return false; }
+        if (fwrite(item.elements.data(), sizeof(int64_t), nelements, wfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to write %s\n", output_filename); return false; }
 
-        // free memory
-        delete[] down_elements;
-        delete[] up_elements;
-    }
+        return true;
+    };
+
+    if (!RunLabelPipeline(context->first_label, context->last_label, read, process, write)) { fclose(rfp); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
 
     // free memory
-    delete[] down_to_up;
+    DeleteUpsampleContext(context);
 
     // close the files
     fclose(rfp);
-    fclose(wfp);
+    if (fclose(wfp)) { fprintf(stderr, "Failed to write %s\n", output_filename); return 0; }
+
+    return 1;
+}
+
+
+
+// get the block of full resolution voxels that a downsampled index covers (same window as the representative voxel search)
+static void DownsampleBlock(UpsampleContext *context, int64_t down_index, int64_t block_min[3], int64_t block_max[3])
+{
+    int64_t ix, iy, iz;
+    IndexToIndices(context, down_index, ix, iy, iz);
+
+    block_min[IB_Z] = (int64_t) (context->zdown * iz);
+    block_min[IB_Y] = (int64_t) (context->ydown * iy);
+    block_min[IB_X] = (int64_t) (context->xdown * ix);
+
+    block_max[IB_Z] = std::min((int64_t) ceil(context->zdown * (iz + 1) + 1), context->up_grid_size[IB_Z]);
+    block_max[IB_Y] = std::min((int64_t) ceil(context->ydown * (iy + 1) + 1), context->up_grid_size[IB_Y]);
+    block_max[IB_X] = std::min((int64_t) ceil(context->xdown * (ix + 1) + 1), context->up_grid_size[IB_X]);
+}
+
+
+
+// find the shortest path between two upsampled joints that stays within this label and the box
+static bool ConnectJoints(UpsampleContext *context, int64_t label, int64_t source, int64_t target, int64_t box_min[3], int64_t box_max[3], std::vector<int64_t> &path)
+{
+    int64_t up_sheet_size = context->up_sheet_size;
+    int64_t up_row_size = context->up_row_size;
+    float *up_resolution = context->up_resolution;
+
+    int64_t box_size[3];
+    box_size[IB_Z] = box_max[IB_Z] - box_min[IB_Z];
+    box_size[IB_Y] = box_max[IB_Y] - box_min[IB_Y];
+    box_size[IB_X] = box_max[IB_X] - box_min[IB_X];
+    int64_t box_sheet_size = box_size[IB_Y] * box_size[IB_X];
+    int64_t box_row_size = box_size[IB_X];
+    int64_t box_nentries = box_size[IB_Z] * box_sheet_size;
+
+    // convert the full resolution indices into box indices
+    int64_t source_iz = source / up_sheet_size - box_min[IB_Z];
+    int64_t source_iy = (source % up_sheet_size) / up_row_size - box_min[IB_Y];
+    int64_t source_ix = source % up_row_size - box_min[IB_X];
+    int64_t target_iz = target / up_sheet_size - box_min[IB_Z];
+    int64_t target_iy = (target % up_sheet_size) / up_row_size - box_min[IB_Y];
+    int64_t target_ix = target % up_row_size - box_min[IB_X];
+
+    int64_t box_source = source_iz * box_sheet_size + source_iy * box_row_size + source_ix;
+    int64_t box_target = target_iz * box_sheet_size + target_iy * box_row_size + target_ix;
+
+    std::vector<float> distances = std::vector<float>(box_nentries, INFINITY);
+    std::vector<int64_t> parents = std::vector<int64_t>(box_nentries, -1);
+
+    // dijkstra's algorithm with 26-connectivity weighted by the physical distance between voxels
+    typedef std::pair<float, int64_t> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > queue;
+    distances[box_source] = 0.0;
+    queue.push(QueueEntry(0.0, box_source));
+
+    while (!queue.empty()) {
+        QueueEntry entry = queue.top();
+        queue.pop();
+
+        int64_t box_index = entry.second;
+        if (entry.first > distances[box_index]) continue;
+        if (box_index == box_target) break;
+
+        int64_t iz = box_index / box_sheet_size;
+        int64_t iy = (box_index - iz * box_sheet_size) / box_row_size;
+        int64_t ix = box_index % box_row_size;
+
+        for (int64_t iw = iz - 1; iw <= iz + 1; ++iw) {
+            if (iw < 0 || iw >= box_size[IB_Z]) continue;
+            for (int64_t iv = iy - 1; iv <= iy + 1; ++iv) {
+                if (iv < 0 || iv >= box_size[IB_Y]) continue;
+                for (int64_t iu = ix - 1; iu <= ix + 1; ++iu) {
+                    if (iu < 0 || iu >= box_size[IB_X]) continue;
+
+                    int64_t neighbor_index = iw * box_sheet_size + iv * box_row_size + iu;
+                    if (neighbor_index == box_index) continue;
+
+                    // the path must remain within this label
+                    int64_t up_index = (iw + box_min[IB_Z]) * up_sheet_size + (iv + box_min[IB_Y]) * up_row_size + iu + box_min[IB_X];
+                    if (context->segmentation[up_index] != label) continue;
+
+                    float dz = (iw - iz) * up_resolution[IB_Z];
+                    float dy = (iv - iy) * up_resolution[IB_Y];
+                    float dx = (iu - ix) * up_resolution[IB_X];
+                    float distance = entry.first + sqrt(dz * dz + dy * dy + dx * dx);
+
+                    if (distance < distances[neighbor_index]) {
+                        distances[neighbor_index] = distance;
+                        parents[neighbor_index] = box_index;
+                        queue.push(QueueEntry(distance, neighbor_index));
+                    }
+                }
+            }
+        }
+    }
+
+    // the two joints are not connected within this box
+    if (parents[box_target] == -1) return false;
+
+    // add the intermediate voxels (not the joints themselves) to the path
+    int64_t box_index = parents[box_target];
+    while (box_index != box_source) {
+        int64_t iz = box_index / box_sheet_size;
+        int64_t iy = (box_index - iz * box_sheet_size) / box_row_size;
+        int64_t ix = box_index % box_row_size;
+
+        path.push_back((iz + box_min[IB_Z]) * up_sheet_size + (iy + box_min[IB_Y]) * up_row_size + ix + box_min[IB_X]);
+        box_index = parents[box_index];
+    }
+
+    return true;
+}
+
+
+
+// returns the number of adjacent joint pairs that are not connected even within the bounding box of the label
+static int64_t DensifySkeleton(UpsampleContext *context, int64_t label, std::vector<int64_t> &down_elements, int64_t label_min[3], int64_t label_max[3], std::vector<int64_t> &up_elements)
+{
+    int64_t *down_grid_size = context->down_grid_size;
+    std::map<int64_t, int64_t> &label_down_to_up = context->down_to_up[label];
+
+    std::unordered_set<int64_t> joints = std::unordered_set<int64_t>();
+    std::unordered_set<int64_t> up_joints = std::unordered_set<int64_t>();
+    for (uint64_t ie = 0; ie < down_elements.size(); ++ie) {
+        int64_t down_index = down_elements[ie];
+        int64_t up_index = label_down_to_up.at(llabs(down_index));
+
+        joints.insert(llabs(down_index));
+        up_joints.insert(up_index);
+
+        // endpoints remain negative
+        if (down_index < 0) up_elements.push_back(-1 * up_index);
+        else up_elements.push_back(up_index);
+    }
+
+    // connect every pair of adjacent joints once
+    int64_t nunconnected = 0;
+    std::set<std::pair<int64_t, int64_t> > connected_joints = std::set<std::pair<int64_t, int64_t> >();
+    for (std::unordered_set<int64_t>::iterator it = joints.begin(); it != joints.end(); ++it) {
+        int64_t down_index = *it;
+
+        int64_t ix, iy, iz;
+        IndexToIndices(context, down_index, ix, iy, iz);
+
+        for (int64_t iw = iz - 1; iw <= iz + 1; ++iw) {
+            if (iw < 0 || iw >= down_grid_size[IB_Z]) continue;
+            for (int64_t iv = iy - 1; iv <= iy + 1; ++iv) {
+                if (iv < 0 || iv >= down_grid_size[IB_Y]) continue;
+                for (int64_t iu = ix - 1; iu <= ix + 1; ++iu) {
+                    if (iu < 0 || iu >= down_grid_size[IB_X]) continue;
+
+                    int64_t neighbor_index = iw * context->down_sheet_size + iv * context->down_row_size + iu;
+                    if (neighbor_index == down_index) continue;
+                    if (!joints.count(neighbor_index)) continue;
+
+                    std::pair<int64_t, int64_t> joint_pair = std::make_pair(std::min(down_index, neighbor_index), std::max(down_index, neighbor_index));
+                    if (connected_joints.count(joint_pair)) continue;
+                    connected_joints.insert(joint_pair);
+
+                    // restrict the search to the box spanned by the blocks of both joints
+                    int64_t box_min[3], box_max[3], neighbor_min[3], neighbor_max[3];
+                    DownsampleBlock(context, down_index, box_min, box_max);
+                    DownsampleBlock(context, neighbor_index, neighbor_min, neighbor_max);
+                    for (int dim = 0; dim < 3; ++dim) {
+                        box_min[dim] = std::min(box_min[dim], neighbor_min[dim]);
+                        box_max[dim] = std::max(box_max[dim], neighbor_max[dim]);
+                    }
+
+                    // a path that leaves the box is searched again in boxes that grow on every side (by the size of the
+                    // first one and then twice as much each time) until they cover the label
+                    std::vector<int64_t> path = std::vector<int64_t>();
+                    int64_t source = label_down_to_up.at(down_index);
+                    int64_t target = label_down_to_up.at(neighbor_index);
+                    int64_t margin[3];
+                    for (int dim = 0; dim < 3; ++dim)
+                        margin[dim] = box_max[dim] - box_min[dim];
+
+                    bool connected = ConnectJoints(context, label, source, target, box_min, box_max, path);
+                    while (!connected) {
+                        bool covered = true;
+                        for (int dim = 0; dim < 3; ++dim)
+                            if (box_min[dim] > label_min[dim] || box_max[dim] < label_max[dim]) covered = false;
+                        if (covered) break;
+
+                        for (int dim = 0; dim < 3; ++dim) {
+                            box_min[dim] = std::max(box_min[dim] - margin[dim], label_min[dim]);
+                            box_max[dim] = std::min(box_max[dim] + margin[dim], label_max[dim]);
+                            margin[dim] *= 2;
+                        }
+
+                        connected = ConnectJoints(context, label, source, target, box_min, box_max, path);
+                    }
+                    if (!connected) { nunconnected++; continue; }
+
+                    // paths between neighboring pairs can overlap
+                    for (uint64_t ip = 0; ip < path.size(); ++ip) {
+                        if (up_joints.count(path[ip])) continue;
+                        up_joints.insert(path[ip]);
+                        up_elements.push_back(path[ip]);
+                    }
+                }
+            }
+        }
+    }
+
+    return nunconnected;
+}
+
+
+
+// operation that connects the upsampled joints with paths through the full resolution segmentation
+int CppDensifySkeletons(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3], int64_t num_threads)
+{
+    // get the mapping from downsampled locations to upsampled ones
+    UpsampleContext *context = NewUpsampleContext(prefix, input_segmentation, skeleton_resolution, output_resolution, 0, ALL_LABELS);
+    if (!context) return 0;
+
+    int64_t *up_grid_size = context->up_grid_size;
+
+    // I/O filenames
+    char input_filename[4096];
+    sprintf(input_filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-downsample-skeleton.pts", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    char output_filename[4096];
+    sprintf(output_filename, "skeletons/%s/thinning-%03ldx%03ldx%03ld-dense-skeleton.pts", prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z]);
+
+    // read all of the downsampled skeletons before starting the threads
+    FILE *rfp = CppOpenArtifact(input_filename, "rb");
+    if (!rfp) { fprintf(stderr, "Failed to read %s\n", input_filename); DeleteUpsampleContext(context); return 0; }
+
+    int64_t max_label;
+    int64_t input_grid_size[3];
+    if (fread(&(input_grid_size[IB_Z]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); fclose(rfp); DeleteUpsampleContext(context); return 0; }
+    if (fread(&(input_grid_size[IB_Y]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); fclose(rfp); DeleteUpsampleContext(context); return 0; }
+    if (fread(&(input_grid_size[IB_X]), sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); fclose(rfp); DeleteUpsampleContext(context); return 0; }
+    if (fread(&max_label, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); fclose(rfp); DeleteUpsampleContext(context); return 0; }
+
+    std::vector<std::vector<int64_t> > down_skeletons = std::vector<std::vector<int64_t> >(max_label);
+    for (int64_t label = 0; label < max_label; ++label) {
+        int64_t nelements;
+        if (fread(&nelements, sizeof(int64_t), 1, rfp) != 1) { fprintf(stderr, "Failed to read %s\n", input_filename); fclose(rfp); DeleteUpsampleContext(context); return 0; }
+
+        down_skeletons[label].resize(nelements);
+        if (fread(down_skeletons[label].data(), sizeof(int64_t), nelements, rfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to read %s\n", input_filename); fclose(rfp); DeleteUpsampleContext(context); return 0; }
+    }
+    fclose(rfp);
+
+    // the bounding box of every label limits the searches of the pairs that are not connected near their joints
+    std::vector<int64_t> label_boxes = std::vector<int64_t>(6 * max_label);
+    for (int64_t label = 0; label < max_label; ++label) {
+        for (int dim = 0; dim < 3; ++dim) {
+            label_boxes[6 * label + dim] = up_grid_size[dim];
+            label_boxes[6 * label + 3 + dim] = 0;
+        }
+    }
+    for (int64_t iz = 0; iz < up_grid_size[IB_Z]; ++iz) {
+        for (int64_t iy = 0; iy < up_grid_size[IB_Y]; ++iy) {
+            for (int64_t ix = 0; ix < up_grid_size[IB_X]; ++ix) {
+                int64_t label = context->segmentation[iz * context->up_sheet_size + iy * context->up_row_size + ix];
+                if (label < 0 || label >= max_label) continue;
+
+                int64_t *box = &(label_boxes[6 * label]);
+                box[IB_Z] = std::min(box[IB_Z], iz);
+                box[IB_Y] = std::min(box[IB_Y], iy);
+                box[IB_X] = std::min(box[IB_X], ix);
+                box[3 + IB_Z] = std::max(box[3 + IB_Z], iz + 1);
+                box[3 + IB_Y] = std::max(box[3 + IB_Y], iy + 1);
+                box[3 + IB_X] = std::max(box[3 + IB_X], ix + 1);
+            }
+        }
+    }
+
+    // each thread takes the next unprocessed label (the context is only read from here on)
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::vector<int64_t> > up_skeletons = std::vector<std::vector<int64_t> >(max_label);
+    std::atomic<int64_t> next_label(0);
+    std::atomic<int64_t> nunconnected(0);
+    std::vector<std::thread> threads = std::vector<std::thread>();
+    for (int64_t it = 0; it < num_threads; ++it) {
+        threads.push_back(std::thread([&]() {
+            int64_t label;
+            while ((label = next_label++) < max_label)
+                nunconnected += DensifySkeleton(context, label, down_skeletons[label], &(label_boxes[6 * label]), &(label_boxes[6 * label + 3]), up_skeletons[label]);
+        }));
+    }
+    for (uint64_t it = 0; it < threads.size(); ++it)
+        threads[it].join();
+
+    // such pairs are left unconnected in the dense skeletons
+    if (nunconnected) fprintf(stderr, "Failed to connect %ld joint pairs of %s\n", nunconnected.load(), prefix);
+
+    // write the dense skeletons in label order
+    FILE *wfp = CppOpenArtifact(output_filename, "wb");
+    if (!wfp) { fprintf(stderr, "Failed to write %s\n", output_filename); DeleteUpsampleContext(context); return 0; }
+
+    if (fwrite(&(up_grid_size[IB_Z]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
+    if (fwrite(&(up_grid_size[IB_Y]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
+    if (fwrite(&(up_grid_size[IB_X]), sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
+    if (fwrite(&max_label, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
+
+    for (int64_t label = 0; label < max_label; ++label) {
+        int64_t nelements = up_skeletons[label].size();
+        if (fwrite(&nelements, sizeof(int64_t), 1, wfp) != 1) { fprintf(stderr, "Failed to write %s\n", output_filename); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
+        if (fwrite(up_skeletons[label].data(), sizeof(int64_t), nelements, wfp) != (uint64_t)nelements) { fprintf(stderr, "Failed to write %s\n", output_filename); CppDiscardArtifact(wfp); DeleteUpsampleContext(context); return 0; }
+    }
+
+    // free memory
+    DeleteUpsampleContext(context);
+
+    // close the file
+    if (fclose(wfp)) { fprintf(stderr, "Failed to write %s\n", output_filename); return 0; }
+
+    return 1;
 }
@@ -9,23 +9,82 @@ from libcpp cimport bool
 import ctypes
 import numpy as np
 from libc.stdint cimport int64_t
+from libc.stdlib cimport malloc, free
 
 
 
 from topological_thinning.utilities import dataIO
+from topological_thinning.transforms.seg2seg import DownsampleMapping
 from topological_thinning.utilities.constants import *
 
 
 
-cdef extern from 'cpp-generate_skeletons.h':
-    void CppTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory)
-    void CppFindEndpointVectors(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3])
-    void CppApplyUpsampleOperation(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3])
+cdef extern from 'cpp-perf.h' nogil:
+    void CppPrintPerfCounters(const char *stage)
 
+cdef extern from 'cpp-storage.h' nogil:
+    bool CppCreateContainer(const char *prefix)
+    bool CppCreateDirectory(const char *prefix)
 
+cdef extern from 'cpp-progress.h' nogil:
+    ctypedef struct StageProgress:
+        const char *stage
+        int64_t labels
+        int64_t nlabels
+        int64_t voxels
+        int64_t nvoxels
+        int64_t bytes
+        double seconds
+        double voxels_per_second
+        double bytes_per_second
+    ctypedef bool (*ProgressCallback)(const StageProgress *progress, void *data) noexcept
+    cdef struct ProgressContext
+    ProgressContext *CppNewProgressContext(ProgressCallback callback, void *data, double interval)
+    void CppDeleteProgressContext(ProgressContext *progress)
+    void CppStartProgress(ProgressContext *progress, const char *stage, int64_t nlabels, int64_t nvoxels)
+    bool CppProgressCancelled(ProgressContext *progress)
+    bool CppFinishProgress(ProgressContext *progress)
 
-# generate skeletons for this volume
-def TopologicalThinning(prefix, input_segmentation, skeleton_resolution=(80, 80, 80)):
+cdef extern from 'cpp-generate_skeletons.h' nogil:
+    int CppTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget, int64_t label_start, int64_t label_end, int64_t max_iterations, double max_seconds, bool statistics, bool morton, ProgressContext *progress)
+    int CppResumeTopologicalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t max_iterations, double max_seconds)
+    int CppFindEndpointVectors(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3], int64_t label_start, int64_t label_end)
+    int CppApplyUpsampleOperation(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3], int64_t label_start, int64_t label_end)
+    int CppDensifySkeletons(const char *prefix, int64_t *input_segmentation, int64_t skeleton_resolution[3], float output_resolution[3], int64_t num_threads)
+    int CppAdaptiveTopologicalThinning(const char *prefix, int64_t *skeleton_resolutions, int64_t nskeleton_resolutions, int64_t label_voxel_budget, const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget)
+    int64_t CppIncrementalThinning(const char *prefix, int64_t skeleton_resolution[3], const char *lookup_table_directory, int64_t num_threads, int64_t memory_budget)
+    int CppRunSkeletonService(const char *socket_path, const char *lookup_table_directory)
+    int CppMergeShards(const char *output_filename, const char **shard_filenames, int64_t nshards)
+    int CppStitchBlocks(const char *prefix, int64_t skeleton_resolution[3], float output_resolution[3], int64_t grid_size[3], const char **block_prefixes, int64_t *block_origins, int64_t *block_cores, int64_t nblocks, int64_t label_start, int64_t label_end)
+    enum: ALL_LABELS
+
+
+
+include 'progress.pxi'
+
+
+
+# get the label range for the c++ calls (no range runs every label into the canonical files)
+def LabelRange(label_range):
+    if label_range is None: return 0, ALL_LABELS
+
+    label_start, label_end = label_range
+    assert (0 <= label_start and label_start <= label_end)
+
+    return label_start, label_end
+
+
+
+# generate skeletons for this volume (labels are thinned largest first on num_threads threads, all cores if zero,
+# with at most memory_budget bytes of working volumes in flight, unlimited if zero); with a label_range of
+# (start, end) only those labels are skeletonized into shard files that MergeShards combines; with max_iterations
+# or max_seconds per label the labels that run out keep their current surface as the skeleton (flagged by
+# dataIO.ReadThinningConvergence) until ResumeTopologicalThinning; with statistics the work done on every label is saved and returned as a record
+# array (dataIO.ReadThinningStatistics, only returned for all labels); morton thins in a working volume of z-order
+# bricks that keeps the neighborhoods of large labels in cache (skeletons can differ slightly from the row layout);
+# progress is called with the thinned labels, their downsampled voxels and the written bytes every progress_interval
+# seconds, and returning True stops thinning after the last written label (the same call continues from there)
+def TopologicalThinning(prefix, input_segmentation, skeleton_resolution=(80, 80, 80), num_threads=0, memory_budget=0, label_range=None, max_iterations=0, max_seconds=0, statistics=False, morton=False, progress=None, progress_interval=1.0):
     # everything needs to be long ints to work with c++
     assert (input_segmentation.dtype == np.int64)
 
@@ -33,29 +92,355 @@ def TopologicalThinning(prefix, input_segmentation, skeleton_resolution=(80, 80,
 
     # convert the numpy arrays to c++
     cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_skeleton_resolution = np.ascontiguousarray(skeleton_resolution, dtype=ctypes.c_int64)
-    lut_directory = os.path.dirname(__file__)
+    cdef np.ndarray[int64_t, ndim=3, mode='c'] cpp_input_segmentation = np.ascontiguousarray(input_segmentation, dtype=ctypes.c_int64)
+    cdef np.ndarray[float, ndim=1, mode='c'] cpp_output_resolution = np.ascontiguousarray(dataIO.Resolution(prefix), dtype=ctypes.c_float)
+
+    # the strings must outlive the calls without the gil
+    cpp_prefix = prefix.encode('utf-8')
+    cpp_lut_directory = os.path.dirname(__file__).encode('utf-8')
+    cdef const char *prefix_ptr = cpp_prefix
+    cdef const char *lut_directory_ptr = cpp_lut_directory
+    cdef int64_t *skeleton_resolution_ptr = &(cpp_skeleton_resolution[0])
+    cdef int64_t *input_segmentation_ptr = &(cpp_input_segmentation[0,0,0])
+    cdef float *output_resolution_ptr = &(cpp_output_resolution[0])
+    cdef int64_t cpp_num_threads = num_threads
+    cdef int64_t cpp_memory_budget = memory_budget
+    cdef int64_t label_start, label_end
+    label_start, label_end = LabelRange(label_range)
+    cdef int64_t cpp_max_iterations = max_iterations
+    cdef double cpp_max_seconds = max_seconds
+    cdef bool cpp_statistics = statistics
+    cdef bool cpp_morton = morton
+    cdef int thinned
+    cdef int upsampled
+
+    # the callback of this call only lives as long as the call
+    cdef ProgressReporter reporter = None
+    cdef ProgressContext *progress_context = NULL
+    if progress is not None:
+        reporter = ProgressReporter(progress)
+        progress_context = CppNewProgressContext(ReportProgress, <void *> reporter, progress_interval)
 
-    # call the topological skeleton algorithm
-    CppTopologicalThinning(prefix.encode('utf-8'), &(cpp_skeleton_resolution[0]), lut_directory.encode('utf-8'))
+    with nogil:
+        # call the topological skeleton algorithm
+        thinned = CppTopologicalThinning(prefix_ptr, skeleton_resolution_ptr, lut_directory_ptr, cpp_num_threads, cpp_memory_budget, label_start, label_end, cpp_max_iterations, cpp_max_seconds, cpp_statistics, cpp_morton, progress_context)
 
-    # call the upsampling operation
+        # only prints when compiled with PERF_COUNTERS
+        CppPrintPerfCounters('thinning')
+
+    cdef bool cancelled = CppProgressCancelled(progress_context)
+    CppDeleteProgressContext(progress_context)
+    RaiseProgressException(reporter)
+
+    assert (thinned)
+
+    # the journal of a cancelled run holds the labels written so far
+    if cancelled:
+        print ('Cancelled thinning of {} after {:0.2f} seconds.'.format(prefix, time.time() - start_time))
+        return
+
+    with nogil:
+        # call the upsampling operation
+        upsampled = CppApplyUpsampleOperation(prefix_ptr, input_segmentation_ptr, skeleton_resolution_ptr, output_resolution_ptr, label_start, label_end)
+
+    assert (upsampled)
+
+    print ('Generated skeletons for {} in {:0.2f} seconds.'.format(prefix, time.time() - start_time))
+
+    if (max_iterations or max_seconds) and label_range is None:
+        converged, iterations = dataIO.ReadThinningConvergence(prefix, downsample_resolution=skeleton_resolution)
+        print ('  {} labels did not converge within the budget.'.format(np.count_nonzero(~converged)))
+
+    if statistics and label_range is None:
+        label_statistics = dataIO.ReadThinningStatistics(prefix, downsample_resolution=skeleton_resolution)
+        seconds = label_statistics.detect_seconds + label_statistics.delete_seconds
+        if seconds.size: print ('  slowest label {} took {:0.2f} seconds.'.format(np.argmax(seconds), np.max(seconds)))
+
+        return label_statistics
+
+
+
+# continue thinning the labels that did not converge within the budget of TopologicalThinning (until they converge
+# or for another max_iterations or max_seconds per label, in the layout of the first pass) and upsample the new
+# skeletons (dataIO.ReadThinningStatistics keeps describing the first pass)
+def ResumeTopologicalThinning(prefix, input_segmentation, skeleton_resolution=(80, 80, 80), num_threads=0, max_iterations=0, max_seconds=0):
+    # everything needs to be long ints to work with c++
+    assert (input_segmentation.dtype == np.int64)
+
+    start_time = time.time()
+
+    # convert the numpy arrays to c++
+    cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_skeleton_resolution = np.ascontiguousarray(skeleton_resolution, dtype=ctypes.c_int64)
     cdef np.ndarray[int64_t, ndim=3, mode='c'] cpp_input_segmentation = np.ascontiguousarray(input_segmentation, dtype=ctypes.c_int64)
     cdef np.ndarray[float, ndim=1, mode='c'] cpp_output_resolution = np.ascontiguousarray(dataIO.Resolution(prefix), dtype=ctypes.c_float)
 
-    CppApplyUpsampleOperation(prefix.encode('utf-8'), &(cpp_input_segmentation[0,0,0]), &(cpp_skeleton_resolution[0]), &(cpp_output_resolution[0]))
+    # the strings must outlive the calls without the gil
+    cpp_prefix = prefix.encode('utf-8')
+    cpp_lut_directory = os.path.dirname(__file__).encode('utf-8')
+    cdef const char *prefix_ptr = cpp_prefix
+    cdef const char *lut_directory_ptr = cpp_lut_directory
+    cdef int64_t *skeleton_resolution_ptr = &(cpp_skeleton_resolution[0])
+    cdef int64_t *input_segmentation_ptr = &(cpp_input_segmentation[0,0,0])
+    cdef float *output_resolution_ptr = &(cpp_output_resolution[0])
+    cdef int64_t cpp_num_threads = num_threads
+    cdef int64_t cpp_max_iterations = max_iterations
+    cdef double cpp_max_seconds = max_seconds
+    cdef int thinned
+    cdef int upsampled
 
-    print ('Generated skeletons for {} in {:0.2f} seconds.'.format(prefix, time.time() - start_time))
+    with nogil:
+        thinned = CppResumeTopologicalThinning(prefix_ptr, skeleton_resolution_ptr, lut_directory_ptr, cpp_num_threads, cpp_max_iterations, cpp_max_seconds)
+
+    assert (thinned)
+
+    with nogil:
+        upsampled = CppApplyUpsampleOperation(prefix_ptr, input_segmentation_ptr, skeleton_resolution_ptr, output_resolution_ptr, 0, ALL_LABELS)
 
+    assert (upsampled)
 
+    converged, iterations = dataIO.ReadThinningConvergence(prefix, downsample_resolution=skeleton_resolution)
 
-# find endpoint vectors for this skeleton
-def FindEndpointVectors(prefix, skeleton_resolution=(80, 80, 80)):
+    print ('Resumed thinning for {} in {:0.2f} seconds ({} labels did not converge).'.format(prefix, time.time() - start_time, np.count_nonzero(~converged)))
+
+
+
+# skeletonize every label at the finest of skeleton_resolutions (all downsampled by DownsampleMapping) where it has
+# at most label_voxel_budget downsampled voxels (the coarsest otherwise) so that the work per label stays bounded;
+# the resolution of every label is saved with the skeletons (dataIO.ReadAdaptiveResolutions)
+def AdaptiveTopologicalThinning(prefix, skeleton_resolutions=((40, 40, 40), (80, 80, 80), (160, 160, 160)), label_voxel_budget=2**18, num_threads=0, memory_budget=0):
+    start_time = time.time()
+
+    # order the resolutions from finest to coarsest
+    skeleton_resolutions = sorted(skeleton_resolutions, key=lambda resolution: resolution[IB_Z] * resolution[IB_Y] * resolution[IB_X])
+    cdef np.ndarray[int64_t, ndim=2, mode='c'] cpp_skeleton_resolutions = np.ascontiguousarray(skeleton_resolutions, dtype=ctypes.c_int64)
+
+    # the strings must outlive the calls without the gil
+    cpp_prefix = prefix.encode('utf-8')
+    cpp_lut_directory = os.path.dirname(__file__).encode('utf-8')
+    cdef const char *prefix_ptr = cpp_prefix
+    cdef const char *lut_directory_ptr = cpp_lut_directory
+    cdef int64_t *skeleton_resolutions_ptr = &(cpp_skeleton_resolutions[0,0])
+    cdef int64_t nskeleton_resolutions = cpp_skeleton_resolutions.shape[0]
+    cdef int64_t cpp_label_voxel_budget = label_voxel_budget
+    cdef int64_t cpp_num_threads = num_threads
+    cdef int64_t cpp_memory_budget = memory_budget
+    cdef int thinned
+
+    with nogil:
+        thinned = CppAdaptiveTopologicalThinning(prefix_ptr, skeleton_resolutions_ptr, nskeleton_resolutions, cpp_label_voxel_budget, lut_directory_ptr, cpp_num_threads, cpp_memory_budget)
+
+    assert (thinned)
+
+    print ('Generated adaptive skeletons for {} in {:0.2f} seconds.'.format(prefix, time.time() - start_time))
+
+
+
+# regenerate the skeletons, endpoint vectors and upsampled skeletons after DownsampleMapping of an edited segmentation;
+# only the labels whose downsampled voxels changed since the previous call are skeletonized and every other label
+# is copied from the previous outputs (the first call skeletonizes every label)
+def IncrementalTopologicalThinning(prefix, skeleton_resolution=(80, 80, 80), num_threads=0, memory_budget=0):
+    start_time = time.time()
+
+    cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_skeleton_resolution = np.ascontiguousarray(skeleton_resolution, dtype=ctypes.c_int64)
+
+    # the strings must outlive the calls without the gil
+    cpp_prefix = prefix.encode('utf-8')
+    cpp_lut_directory = os.path.dirname(__file__).encode('utf-8')
+    cdef const char *prefix_ptr = cpp_prefix
+    cdef const char *lut_directory_ptr = cpp_lut_directory
+    cdef int64_t *skeleton_resolution_ptr = &(cpp_skeleton_resolution[0])
+    cdef int64_t cpp_num_threads = num_threads
+    cdef int64_t cpp_memory_budget = memory_budget
+    cdef int64_t nchanged
+
+    with nogil:
+        nchanged = CppIncrementalThinning(prefix_ptr, skeleton_resolution_ptr, lut_directory_ptr, cpp_num_threads, cpp_memory_budget)
+
+    assert (nchanged >= 0)
+
+    print ('Generated skeletons for {} changed labels of {} in {:0.2f} seconds.'.format(nchanged, prefix, time.time() - start_time))
+
+
+
+# answer skeleton requests on a unix socket until a client asks the service to shut down (see utilities/skeleton_client.py);
+# the downsampled labels are read on the first request for a prefix and resolution and skeletons are kept once thinned
+def RunSkeletonService(socket_path='skeletons/service.sock'):
+    start_time = time.time()
+
+    # the strings must outlive the calls without the gil
+    cpp_socket_path = socket_path.encode('utf-8')
+    cpp_lut_directory = os.path.dirname(__file__).encode('utf-8')
+    cdef const char *socket_path_ptr = cpp_socket_path
+    cdef const char *lut_directory_ptr = cpp_lut_directory
+    cdef int clean
+
+    with nogil:
+        clean = CppRunSkeletonService(socket_path_ptr, lut_directory_ptr)
+
+    assert (clean)
+
+    print ('Ran skeleton service on {} for {:0.2f} seconds.'.format(socket_path, time.time() - start_time))
+
+
+
+# connect adjacent upsampled joints with paths through the full resolution segmentation
+def DensifySkeletons(prefix, input_segmentation, skeleton_resolution=(80, 80, 80), num_threads=0):
+    # everything needs to be long ints to work with c++
+    assert (input_segmentation.dtype == np.int64)
+
+    start_time = time.time()
+
+    # convert the numpy arrays to c++
+    cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_skeleton_resolution = np.ascontiguousarray(skeleton_resolution, dtype=ctypes.c_int64)
+    cdef np.ndarray[int64_t, ndim=3, mode='c'] cpp_input_segmentation = np.ascontiguousarray(input_segmentation, dtype=ctypes.c_int64)
+    cdef np.ndarray[float, ndim=1, mode='c'] cpp_output_resolution = np.ascontiguousarray(dataIO.Resolution(prefix), dtype=ctypes.c_float)
+
+    # the strings must outlive the calls without the gil
+    cpp_prefix = prefix.encode('utf-8')
+    cdef const char *prefix_ptr = cpp_prefix
+    cdef int64_t *skeleton_resolution_ptr = &(cpp_skeleton_resolution[0])
+    cdef int64_t *input_segmentation_ptr = &(cpp_input_segmentation[0,0,0])
+    cdef float *output_resolution_ptr = &(cpp_output_resolution[0])
+    cdef int64_t cpp_num_threads = num_threads
+    cdef int densified
+
+    # a thread count of zero uses all available cores
+    with nogil:
+        densified = CppDensifySkeletons(prefix_ptr, input_segmentation_ptr, skeleton_resolution_ptr, output_resolution_ptr, cpp_num_threads)
+
+    assert (densified)
+
+    print ('Densified skeletons for {} in {:0.2f} seconds.'.format(prefix, time.time() - start_time))
+
+
+
+# find endpoint vectors for this skeleton (only for the labels in label_range if given)
+def FindEndpointVectors(prefix, skeleton_resolution=(80, 80, 80), label_range=None):
     start_time = time.time()
 
     # convert to numpy array for c++ call
     cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_skeleton_resolution = np.ascontiguousarray(skeleton_resolution, dtype=ctypes.c_int64)
     cdef np.ndarray[float, ndim=1, mode='c'] cpp_output_resolution = np.ascontiguousarray(dataIO.Resolution(prefix), dtype=ctypes.c_float)
 
-    CppFindEndpointVectors(prefix.encode('utf-8'), &(cpp_skeleton_resolution[0]), &(cpp_output_resolution[0]))
+    # the strings must outlive the calls without the gil
+    cpp_prefix = prefix.encode('utf-8')
+    cdef const char *prefix_ptr = cpp_prefix
+    cdef int64_t *skeleton_resolution_ptr = &(cpp_skeleton_resolution[0])
+    cdef float *output_resolution_ptr = &(cpp_output_resolution[0])
+    cdef int64_t label_start, label_end
+    label_start, label_end = LabelRange(label_range)
+    cdef int found
+
+    with nogil:
+        found = CppFindEndpointVectors(prefix_ptr, skeleton_resolution_ptr, output_resolution_ptr, label_start, label_end)
+
+    assert (found)
 
     print ('Found endpoint vectors for {} in {:0.2f} seconds.'.format(prefix, time.time() - start_time))
+
+
+
+# merge the label range shards of every output into the canonical files
+def MergeShards(prefix, skeleton_resolution=(80, 80, 80)):
+    start_time = time.time()
+
+    cdef const char *output_filename_ptr
+    cdef const char **shard_filenames_ptr
+    cdef int64_t nshards
+    cdef int merged
+
+    for name, extension in [('downsample-skeleton', 'pts'), ('upsample-skeleton', 'pts'), ('endpoint-vectors', 'vec'), ('convergence', 'bytes'), ('state', 'bytes'), ('statistics', 'bytes')]:
+        output_filename = 'skeletons/{}/thinning-{:03d}x{:03d}x{:03d}-{}.{}'.format(prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z], name, extension)
+        shard_filenames = dataIO.GlobArtifacts('skeletons/{}/thinning-{:03d}x{:03d}x{:03d}-{}-shard-*.{}'.format(prefix, skeleton_resolution[IB_X], skeleton_resolution[IB_Y], skeleton_resolution[IB_Z], name, extension))
+        if not len(shard_filenames): continue
+
+        # the strings must outlive the calls without the gil
+        cpp_output_filename = output_filename.encode('utf-8')
+        cpp_shard_filenames = [shard_filename.encode('utf-8') for shard_filename in shard_filenames]
+        output_filename_ptr = cpp_output_filename
+        nshards = len(cpp_shard_filenames)
+        shard_filenames_ptr = <const char **> malloc(nshards * sizeof(char *))
+        for iv in range(nshards):
+            shard_filenames_ptr[iv] = cpp_shard_filenames[iv]
+
+        with nogil:
+            merged = CppMergeShards(output_filename_ptr, shard_filenames_ptr, nshards)
+        free(shard_filenames_ptr)
+
+        assert (merged)
+
+    print ('Merged shards for {} in {:0.2f} seconds.'.format(prefix, time.time() - start_time))
+
+
+
+# skeletonize one block of block_size voxels with halo voxels of context on every side, both rounded up to whole
+# downsample periods (dataIO.BlockSize) so that the block downsamples like the volume (blocks are independent
+# so they can run in parallel or on separate nodes before StitchBlocks); with container the outputs of every block
+# are written into skeletons/{block prefix}.container
+def SkeletonizeBlock(prefix, block_index, block_size, halo, skeleton_resolution=(80, 80, 80), num_threads=0, memory_budget=0, container=False):
+    block_prefix = dataIO.WriteBlockMetaData(prefix, block_index, block_size, halo, skeleton_resolution)
+
+    # only this block is read from the segmentation
+    segmentation = dataIO.ReadSegmentationData(block_prefix)
+
+    # relabel consecutively so that memory depends on the block and not on the largest label in the dataset
+    labels = np.unique(segmentation)
+    if not labels[0] == 0: labels = np.concatenate(([0], labels))
+    segmentation = np.searchsorted(labels, segmentation).astype(np.int64)
+
+    DownsampleMapping(block_prefix, segmentation, skeleton_resolution, container)
+    dataIO.WriteBlockLabels(block_prefix, labels)
+
+    TopologicalThinning(block_prefix, segmentation, skeleton_resolution, num_threads, memory_budget)
+    FindEndpointVectors(block_prefix, skeleton_resolution)
+
+
+
+# stitch the skeletons of all blocks into one skeleton per label where each block contributes the points in its
+# core and the halo points that join its fragments to those of its neighbors (only the labels in label_range if
+# given, into shard files that MergeShards combines); with container the
+# stitched skeletons are written into skeletons/{prefix}.container
+def StitchBlocks(prefix, block_size, skeleton_resolution=(80, 80, 80), label_range=None, container=False):
+    if not os.path.isdir('skeletons'): os.mkdir('skeletons')
+    if container: assert (CppCreateContainer(prefix.encode('utf-8')))
+    else: assert (CppCreateDirectory(prefix.encode('utf-8')))
+
+    start_time = time.time()
+
+    nblocks = dataIO.NumberOfBlocks(prefix, block_size, skeleton_resolution)
+    block_indices = [(iz, iy, ix) for iz in range(nblocks[IB_Z]) for iy in range(nblocks[IB_Y]) for ix in range(nblocks[IB_X])]
+
+    # the origin and core of every block come from its meta file
+    block_prefixes = [dataIO.BlockPrefix(prefix, block_index) for block_index in block_indices]
+    block_meta = [dataIO.ReadMetaData(block_prefix) for block_prefix in block_prefixes]
+
+    cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_skeleton_resolution = np.ascontiguousarray(skeleton_resolution, dtype=ctypes.c_int64)
+    cdef np.ndarray[float, ndim=1, mode='c'] cpp_output_resolution = np.ascontiguousarray(dataIO.Resolution(prefix), dtype=ctypes.c_float)
+    cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_grid_size = np.ascontiguousarray(dataIO.GridSize(prefix), dtype=ctypes.c_int64)
+    cdef np.ndarray[int64_t, ndim=2, mode='c'] cpp_block_origins = np.ascontiguousarray([meta.BlockOrigin() for meta in block_meta], dtype=ctypes.c_int64)
+    cdef np.ndarray[int64_t, ndim=2, mode='c'] cpp_block_cores = np.ascontiguousarray([meta.BlockCore() for meta in block_meta], dtype=ctypes.c_int64)
+
+    # the strings must outlive the calls without the gil
+    cpp_prefix = prefix.encode('utf-8')
+    cpp_block_prefixes = [block_prefix.encode('utf-8') for block_prefix in block_prefixes]
+    cdef const char *prefix_ptr = cpp_prefix
+    cdef int64_t nblocks_total = len(cpp_block_prefixes)
+    cdef const char **block_prefixes_ptr = <const char **> malloc(nblocks_total * sizeof(char *))
+    for ib in range(nblocks_total):
+        block_prefixes_ptr[ib] = cpp_block_prefixes[ib]
+    cdef int64_t *skeleton_resolution_ptr = &(cpp_skeleton_resolution[0])
+    cdef float *output_resolution_ptr = &(cpp_output_resolution[0])
+    cdef int64_t *grid_size_ptr = &(cpp_grid_size[0])
+    cdef int64_t *block_origins_ptr = &(cpp_block_origins[0,0])
+    cdef int64_t *block_cores_ptr = &(cpp_block_cores[0,0])
+    cdef int64_t label_start, label_end
+    label_start, label_end = LabelRange(label_range)
+    cdef int stitched
+
+    with nogil:
+        stitched = CppStitchBlocks(prefix_ptr, skeleton_resolution_ptr, output_resolution_ptr, grid_size_ptr, block_prefixes_ptr, block_origins_ptr, block_cores_ptr, nblocks_total, label_start, label_end)
+    free(block_prefixes_ptr)
+
+    assert (stitched)
+
+    print ('Stitched {} blocks for {} in {:0.2f} seconds.'.format(nblocks_total, prefix, time.time() - start_time))
@@ -0,0 +1,38 @@
+# the python callback of a native stage and the exception that it raised (included by generate_skeletons.pyx and
+# transforms/seg2seg.pyx after their cpp-progress.h declarations)
+cdef class ProgressReporter:
+    cdef object callback
+    cdef object exception
+
+    def __init__(self, callback):
+        self.callback = callback
+        self.exception = None
+
+
+
+# pass the progress of a native stage to the python callback as a dict (the callback cancels the stage by returning
+# True; a callback that raises cancels it as well and RaiseProgressException raises the exception after the stage)
+cdef bool ReportProgress(const StageProgress *progress, void *data) noexcept with gil:
+    cdef ProgressReporter reporter = <ProgressReporter> data
+    try:
+        cancel = reporter.callback({
+            'stage': progress.stage.decode('utf-8'),
+            'labels': progress.labels,
+            'nlabels': progress.nlabels,
+            'voxels': progress.voxels,
+            'nvoxels': progress.nvoxels,
+            'bytes': progress.bytes,
+            'seconds': progress.seconds,
+            'voxels_per_second': progress.voxels_per_second,
+            'bytes_per_second': progress.bytes_per_second,
+        })
+        return True if cancel else False
+    except BaseException as exception:
+        reporter.exception = exception
+        return True
+
+
+
+# raise the exception of the callback (including KeyboardInterrupt) once the native call returned
+cdef RaiseProgressException(ProgressReporter reporter):
+    if reporter is not None and reporter.exception is not None: raise reporter.exception
@@ -1,3 +1,4 @@
+import os
 from distutils.core import setup, Extension
 from Cython.Build import cythonize
 import numpy as np
@@ -6,8 +7,19 @@ extensions = [
     Extension(
         name='generate_skeletons',
         include_dirs=[np.get_include()],
-        sources=['generate_skeletons.pyx', 'cpp-thinning.cpp', 'cpp-upsample.cpp'],
-        extra_compile_args=['-O4', '-std=c++11'],
+        sources=['generate_skeletons.pyx', 'cpp-thinning.cpp', 'cpp-upsample.cpp', 'cpp-shards.cpp', 'cpp-blocks.cpp', 'cpp-adaptive.cpp', 'cpp-incremental.cpp', 'cpp-service.cpp', 'cpp-progress.cpp', 'cpp-storage.cpp'],
+        # PERF_COUNTERS=1 python setup.py build_ext --inplace prints hardware counters of the hot loops
+        define_macros=[('PERF_COUNTERS', None)] if os.environ.get('PERF_COUNTERS') else [],
+        extra_compile_args=['-O4', '-std=c++11', '-pthread'],
+        extra_link_args=['-pthread'],
+        language='c++'
+    ),
+    # reads and writes the outputs of a dataset for utilities/dataIO.py
+    Extension(
+        name='storage',
+        sources=['storage.pyx', 'cpp-storage.cpp'],
+        extra_compile_args=['-O4', '-std=c++11', '-pthread'],
+        extra_link_args=['-pthread'],
         language='c++'
     )
 ]
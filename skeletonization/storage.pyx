@@ -0,0 +1,71 @@
+from libcpp cimport bool
+from libcpp.string cimport string
+from libcpp.vector cimport vector
+from libc.stdio cimport FILE, fread, fwrite, fclose, fseek, ftell, SEEK_SET, SEEK_END
+from libc.stdlib cimport malloc, free
+
+
+
+cdef extern from 'cpp-storage.h' nogil:
+    FILE *CppOpenArtifact(const char *filename, const char *mode)
+    void CppDiscardArtifact(FILE *fp)
+    bool CppGlobArtifacts(const char *pattern, vector[string] &filenames)
+
+
+
+# the outputs of a dataset are the files in skeletons/{prefix}/ or the entries of skeletons/{prefix}.container, and the
+# layout is chosen once per process by the c++ code (see cpp-storage.h)
+def ReadArtifact(filename):
+    # return the bytes of an output
+    cpp_filename = filename.encode('utf-8')
+    cdef FILE *fp = CppOpenArtifact(cpp_filename, 'rb')
+    if fp == NULL: raise IOError('Failed to read {}'.format(filename))
+
+    cdef long nbytes = -1
+    if not fseek(fp, 0, SEEK_END): nbytes = ftell(fp)
+    if nbytes < 0 or fseek(fp, 0, SEEK_SET):
+        fclose(fp)
+        raise IOError('Failed to read {}'.format(filename))
+
+    cdef char *data = <char *> malloc(nbytes + 1)
+    if data == NULL:
+        fclose(fp)
+        raise MemoryError()
+    cdef size_t nread
+    with nogil:
+        nread = fread(data, 1, nbytes, fp)
+        fclose(fp)
+
+    try:
+        if not nread == nbytes: raise IOError('Failed to read {}'.format(filename))
+        return data[:nbytes]
+    finally:
+        free(data)
+
+
+
+def WriteArtifact(filename, data):
+    # write (or replace) an output; a container entry is only replaced once all of it is written
+    cpp_filename = filename.encode('utf-8')
+    cdef const unsigned char[::1] cpp_data = memoryview(data).cast('B')
+    cdef size_t nbytes = cpp_data.shape[0]
+    cdef FILE *fp = CppOpenArtifact(cpp_filename, 'wb')
+    if fp == NULL: raise IOError('Failed to write {}'.format(filename))
+
+    cdef bool written
+    with nogil:
+        written = not nbytes or fwrite(&(cpp_data[0]), 1, nbytes, fp) == nbytes
+        if not written: CppDiscardArtifact(fp)
+        else: written = not fclose(fp)
+
+    if not written: raise IOError('Failed to write {}'.format(filename))
+
+
+
+def GlobArtifacts(pattern):
+    # return the outputs that match the pattern in sorted order
+    cpp_pattern = pattern.encode('utf-8')
+    cdef vector[string] filenames
+    if not CppGlobArtifacts(cpp_pattern, filenames): raise IOError('Failed to read {}'.format(pattern))
+
+    return [filename.decode('utf-8') for filename in filenames]
@@ -1,7 +1,17 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <inttypes.h>
 #include <algorithm>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
+#include "cpp-seg2seg.h"
+#include "../skeletonization/cpp-perf.h"
+#include "../skeletonization/cpp-progress.h"
+#include "../skeletonization/cpp-storage.h"
 
 
 
@@ -11,66 +21,360 @@
 
 
 
-void CppDownsampleMapping(const char *prefix, int64_t *segmentation, float input_resolution[3], int64_t output_resolution[3], int64_t input_grid_size[3])
+// closest voxel to the center of a downsampled window found so far
+struct Representative {
+    int64_t distance;
+    int64_t index;
+};
+
+
+
+// all of the state for downsampling a segmentation that arrives in z slabs
+struct DownsampleContext {
+    std::string prefix;
+    int64_t output_resolution[3];
+
+    int64_t input_grid_size[3];
+    int64_t output_grid_size[3];
+    int64_t output_sheet_size;
+    int64_t output_row_size;
+
+    // get downsample ratios
+    float zdown;
+    float ydown;
+    float xdown;
+
+    // an integer ratio along x (such as 8 to 80 nm) splits every row into runs of xratio voxels that each fall in
+    // one downsampled location (zero for other ratios)
+    int64_t xratio;
+
+    // the segment and location last added for every location of the output sheet (a segment that fills a location
+    // does so for several rows and slices so only its first row adds it)
+    std::vector<int64_t> cell_segments;
+    std::vector<int64_t> cell_indices;
+
+    // downsampled windows (minimum, maximum and center) that contain each full resolution coordinate
+    std::vector<int64_t> window_min[3];
+    std::vector<int64_t> window_max[3];
+    std::vector<int64_t> window_center[3];
+    std::vector<std::vector<int64_t> > windows[3];
+
+    // downsampled locations, number of voxels and representative voxels for each segment
+    std::vector<std::unordered_set<int64_t> > downsample_sets;
+    std::vector<int64_t> nvoxels;
+    std::vector<std::unordered_map<int64_t, Representative> > representatives;
+
+    // closest voxel of each segment within one window of a row
+    std::vector<int64_t> row_segments;
+    std::vector<Representative> row_closest;
+
+    // the next slice expected from the slabs
+    int64_t next_slice;
+};
+
+
+
+DownsampleContext *CppNewDownsampleContext(const char *prefix, float input_resolution[3], int64_t output_resolution[3], int64_t input_grid_size[3])
 {
-    // get the number of entries
-    int64_t input_nentries = input_grid_size[IB_Z] * input_grid_size[IB_Y] * input_grid_size[IB_X];
+    DownsampleContext *context = new DownsampleContext();
+    context->prefix = prefix;
+
+    for (int dim = 0; dim < 3; ++dim) {
+        context->output_resolution[dim] = output_resolution[dim];
+        context->input_grid_size[dim] = input_grid_size[dim];
+    }
 
     // get downsample ratios
-    float zdown = ((float) output_resolution[IB_Z]) / input_resolution[IB_Z];
-    float ydown = ((float) output_resolution[IB_Y]) / input_resolution[IB_Y];
-    float xdown = ((float) output_resolution[IB_X]) / input_resolution[IB_X];
+    context->zdown = ((float) output_resolution[IB_Z]) / input_resolution[IB_Z];
+    context->ydown = ((float) output_resolution[IB_Y]) / input_resolution[IB_Y];
+    context->xdown = ((float) output_resolution[IB_X]) / input_resolution[IB_X];
 
     // get the output resolution size
-    int64_t output_grid_size[3];
-    output_grid_size[IB_Z] = (int64_t) ceil(input_grid_size[IB_Z] / zdown);
-    output_grid_size[IB_Y] = (int64_t) ceil(input_grid_size[IB_Y] / ydown);
-    output_grid_size[IB_X] = (int64_t) ceil(input_grid_size[IB_X] / xdown);
-    int64_t output_sheet_size = output_grid_size[IB_Y] * output_grid_size[IB_X];
-    int64_t output_row_size = output_grid_size[IB_X];
+    context->output_grid_size[IB_Z] = (int64_t) ceil(input_grid_size[IB_Z] / context->zdown);
+    context->output_grid_size[IB_Y] = (int64_t) ceil(input_grid_size[IB_Y] / context->ydown);
+    context->output_grid_size[IB_X] = (int64_t) ceil(input_grid_size[IB_X] / context->xdown);
+    context->output_sheet_size = context->output_grid_size[IB_Y] * context->output_grid_size[IB_X];
+    context->output_row_size = context->output_grid_size[IB_X];
+
+    // the runs must give the same locations as the float division of the general path
+    context->xratio = 0;
+    if (context->xdown >= 1 && context->xdown == floorf(context->xdown)) {
+        context->xratio = (int64_t) context->xdown;
+        for (int64_t ix = 0; ix < input_grid_size[IB_X] && context->xratio; ++ix)
+            if ((int64_t) (ix / context->xdown) != ix / context->xratio) context->xratio = 0;
+    }
+    if (context->xratio) {
+        context->cell_segments.resize(context->output_sheet_size, -1);
+        context->cell_indices.resize(context->output_sheet_size, -1);
+    }
 
-    int64_t max_segment = 0;
-    for (int64_t iv = 0; iv < input_nentries; ++iv)
-        if (segmentation[iv] > max_segment) max_segment = segmentation[iv];
-    max_segment++;
+    // the window of each downsampled location reaches one voxel into its neighbors
+    float down[3] = { context->zdown, context->ydown, context->xdown };
+    for (int dim = 0; dim < 3; ++dim) {
+        context->windows[dim].resize(input_grid_size[dim]);
+        for (int64_t iw = 0; iw < context->output_grid_size[dim]; ++iw) {
+            int64_t minimum = (int64_t) (down[dim] * iw);
+            int64_t maximum = std::min((int64_t) ceil(down[dim] * (iw + 1) + 1), input_grid_size[dim]);
 
-    // create a set for each segment of downsampled locations
-    std::unordered_set<int64_t> *downsample_sets = new std::unordered_set<int64_t>[max_segment];
-    for (int64_t iv = 0; iv < max_segment; ++iv)
-        downsample_sets[iv] = std::unordered_set<int64_t>();
-
-    int64_t index = 0;
-    for (int64_t iz = 0; iz < input_grid_size[IB_Z]; ++iz) {
-        for (int64_t iy = 0; iy < input_grid_size[IB_Y]; ++iy) {
-            for (int64_t ix = 0; ix < input_grid_size[IB_X]; ++ix, ++index) {
-                int64_t segment = segmentation[index];
-                if (!segment) continue;
-
-                int64_t iw = (int64_t) (iz / zdown);
-                int64_t iv = (int64_t) (iy / ydown);
-                int64_t iu = (int64_t) (ix / xdown);
-
-                int64_t downsample_index = iw * output_sheet_size + iv * output_row_size + iu;
-                downsample_sets[segment].insert(downsample_index);
+            context->window_min[dim].push_back(minimum);
+            context->window_max[dim].push_back(maximum);
+            context->window_center[dim].push_back((maximum + minimum) / 2);
+
+            for (int64_t iv = minimum; iv < maximum; ++iv)
+                context->windows[dim][iv].push_back(iw);
+        }
+    }
+
+    context->next_slice = 0;
+
+    return context;
+}
+
+
+
+void CppDeleteDownsampleContext(DownsampleContext *context)
+{
+    delete context;
+}
+
+
+
+// whether every voxel of the run has this label (a reduction without branches that the compiler vectorizes)
+template <typename T>
+static inline bool UniformRun(const T *run, int64_t length, T label)
+{
+    T differences = 0;
+    for (int64_t ix = 0; ix < length; ++ix)
+        differences |= run[ix] ^ label;
+
+    return !differences;
+}
+
+
+
+static inline void AddToCell(DownsampleContext *context, int64_t segment, int64_t cell, int64_t downsample_index, int64_t nvoxels)
+{
+    if (segment >= (int64_t) context->downsample_sets.size()) {
+        context->downsample_sets.resize(segment + 1);
+        context->nvoxels.resize(segment + 1, 0);
+        context->representatives.resize(segment + 1);
+    }
+
+    // locations are only inserted the first time (in the same order as the general path)
+    if (context->cell_segments[cell] != segment || context->cell_indices[cell] != downsample_index) {
+        context->downsample_sets[segment].insert(downsample_index);
+        context->cell_segments[cell] = segment;
+        context->cell_indices[cell] = downsample_index;
+    }
+    context->nvoxels[segment] += nvoxels;
+}
+
+
+
+// the scan of DownsampleRow for integer ratios along x
+template <typename T>
+static void DownsampleRowRuns(DownsampleContext *context, const T *row, int64_t iw, int64_t iv)
+{
+    int64_t input_row_size = context->input_grid_size[IB_X];
+    int64_t xratio = context->xratio;
+    int64_t sheet_cell = iv * context->output_row_size;
+    int64_t row_index = iw * context->output_sheet_size + sheet_cell;
+
+    for (int64_t iu = 0, start = 0; start < input_row_size; ++iu, start += xratio) {
+        const T *run = &(row[start]);
+        int64_t length = std::min(xratio, input_row_size - start);
+
+        // most runs have a single label
+        if (UniformRun(run, length, run[0])) {
+            if (run[0]) AddToCell(context, (int64_t) run[0], sheet_cell + iu, row_index + iu, length);
+            continue;
+        }
+
+        for (int64_t ix = 0; ix < length; ++ix)
+            if (run[ix]) AddToCell(context, (int64_t) run[ix], sheet_cell + iu, row_index + iu, 1);
+    }
+}
+
+
+
+template <typename T>
+static void DownsampleRow(DownsampleContext *context, const T *row, int64_t iz, int64_t iy)
+{
+    int64_t input_row_size = context->input_grid_size[IB_X];
+    int64_t input_sheet_size = context->input_grid_size[IB_Y] * input_row_size;
+
+    // add the downsampled location of every voxel to its segment
+    int64_t iw = (int64_t) (iz / context->zdown);
+    int64_t iv = (int64_t) (iy / context->ydown);
+
+    if (context->xratio) {
+        PERF_SCOPE(PERF_DOWNSAMPLE_SCAN);
+
+        DownsampleRowRuns(context, row, iw, iv);
+    }
+    else {
+        PERF_SCOPE(PERF_DOWNSAMPLE_SCAN);
+
+        int64_t previous_segment = 0;
+        int64_t previous_index = -1;
+        for (int64_t ix = 0; ix < input_row_size; ++ix) {
+            int64_t segment = (int64_t) row[ix];
+            if (!segment) continue;
+
+            if (segment >= (int64_t) context->downsample_sets.size()) {
+                context->downsample_sets.resize(segment + 1);
+                context->nvoxels.resize(segment + 1, 0);
+                context->representatives.resize(segment + 1);
+            }
+
+            int64_t iu = (int64_t) (ix / context->xdown);
+            int64_t downsample_index = iw * context->output_sheet_size + iv * context->output_row_size + iu;
+
+            // neighboring voxels usually share their location
+            if (segment != previous_segment || downsample_index != previous_index)
+                context->downsample_sets[segment].insert(downsample_index);
+            context->nvoxels[segment]++;
+
+            previous_segment = segment;
+            previous_index = downsample_index;
+        }
+    }
+
+    {
+        PERF_SCOPE(PERF_REPRESENTATIVE_SEARCH);
+
+        // update the closest voxel to the center of every window that contains this row (rows arrive in raster
+        // order so the first of equally close voxels is kept)
+        std::vector<int64_t> &zwindows = context->windows[IB_Z][iz];
+        std::vector<int64_t> &ywindows = context->windows[IB_Y][iy];
+        for (uint64_t iwz = 0; iwz < zwindows.size(); ++iwz) {
+            int64_t wz = zwindows[iwz];
+            for (uint64_t iwy = 0; iwy < ywindows.size(); ++iwy) {
+                int64_t wy = ywindows[iwy];
+
+                int64_t zydistance = llabs(iz - context->window_center[IB_Z][wz]) + llabs(iy - context->window_center[IB_Y][wy]);
+
+                for (int64_t wx = 0; wx < context->output_grid_size[IB_X]; ++wx) {
+                    int64_t xcenter = context->window_center[IB_X][wx];
+
+                    // closest voxel of each segment within this part of the row (usually only one segment)
+                    std::vector<int64_t> &segments = context->row_segments;
+                    std::vector<Representative> &closest = context->row_closest;
+                    segments.clear();
+                    closest.clear();
+
+                    for (int64_t ix = context->window_min[IB_X][wx]; ix < context->window_max[IB_X][wx]; ++ix) {
+                        int64_t segment = (int64_t) row[ix];
+                        if (!segment) continue;
+
+                        Representative candidate;
+                        candidate.distance = zydistance + llabs(ix - xcenter);
+                        candidate.index = iz * input_sheet_size + iy * input_row_size + ix;
+
+                        uint64_t is = 0;
+                        while (is < segments.size() && segments[is] != segment) ++is;
+                        if (is == segments.size()) {
+                            segments.push_back(segment);
+                            closest.push_back(candidate);
+                        }
+                        else if (candidate.distance < closest[is].distance) closest[is] = candidate;
+                    }
+
+                    int64_t window_index = wz * context->output_sheet_size + wy * context->output_row_size + wx;
+                    for (uint64_t is = 0; is < segments.size(); ++is) {
+                        std::unordered_map<int64_t, Representative> &representatives = context->representatives[segments[is]];
+
+                        std::unordered_map<int64_t, Representative>::iterator it = representatives.find(window_index);
+                        if (it == representatives.end()) representatives[window_index] = closest[is];
+                        else if (closest[is].distance < it->second.distance) it->second = closest[is];
+                    }
+                }
             }
         }
     }
+}
+
+
+
+// returns false if the stage was cancelled (checked after every slice)
+template <typename T>
+static bool DownsampleSlab(DownsampleContext *context, const T *slab, int64_t nslices, ProgressContext *progress)
+{
+    int64_t input_row_size = context->input_grid_size[IB_X];
+    int64_t input_sheet_size = context->input_grid_size[IB_Y] * input_row_size;
+
+    for (int64_t iz = 0; iz < nslices; ++iz) {
+        for (int64_t iy = 0; iy < context->input_grid_size[IB_Y]; ++iy) {
+            DownsampleRow(context, &(slab[iz * input_sheet_size + iy * input_row_size]), context->next_slice + iz, iy);
+        }
+
+        if (CppReportProgress(progress, 0, input_sheet_size, 0)) return false;
+    }
+
+    return true;
+}
+
+
+
+int CppDownsampleSlab(DownsampleContext *context, const void *slab, int64_t bytes_per_voxel, int64_t nslices, ProgressContext *progress)
+{
+    if (context->next_slice + nslices > context->input_grid_size[IB_Z]) { fprintf(stderr, "Too many slices for %s\n", context->prefix.c_str()); return 0; }
+
+    // callers reject negative labels so signed types are read as unsigned ones of the same size (a cancelled stage
+    // leaves the context incomplete)
+    bool downsampled;
+    if (bytes_per_voxel == 1) downsampled = DownsampleSlab(context, (const uint8_t *) slab, nslices, progress);
+    else if (bytes_per_voxel == 2) downsampled = DownsampleSlab(context, (const uint16_t *) slab, nslices, progress);
+    else if (bytes_per_voxel == 4) downsampled = DownsampleSlab(context, (const uint32_t *) slab, nslices, progress);
+    else if (bytes_per_voxel == 8) downsampled = DownsampleSlab(context, (const uint64_t *) slab, nslices, progress);
+    else { fprintf(stderr, "Unsupported segmentation type for %s\n", context->prefix.c_str()); return 0; }
+    if (!downsampled) return 0;
+
+    context->next_slice += nslices;
+
+    return 1;
+}
+
+
+
+int CppFinishDownsampleMapping(DownsampleContext *context, ProgressContext *progress)
+{
+    const char *prefix = context->prefix.c_str();
+    int64_t *output_resolution = context->output_resolution;
+    int64_t *input_grid_size = context->input_grid_size;
+    int64_t *output_grid_size = context->output_grid_size;
+
+    if (context->next_slice != input_grid_size[IB_Z]) { fprintf(stderr, "Missing slices for %s\n", prefix); return 0; }
+
+    // create a set for each segment of downsampled locations
+    int64_t max_segment = std::max((int64_t) context->downsample_sets.size(), (int64_t) 1);
+    context->downsample_sets.resize(max_segment);
+    context->nvoxels.resize(max_segment, 0);
+    context->representatives.resize(max_segment);
 
     // write the downsampling information
     char downsample_filename[4096];
     sprintf(downsample_filename, "skeletons/%s/downsample-%03ldx%03ldx%03ld.bytes", prefix, output_resolution[IB_X], output_resolution[IB_Y], output_resolution[IB_Z]);
 
     // open the output file
-    FILE *dfp = fopen(downsample_filename, "wb");
-    if (!dfp) { fprintf(stderr, "Failed to write to %s\n", downsample_filename); exit(-1); }
+    FILE *dfp = CppOpenArtifact(downsample_filename, "wb");
+    if (!dfp) { fprintf(stderr, "Failed to write to %s\n", downsample_filename); return 0; }
 
     // write the upsampling information
     char upsample_filename[4096];
     sprintf(upsample_filename, "skeletons/%s/upsample-%03ldx%03ldx%03ld.bytes", prefix, output_resolution[IB_X], output_resolution[IB_Y], output_resolution[IB_Z]);
 
     // open the output file
-    FILE *ufp = fopen(upsample_filename, "wb");
-    if (!ufp) { fprintf(stderr, "Failed to write to %s\n", upsample_filename); exit(-1); }
+    FILE *ufp = CppOpenArtifact(upsample_filename, "wb");
+    if (!ufp) { fprintf(stderr, "Failed to write to %s\n", upsample_filename); CppDiscardArtifact(dfp); return 0; }
+
+    // write the manifest with the size and bounding box of every label for scheduling
+    char manifest_filename[4096];
+    sprintf(manifest_filename, "skeletons/%s/manifest-%03ldx%03ldx%03ld.bytes", prefix, output_resolution[IB_X], output_resolution[IB_Y], output_resolution[IB_Z]);
+
+    // open the output file
+    FILE *mfp = CppOpenArtifact(manifest_filename, "wb");
+    if (!mfp) { fprintf(stderr, "Failed to write to %s\n", manifest_filename); CppDiscardArtifact(dfp); CppDiscardArtifact(ufp); return 0; }
 
     // write the number of segments
     fwrite(&output_grid_size[IB_Z], sizeof(int64_t), 1, dfp);
@@ -84,13 +388,28 @@ void CppDownsampleMapping(const char *prefix, int64_t *segmentation, float input
     fwrite(&(input_grid_size[IB_X]), sizeof(int64_t), 1, ufp);
     fwrite(&max_segment, sizeof(int64_t), 1, ufp);
 
+    // the manifest has the same header as the downsampled file
+    fwrite(&output_grid_size[IB_Z], sizeof(int64_t), 1, mfp);
+    fwrite(&output_grid_size[IB_Y], sizeof(int64_t), 1, mfp);
+    fwrite(&output_grid_size[IB_X], sizeof(int64_t), 1, mfp);
+    fwrite(&max_segment, sizeof(int64_t), 1, mfp);
+
     // output values for downsampling
     for (int64_t label = 0; label < max_segment; ++label) {
         // write the size for this set
-        int64_t nelements = downsample_sets[label].size();
+        int64_t nelements = context->downsample_sets[label].size();
         fwrite(&nelements, sizeof(int64_t), 1, dfp);
         fwrite(&nelements, sizeof(int64_t), 1, ufp);
-        for (std::unordered_set<int64_t>::iterator it = downsample_sets[label].begin(); it != downsample_sets[label].end(); ++it) {
+
+        // bounding box of the downsampled locations (minimum inclusive, maximum exclusive)
+        int64_t bounding_box[6] = { 0, 0, 0, 0, 0, 0 };
+        if (nelements) {
+            bounding_box[IB_Z] = output_grid_size[IB_Z];
+            bounding_box[IB_Y] = output_grid_size[IB_Y];
+            bounding_box[IB_X] = output_grid_size[IB_X];
+        }
+
+        for (std::unordered_set<int64_t>::iterator it = context->downsample_sets[label].begin(); it != context->downsample_sets[label].end(); ++it) {
             int64_t element = *it;
             fwrite(&element, sizeof(int64_t), 1, dfp);
 
@@ -98,47 +417,87 @@ void CppDownsampleMapping(const char *prefix, int64_t *segmentation, float input
             int64_t iy = (element - iz * output_grid_size[IB_Y] * output_grid_size[IB_X]) / output_grid_size[IB_X];
             int64_t ix = element % output_grid_size[IB_X];
 
-            int64_t zmin = (int64_t) (zdown * iz);
-            int64_t ymin = (int64_t) (ydown * iy);
-            int64_t xmin = (int64_t) (xdown * ix);
+            bounding_box[IB_Z] = std::min(bounding_box[IB_Z], iz);
+            bounding_box[IB_Y] = std::min(bounding_box[IB_Y], iy);
+            bounding_box[IB_X] = std::min(bounding_box[IB_X], ix);
+            bounding_box[3 + IB_Z] = std::max(bounding_box[3 + IB_Z], iz + 1);
+            bounding_box[3 + IB_Y] = std::max(bounding_box[3 + IB_Y], iy + 1);
+            bounding_box[3 + IB_X] = std::max(bounding_box[3 + IB_X], ix + 1);
 
-            int64_t zmax = std::min((int64_t) ceil(zdown * (iz + 1) + 1), input_grid_size[IB_Z]);
-            int64_t ymax = std::min((int64_t) ceil(ydown * (iy + 1) + 1), input_grid_size[IB_Y]);
-            int64_t xmax = std::min((int64_t) ceil(xdown * (ix + 1) + 1), input_grid_size[IB_X]);
+            // the closest voxel to the center of the window was found while the slabs arrived
+            int64_t upsample_index = context->representatives[label][element].index;
 
-            double closest_to_center = input_grid_size[IB_Z] * input_grid_size[IB_Y] * input_grid_size[IB_X];
-            int64_t upsample_index = -1;
+            fwrite(&upsample_index, sizeof(int64_t), 1, ufp);
+        }
 
-            int64_t zcenter = (zmax + zmin) / 2;
-            int64_t ycenter = (ymax + ymin) / 2;
-            int64_t xcenter = (xmax + xmin) / 2;
+        // downsampled count, full resolution count, and bounding box
+        fwrite(&nelements, sizeof(int64_t), 1, mfp);
+        fwrite(&(context->nvoxels[label]), sizeof(int64_t), 1, mfp);
+        fwrite(bounding_box, sizeof(int64_t), 6, mfp);
 
-            for (int64_t iw = zmin; iw < zmax; ++iw) {
-                for (int64_t iv = ymin; iv < ymax; ++iv) {
-                    for (int64_t iu = xmin; iu < xmax; ++iu) {
-                        int64_t linear_index = iw * input_grid_size[IB_Y] * input_grid_size[IB_X] + iv * input_grid_size[IB_X] + iu;
+        // the outputs are always completed once they are opened so a cancellation is ignored here
+        CppReportProgress(progress, 1, 0, (10 + 2 * nelements) * sizeof(int64_t));
+    }
 
+    // a failed write keeps the previous outputs of a container
+    if (ferror(dfp) || ferror(ufp) || ferror(mfp)) {
+        fprintf(stderr, "Failed to write to skeletons/%s\n", prefix);
+        CppDiscardArtifact(dfp);
+        CppDiscardArtifact(ufp);
+        CppDiscardArtifact(mfp);
+        return 0;
+    }
 
-                        // find the closest point to the center
-                        if (segmentation[linear_index] != label) continue;
+    // close the file
+    if (fclose(dfp)) { fprintf(stderr, "Failed to write to %s\n", downsample_filename); CppDiscardArtifact(ufp); CppDiscardArtifact(mfp); return 0; }
+    if (fclose(ufp)) { fprintf(stderr, "Failed to write to %s\n", upsample_filename); CppDiscardArtifact(mfp); return 0; }
+    if (fclose(mfp)) { fprintf(stderr, "Failed to write to %s\n", manifest_filename); return 0; }
 
-                        double distance = abs(iw - zcenter) + abs(iv - ycenter) + abs(iu - xcenter);
-                        if (distance < closest_to_center) {
-                            closest_to_center = distance;
-                            upsample_index = linear_index;
-                        }
-                    }
-                }
-            }
+    return 1;
+}
 
-            fwrite(&upsample_index, sizeof(int64_t), 1, ufp);
-        }
+
+
+int CppDownsampleSlabs(DownsampleContext **contexts, int64_t ncontexts, const void *slab, int64_t bytes_per_voxel, int64_t nslices, ProgressContext *progress)
+{
+    // every output resolution downsamples the same slab on its own thread
+    std::vector<int> downsampled = std::vector<int>(ncontexts, 0);
+    std::vector<std::thread> threads;
+    for (int64_t ic = 1; ic < ncontexts; ++ic)
+        threads.push_back(std::thread([&, ic]() { downsampled[ic] = CppDownsampleSlab(contexts[ic], slab, bytes_per_voxel, nslices, progress); }));
+    if (ncontexts) downsampled[0] = CppDownsampleSlab(contexts[0], slab, bytes_per_voxel, nslices, progress);
+
+    for (uint64_t it = 0; it < threads.size(); ++it)
+        threads[it].join();
+
+    for (int64_t ic = 0; ic < ncontexts; ++ic)
+        if (!downsampled[ic]) return 0;
+
+    return 1;
+}
+
+
+
+int CppDownsampleMapping(const char *prefix, int64_t *segmentation, float input_resolution[3], int64_t *output_resolutions, int64_t noutput_resolutions, int64_t input_grid_size[3], ProgressContext *progress)
+{
+    // the whole volume is a single slab that is scanned once for all output resolutions
+    std::vector<DownsampleContext *> contexts = std::vector<DownsampleContext *>(noutput_resolutions);
+    for (int64_t ir = 0; ir < noutput_resolutions; ++ir)
+        contexts[ir] = CppNewDownsampleContext(prefix, input_resolution, &(output_resolutions[3 * ir]), input_grid_size);
+
+    // every output resolution scans every voxel and the number of labels is only known at the end
+    CppStartProgress(progress, "downsampling", 0, noutput_resolutions * input_grid_size[IB_Z] * input_grid_size[IB_Y] * input_grid_size[IB_X]);
+
+    // a cancelled scan writes nothing so the previous outputs stay as they were
+    bool downsampled = CppDownsampleSlabs(contexts.data(), noutput_resolutions, segmentation, sizeof(int64_t), input_grid_size[IB_Z], progress);
+    bool failed = !downsampled && !CppProgressCancelled(progress);
+
+    for (int64_t ir = 0; ir < noutput_resolutions; ++ir) {
+        if (downsampled && !failed && !CppFinishDownsampleMapping(contexts[ir], progress)) failed = true;
+        CppDeleteDownsampleContext(contexts[ir]);
     }
 
-    // close the file
-    fclose(dfp);
-    fclose(ufp);
+    CppFinishProgress(progress);
 
-    // free memory
-    delete[] downsample_sets;
+    return !failed;
 }
@@ -1 +1,21 @@
-void CppDownsampleMapping(const char *prefix, int64_t *segmentation, float input_resolution[3], int64_t output_resolution[3], int64_t input_grid_size[3]);
+#include <inttypes.h>
+#include "../skeletonization/cpp-progress.h"
+
+
+
+// downsample a segmentation that arrives as consecutive z slabs of any unsigned or non-negative integer type (the
+// slab calls return 0 on errors and when the callback of progress cancels the stage, see CppProgressCancelled, and
+// finishing returns 0 on errors; progress can be NULL)
+struct DownsampleContext;
+
+DownsampleContext *CppNewDownsampleContext(const char *prefix, float input_resolution[3], int64_t output_resolution[3], int64_t input_grid_size[3]);
+int CppDownsampleSlab(DownsampleContext *context, const void *slab, int64_t bytes_per_voxel, int64_t nslices, ProgressContext *progress);
+int CppFinishDownsampleMapping(DownsampleContext *context, ProgressContext *progress);
+void CppDeleteDownsampleContext(DownsampleContext *context);
+
+// downsample the same slab to several output resolutions at once
+int CppDownsampleSlabs(DownsampleContext **contexts, int64_t ncontexts, const void *slab, int64_t bytes_per_voxel, int64_t nslices, ProgressContext *progress);
+
+// output_resolutions has noutput_resolutions resolutions of three values each (returns 0 on errors but not when
+// cancelled)
+int CppDownsampleMapping(const char *prefix, int64_t *segmentation, float input_resolution[3], int64_t *output_resolutions, int64_t noutput_resolutions, int64_t input_grid_size[3], ProgressContext *progress);
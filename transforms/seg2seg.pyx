@@ -1,12 +1,15 @@
 cimport cython
 cimport numpy as np
 from libc.stdint cimport int64_t
+from libc.stdlib cimport malloc, free
 
 
 
 import os
 import time
+import queue
 import ctypes
+import threading
 from libcpp cimport bool
 import numpy as np
 
@@ -16,34 +19,196 @@ from topological_thinning.utilities import dataIO
 
 
 
-cdef extern from 'cpp-seg2seg.h':
-    void CppDownsampleMapping(const char *prefix, int64_t *segmentation, float input_resolution[3], int64_t output_resolution[3], int64_t input_grid_size[3])
-
-
-
-
-def DownsampleMapping(prefix, segmentation, output_resolution=(80, 80, 80)):
-    # everything needs to be long ints to work with c++
-    assert (segmentation.dtype == np.int64)
-
+cdef extern from '../skeletonization/cpp-perf.h' nogil:
+    void CppPrintPerfCounters(const char *stage)
+
+cdef extern from '../skeletonization/cpp-storage.h' nogil:
+    bool CppCreateContainer(const char *prefix)
+    bool CppCreateDirectory(const char *prefix)
+
+cdef extern from '../skeletonization/cpp-progress.h' nogil:
+    ctypedef struct StageProgress:
+        const char *stage
+        int64_t labels
+        int64_t nlabels
+        int64_t voxels
+        int64_t nvoxels
+        int64_t bytes
+        double seconds
+        double voxels_per_second
+        double bytes_per_second
+    ctypedef bool (*ProgressCallback)(const StageProgress *progress, void *data) noexcept
+    cdef struct ProgressContext
+    ProgressContext *CppNewProgressContext(ProgressCallback callback, void *data, double interval)
+    void CppDeleteProgressContext(ProgressContext *progress)
+    void CppStartProgress(ProgressContext *progress, const char *stage, int64_t nlabels, int64_t nvoxels)
+    bool CppProgressCancelled(ProgressContext *progress)
+    bool CppFinishProgress(ProgressContext *progress)
+
+cdef extern from 'cpp-seg2seg.h' nogil:
+    cdef struct DownsampleContext
+    DownsampleContext *CppNewDownsampleContext(const char *prefix, float input_resolution[3], int64_t output_resolution[3], int64_t input_grid_size[3])
+    int CppDownsampleSlab(DownsampleContext *context, const void *slab, int64_t bytes_per_voxel, int64_t nslices, ProgressContext *progress)
+    int CppDownsampleSlabs(DownsampleContext **contexts, int64_t ncontexts, const void *slab, int64_t bytes_per_voxel, int64_t nslices, ProgressContext *progress)
+    int CppFinishDownsampleMapping(DownsampleContext *context, ProgressContext *progress)
+    void CppDeleteDownsampleContext(DownsampleContext *context)
+
+
+
+include '../skeletonization/progress.pxi'
+
+
+
+# read the next slab in the background while the current one is downsampled (closing the generator early stops the
+# reader and closes the slab iterator)
+def PrefetchSlabs(slabs):
+    prefetched = queue.Queue(maxsize=1)
+    stopped = threading.Event()
+
+    # returns False once the consumer stopped
+    def Put(item):
+        while not stopped.is_set():
+            try:
+                prefetched.put(item, timeout=0.1)
+                return True
+            except queue.Full:
+                pass
+        return False
+
+    def ReadSlabs():
+        try:
+            for slab in slabs:
+                if not Put(slab): return
+            Put(None)
+        except Exception as exception:
+            Put(exception)
+        finally:
+            # closes the h5 file of a generator that stopped early
+            if hasattr(slabs, 'close'): slabs.close()
+
+    reader = threading.Thread(target=ReadSlabs)
+    reader.daemon = True
+    reader.start()
+
+    try:
+        while True:
+            slab = prefetched.get()
+            if slab is None: break
+            if isinstance(slab, Exception): raise slab
+            yield slab
+    finally:
+        stopped.set()
+        while True:
+            try: prefetched.get_nowait()
+            except queue.Empty: break
+        reader.join()
+
+
+
+# the segmentation is either a volume or an iterator over its consecutive z slabs (dataIO.ReadSegmentationSlabs)
+# of any integer type so that the entire volume never needs to be in memory (negative labels raise a ValueError);
+# output_resolution is one resolution or a list of them that are all produced from a single pass over the
+# segmentation; with container every output of this dataset from here on is written into the single file
+# skeletons/{prefix}.container instead of skeletons/{prefix}/ (without container a dataset that has a container fails
+# rather than writing into it);
+# progress is called with the scanned voxels and written labels and bytes every progress_interval seconds and
+# cancels the stage by returning True (nothing is written when the scan is cancelled)
+def DownsampleMapping(prefix, segmentation, output_resolution=(80, 80, 80), container=False, progress=None, progress_interval=1.0):
     if not os.path.isdir('skeletons'): os.mkdir('skeletons')
-    if not os.path.isdir('skeletons/{}'.format(prefix)): os.mkdir('skeletons/{}'.format(prefix))
+    if container: assert (CppCreateContainer(prefix.encode('utf-8')))
+    else: assert (CppCreateDirectory(prefix.encode('utf-8')))
 
     start_time = time.time()
 
+    if isinstance(segmentation, np.ndarray):
+        input_grid_size = segmentation.shape
+        slabs = [segmentation]
+    else:
+        input_grid_size = dataIO.GridSize(prefix)
+        slabs = PrefetchSlabs(segmentation)
+
     # convert numpy arrays to c++ format
-    cdef np.ndarray[int64_t, ndim=3, mode='c'] cpp_segmentation = np.ascontiguousarray(segmentation, dtype=ctypes.c_int64)
     cdef np.ndarray[float, ndim=1, mode='c'] cpp_input_resolution = np.ascontiguousarray(dataIO.Resolution(prefix), dtype=ctypes.c_float)
-    cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_output_resolution = np.ascontiguousarray(output_resolution, dtype=ctypes.c_int64)
-    cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_input_grid_size = np.ascontiguousarray(segmentation.shape, dtype=ctypes.c_int64)
-
-    # call c++ function
-    CppDownsampleMapping(prefix.encode('utf-8'), &(cpp_segmentation[0,0,0]), &(cpp_input_resolution[0]), &(cpp_output_resolution[0]), &(cpp_input_grid_size[0]))
+    cdef np.ndarray[int64_t, ndim=2, mode='c'] cpp_output_resolutions = np.ascontiguousarray(np.reshape(output_resolution, (-1, 3)), dtype=ctypes.c_int64)
+    cdef np.ndarray[int64_t, ndim=1, mode='c'] cpp_input_grid_size = np.ascontiguousarray(input_grid_size, dtype=ctypes.c_int64)
+
+    # keep the encoded prefix alive while the gil is released
+    cpp_prefix = prefix.encode('utf-8')
+    cdef const char *prefix_ptr = cpp_prefix
+    cdef float *input_resolution_ptr = &(cpp_input_resolution[0])
+    cdef int64_t *input_grid_size_ptr = &(cpp_input_grid_size[0])
+
+    # one context per output resolution
+    cdef int64_t ncontexts = cpp_output_resolutions.shape[0]
+    cdef int64_t ic
+    cdef DownsampleContext **contexts = <DownsampleContext **> malloc(ncontexts * sizeof(DownsampleContext *))
+    for ic in range(ncontexts):
+        contexts[ic] = CppNewDownsampleContext(prefix_ptr, input_resolution_ptr, &(cpp_output_resolutions[ic,0]), input_grid_size_ptr)
+
+    cdef np.ndarray cpp_slab
+    cdef const void *slab_ptr
+    cdef int64_t bytes_per_voxel
+    cdef int64_t nslices
+    cdef int downsampled
+    cdef int finished
+    cdef bool cancelled = False
+
+    # every output resolution scans every voxel and the number of labels is only known at the end (the callback of
+    # this call only lives as long as the call)
+    cdef ProgressReporter reporter = None
+    cdef ProgressContext *progress_context = NULL
+    if progress is not None:
+        reporter = ProgressReporter(progress)
+        progress_context = CppNewProgressContext(ReportProgress, <void *> reporter, progress_interval)
+    CppStartProgress(progress_context, 'downsampling', 0, ncontexts * np.prod(input_grid_size))
+
+    try:
+        for slab in slabs:
+            # slabs keep their own integer type (contiguous slabs are not copied)
+            assert (np.issubdtype(slab.dtype, np.integer))
+            # signed slabs are read as unsigned so a negative label would become a huge one
+            if np.issubdtype(slab.dtype, np.signedinteger) and slab.size and slab.min() < 0:
+                raise ValueError('{} has negative labels'.format(prefix))
+            assert (slab.shape[1] == input_grid_size[1] and slab.shape[2] == input_grid_size[2])
+            cpp_slab = np.ascontiguousarray(slab)
+            slab_ptr = np.PyArray_DATA(cpp_slab)
+            bytes_per_voxel = cpp_slab.itemsize
+            nslices = cpp_slab.shape[0]
+
+            # the next slab is read while the gil is released
+            with nogil:
+                downsampled = CppDownsampleSlabs(contexts, ncontexts, slab_ptr, bytes_per_voxel, nslices, progress_context)
+            cancelled = CppProgressCancelled(progress_context)
+            if cancelled: break
+            assert (downsampled)
+
+        # call c++ function
+        for ic in range(ncontexts):
+            if cancelled: break
+            with nogil:
+                finished = CppFinishDownsampleMapping(contexts[ic], progress_context)
+            assert (finished)
+
+        with nogil:
+            CppFinishProgress(progress_context)
+    finally:
+        # stop the reader of a scan that ended early
+        if not isinstance(slabs, list): slabs.close()
+
+        # free memory (also when a slab is rejected)
+        CppDeleteProgressContext(progress_context)
+        for ic in range(ncontexts):
+            CppDeleteDownsampleContext(contexts[ic])
+        free(contexts)
+
+    RaiseProgressException(reporter)
+
+    # only prints when compiled with PERF_COUNTERS
+    CppPrintPerfCounters('downsampling')
 
-    # free memory
-    del cpp_segmentation
     del cpp_input_resolution
-    del cpp_output_resolution
+    del cpp_output_resolutions
     del cpp_input_grid_size
 
-    print ('Downsampled {} to resolution {} in {:0.2f} seconds.'.format(prefix, output_resolution, time.time() - start_time))
+    if cancelled: print ('Cancelled downsampling of {} after {:0.2f} seconds.'.format(prefix, time.time() - start_time))
+    else: print ('Downsampled {} to resolution {} in {:0.2f} seconds.'.format(prefix, output_resolution, time.time() - start_time))
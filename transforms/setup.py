@@ -1,3 +1,4 @@
+import os
 from distutils.core import setup, Extension
 from Cython.Build import cythonize
 import numpy as np
@@ -6,8 +7,11 @@ extensions = [
     Extension(
         name='seg2seg',
         include_dirs=[np.get_include()],
-        sources=['seg2seg.pyx', 'cpp-seg2seg.cpp'],
-        extra_compile_args=['-O4', '-std=c++11'],
+        sources=['seg2seg.pyx', 'cpp-seg2seg.cpp', '../skeletonization/cpp-progress.cpp', '../skeletonization/cpp-storage.cpp'],
+        # PERF_COUNTERS=1 python setup.py build_ext --inplace prints hardware counters of the hot loops
+        define_macros=[('PERF_COUNTERS', None)] if os.environ.get('PERF_COUNTERS') else [],
+        extra_compile_args=['-O4', '-std=c++11', '-pthread'],
+        extra_link_args=['-pthread'],
         language='c++'
     )
 ]
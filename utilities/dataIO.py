@@ -1,5 +1,7 @@
+import io
 import h5py
 import struct
+import fractions
 
 
 
@@ -8,10 +10,31 @@ import numpy as np
 
 
 from topological_thinning.data_structures import skeleton_points, meta_data
+from topological_thinning.skeletonization import storage
 from topological_thinning.utilities.constants import *
 
 
 
+# the outputs of a dataset are the files in skeletons/{prefix}/ or, once it exists, the entries of the single file
+# skeletons/{prefix}.container (skeletonization/cpp-storage.h describes the layout and reads and writes both)
+def OpenArtifact(filename):
+    # open an output of a dataset for reading
+    return io.BytesIO(storage.ReadArtifact(filename))
+
+
+
+def WriteArtifact(filename, data):
+    # write (or replace) an output of a dataset
+    storage.WriteArtifact(filename, data)
+
+
+
+def GlobArtifacts(pattern):
+    # return the outputs of a dataset that match the pattern in sorted order
+    return storage.GlobArtifacts(pattern)
+
+
+
 def GridSize(prefix):
     # return the size of this dataset
     return meta_data.MetaData(prefix).GridSize()
@@ -24,12 +47,15 @@ def ReadMetaData(prefix):
 
 
 
-def ReadH5File(filename, dataset=None):
+def ReadH5File(filename, dataset=None, bounds=None):
     # read the h5py file
     with h5py.File(filename, 'r') as hf:
         # read the first dataset if none given
-        if dataset == None: data = np.array(hf[hf.keys()[0]])
-        else: data = np.array(hf[dataset])
+        if dataset == None: dataset = list(hf.keys())[0]
+
+        # read only the voxels within the bounds (zmin, ymin, xmin, zmax, ymax, xmax) if given
+        if bounds == None: data = np.array(hf[dataset])
+        else: data = np.array(hf[dataset][bounds[0]:bounds[3],bounds[1]:bounds[4],bounds[2]:bounds[5]])
 
         return data.astype(np.int64)
 
@@ -42,19 +68,190 @@ def Resolution(prefix):
 
 
 def ReadSegmentationData(prefix):
-    filename, dataset = meta_data.MetaData(prefix).SegmentationFilename()
+    meta = meta_data.MetaData(prefix)
+    filename, dataset = meta.SegmentationFilename()
+
+    # blocks only read their own voxels from the segmentation of the larger dataset
+    if not meta.BlockOrigin() == None:
+        origin = meta.BlockOrigin()
+        grid_size = meta.GridSize()
+        return ReadH5File(filename, dataset, (origin[IB_Z], origin[IB_Y], origin[IB_X], origin[IB_Z] + grid_size[IB_Z], origin[IB_Y] + grid_size[IB_Y], origin[IB_X] + grid_size[IB_X]))
 
     return ReadH5File(filename, dataset)
 
 
 
-def ReadSkeletons(prefix, skeleton_algorithm='thinning', downsample_resolution=(80, 80, 80)):
-    # read in all of the skeleton points
-    skeleton_filename = 'skeletons/{}/{}-{:03d}x{:03d}x{:03d}-upsample-skeleton.pts'.format(prefix, skeleton_algorithm, downsample_resolution[IB_X], downsample_resolution[IB_Y], downsample_resolution[IB_Z])
-    endpoint_filename = 'skeletons/{}/{}-{:03d}x{:03d}x{:03d}-endpoint-vectors.vec'.format(prefix, skeleton_algorithm, downsample_resolution[IB_X], downsample_resolution[IB_Y], downsample_resolution[IB_Z])
+def ReadSegmentationSlabs(prefix):
+    # yield consecutive z slabs of the segmentation in its own type (one h5 chunk deep) without reading the full volume
+    meta = meta_data.MetaData(prefix)
+    filename, dataset = meta.SegmentationFilename()
+    grid_size = meta.GridSize()
+
+    # blocks only read their own voxels
+    origin = meta.BlockOrigin()
+    if origin == None: origin = (0, 0, 0)
+
+    with h5py.File(filename, 'r') as hf:
+        data = hf[dataset]
+
+        if data.chunks == None: depth = 1
+        else: depth = data.chunks[IB_Z]
+
+        for iz in range(0, grid_size[IB_Z], depth):
+            zmax = min(iz + depth, grid_size[IB_Z])
+            yield data[origin[IB_Z] + iz:origin[IB_Z] + zmax,origin[IB_Y]:origin[IB_Y] + grid_size[IB_Y],origin[IB_X]:origin[IB_X] + grid_size[IB_X]]
+
+
+
+def DownsamplePeriod(prefix, skeleton_resolution=(80, 80, 80)):
+    # return the number of voxels in each dimension (z, y, x) after which the downsampled grid starts on a voxel again,
+    # so that a block that starts at a multiple of it downsamples exactly like the same voxels of the entire volume
+    resolution = Resolution(prefix)
+
+    return tuple((fractions.Fraction(skeleton_resolution[dim]) / fractions.Fraction(resolution[dim]).limit_denominator(1000)).numerator for dim in range(3))
+
+
+
+def BlockSize(prefix, block_size, skeleton_resolution=(80, 80, 80)):
+    # return the block size rounded up to whole downsample periods in each dimension (z, y, x)
+    period = DownsamplePeriod(prefix, skeleton_resolution)
+
+    return tuple((block_size[dim] + period[dim] - 1) // period[dim] * period[dim] for dim in range(3))
+
+
+
+def NumberOfBlocks(prefix, block_size, skeleton_resolution=(80, 80, 80)):
+    # return the number of blocks in each dimension (z, y, x)
+    grid_size = GridSize(prefix)
+    block_size = BlockSize(prefix, block_size, skeleton_resolution)
+
+    return tuple((grid_size[dim] + block_size[dim] - 1) // block_size[dim] for dim in range(3))
+
+
+
+def BlockPrefix(prefix, block_index):
+    # blocks are datasets of their own with the block index in x, y, z order
+    return '{}-block-{:04d}x{:04d}x{:04d}'.format(prefix, block_index[IB_X], block_index[IB_Y], block_index[IB_Z])
+
+
+
+def WriteBlockMetaData(prefix, block_index, block_size, halo, skeleton_resolution=(80, 80, 80)):
+    # each block owns block_size voxels (its core) and also reads at least halo voxels of its neighbors on every side;
+    # cores, origins and ends are whole downsample periods so that every block has the downsampled grid of the volume
+    meta = meta_data.MetaData(prefix)
+    grid_size = meta.GridSize()
+    resolution = meta.Resolution()
+    period = DownsamplePeriod(prefix, skeleton_resolution)
+    block_size = BlockSize(prefix, block_size, skeleton_resolution)
+
+    core = [0, 0, 0, 0, 0, 0]
+    origin = [0, 0, 0]
+    block_grid_size = [0, 0, 0]
+    for dim in range(3):
+        core[dim] = block_index[dim] * block_size[dim]
+        core[3 + dim] = min(core[dim] + block_size[dim], grid_size[dim])
+        origin[dim] = max(core[dim] - halo[dim], 0) // period[dim] * period[dim]
+        block_grid_size[dim] = min((core[3 + dim] + halo[dim] + period[dim] - 1) // period[dim] * period[dim], grid_size[dim]) - origin[dim]
+
+    block_prefix = BlockPrefix(prefix, block_index)
+    with open('meta/{}.meta'.format(block_prefix), 'w') as fd:
+        fd.write('# resolution in nm\n')
+        fd.write('{:g}x{:g}x{:g}\n'.format(resolution[IB_X], resolution[IB_Y], resolution[IB_Z]))
+        fd.write('# segmentation filename\n')
+        fd.write('{}\n'.format(meta.segmentation_filename))
+        fd.write('# grid size\n')
+        fd.write('{}x{}x{}\n'.format(block_grid_size[IB_X], block_grid_size[IB_Y], block_grid_size[IB_Z]))
+        fd.write('# block origin\n')
+        fd.write('{}x{}x{}\n'.format(origin[IB_X], origin[IB_Y], origin[IB_Z]))
+        fd.write('# block core\n')
+        fd.write('{}x{}x{} {}x{}x{}\n'.format(core[IB_X], core[IB_Y], core[IB_Z], core[3 + IB_X], core[3 + IB_Y], core[3 + IB_Z]))
+
+    return block_prefix
+
+
+
+def WriteBlockLabels(prefix, labels):
+    # write the global label of every block label (block labels are consecutive to bound memory by the block size)
+    labels_filename = 'skeletons/{}/labels.bytes'.format(prefix)
+
+    WriteArtifact(labels_filename, struct.pack('q', labels.size) + np.ascontiguousarray(labels, dtype=np.int64).tobytes())
+
+
+
+def ReadLabelManifest(prefix, downsample_resolution=(80, 80, 80)):
+    # read the number of voxels and the downsampled bounding box (zmin, ymin, xmin, zmax, ymax, xmax) of every label
+    manifest_filename = 'skeletons/{}/manifest-{:03d}x{:03d}x{:03d}.bytes'.format(prefix, downsample_resolution[IB_X], downsample_resolution[IB_Y], downsample_resolution[IB_Z])
+
+    with OpenArtifact(manifest_filename) as fd:
+        zres, yres, xres, max_label, = struct.unpack('qqqq', fd.read(32))
+
+        manifest_dtype = [('downsample_voxels', np.int64), ('voxels', np.int64), ('bounding_box', np.int64, 6)]
+        return np.frombuffer(fd.read(64 * max_label), dtype=manifest_dtype)
+
+
+
+def ReadAdaptiveResolutions(prefix, skeleton_algorithm='thinning'):
+    # read the resolution (z, y, x) that every label was skeletonized at
+    resolutions_filename = 'skeletons/{}/{}-adaptive-resolutions.bytes'.format(prefix, skeleton_algorithm)
+
+    with OpenArtifact(resolutions_filename) as fd:
+        zres, yres, xres, max_label, = struct.unpack('qqqq', fd.read(32))
+
+        return np.frombuffer(fd.read(24 * max_label), dtype=np.int64).reshape(max_label, 3)
+
+
+
+def ReadThinningConvergence(prefix, skeleton_algorithm='thinning', downsample_resolution=(80, 80, 80)):
+    # read whether every label converged within the thinning budget and the number of iterations it took
+    convergence_filename = 'skeletons/{}/{}-{:03d}x{:03d}x{:03d}-convergence.bytes'.format(prefix, skeleton_algorithm, downsample_resolution[IB_X], downsample_resolution[IB_Y], downsample_resolution[IB_Z])
+
+    with OpenArtifact(convergence_filename) as fd:
+        zres, yres, xres, max_label, = struct.unpack('qqqq', fd.read(32))
+
+        convergence = np.frombuffer(fd.read(16 * max_label), dtype=np.int64).reshape(max_label, 2)
+
+        return convergence[:,0].astype(bool), convergence[:,1]
+
+
+
+# one record per label written by TopologicalThinning with statistics (ThinningStatistics in cpp-generate_skeletons.h);
+# the bounding box is zmin, ymin, xmin, zmax, ymax, xmax and the deletions are per thinning direction
+THINNING_STATISTICS_DTYPE = np.dtype([
+    ('label', np.int64),
+    ('voxels', np.int64),
+    ('bounding_box', np.int64, 6),
+    ('iterations', np.int64),
+    ('deleted', np.int64, 6),
+    ('isthmuses', np.int64),
+    ('skeleton_size', np.int64),
+    ('detect_seconds', np.float64),
+    ('delete_seconds', np.float64),
+])
+
+
+
+def ReadThinningStatistics(prefix, skeleton_algorithm='thinning', downsample_resolution=(80, 80, 80)):
+    # read the work done on every label as a numpy record array
+    statistics_filename = 'skeletons/{}/{}-{:03d}x{:03d}x{:03d}-statistics.bytes'.format(prefix, skeleton_algorithm, downsample_resolution[IB_X], downsample_resolution[IB_Y], downsample_resolution[IB_Z])
+
+    with OpenArtifact(statistics_filename) as fd:
+        zres, yres, xres, max_label, = struct.unpack('qqqq', fd.read(32))
+
+        return np.frombuffer(fd.read(THINNING_STATISTICS_DTYPE.itemsize * max_label), dtype=THINNING_STATISTICS_DTYPE).view(np.recarray)
+
+
+
+def ReadSkeletons(prefix, skeleton_algorithm='thinning', downsample_resolution=(80, 80, 80), dense=False, adaptive=False):
+    # read in all of the skeleton points (dense skeletons have joints connected at full resolution and adaptive
+    # skeletons have a resolution per label)
+    if adaptive: skeleton_filename = 'skeletons/{}/{}-adaptive-upsample-skeleton.pts'.format(prefix, skeleton_algorithm)
+    elif dense: skeleton_filename = 'skeletons/{}/{}-{:03d}x{:03d}x{:03d}-dense-skeleton.pts'.format(prefix, skeleton_algorithm, downsample_resolution[IB_X], downsample_resolution[IB_Y], downsample_resolution[IB_Z])
+    else: skeleton_filename = 'skeletons/{}/{}-{:03d}x{:03d}x{:03d}-upsample-skeleton.pts'.format(prefix, skeleton_algorithm, downsample_resolution[IB_X], downsample_resolution[IB_Y], downsample_resolution[IB_Z])
+    if adaptive: endpoint_filename = 'skeletons/{}/{}-adaptive-endpoint-vectors.vec'.format(prefix, skeleton_algorithm)
+    else: endpoint_filename = 'skeletons/{}/{}-{:03d}x{:03d}x{:03d}-endpoint-vectors.vec'.format(prefix, skeleton_algorithm, downsample_resolution[IB_X], downsample_resolution[IB_Y], downsample_resolution[IB_Z])
 
     # read the joints file and the vector file
-    with open(skeleton_filename, 'rb') as sfd, open(endpoint_filename, 'rb') as efd:
+    with OpenArtifact(skeleton_filename) as sfd, OpenArtifact(endpoint_filename) as efd:
         skel_zres, skel_yres, skel_xres, skel_max_label, = struct.unpack('qqqq', sfd.read(32))
         end_zres, end_yres, end_xres, end_max_label, = struct.unpack('qqqq', efd.read(32))
         assert (skel_zres == end_zres and skel_yres == end_yres and skel_xres == end_xres and skel_max_label == end_max_label)
@@ -0,0 +1,120 @@
+import socket
+import struct
+
+
+
+import numpy as np
+
+
+
+from topological_thinning.data_structures import skeleton_points
+from topological_thinning.utilities import dataIO
+
+
+
+# operations of the skeleton service (skeletonization/cpp-service.cpp)
+SERVICE_SKELETONS = 0
+SERVICE_VECTORS = 1
+SERVICE_RETHIN = 2
+SERVICE_SHUTDOWN = 3
+
+
+
+class SkeletonClient:
+    # connect to a service started with generate_skeletons.RunSkeletonService (the connection is kept for every request)
+    def __init__(self, socket_path='skeletons/service.sock'):
+        self.socket_path = socket_path
+        self.connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.connection.connect(socket_path)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.Close()
+
+    def Close(self):
+        self.connection.close()
+
+    def Receive(self, nbytes):
+        chunks = []
+        while nbytes > 0:
+            chunk = self.connection.recv(min(nbytes, 1 << 20))
+            if not chunk: raise IOError('Skeleton service on {} closed the connection'.format(self.socket_path))
+            chunks.append(chunk)
+            nbytes -= len(chunk)
+
+        return b''.join(chunks)
+
+    def Request(self, operation, prefix='', labels=(), skeleton_resolution=(80, 80, 80)):
+        cpp_prefix = prefix.encode('utf-8')
+        labels = np.ascontiguousarray(labels, dtype=np.int64)
+
+        request = struct.pack('qq', operation, len(cpp_prefix)) + cpp_prefix
+        request += struct.pack('qqqq', skeleton_resolution[0], skeleton_resolution[1], skeleton_resolution[2], labels.size)
+        self.connection.sendall(request + labels.tobytes())
+
+        status, = struct.unpack('q', self.Receive(8))
+        if status: raise IOError('Skeleton service on {} failed to answer for {}'.format(self.socket_path, prefix))
+
+    # read the skeletons (or only the endpoints and vectors) of every label in the answer
+    def ReceiveSkeletons(self, include_skeleton):
+        answers = []
+
+        nlabels, = struct.unpack('q', self.Receive(8))
+        for _ in range(nlabels):
+            label, = struct.unpack('q', self.Receive(8))
+
+            skeleton = None
+            if include_skeleton:
+                nelements, = struct.unpack('q', self.Receive(8))
+                skeleton = np.frombuffer(self.Receive(8 * nelements), dtype=np.int64)
+
+            nendpoints, = struct.unpack('q', self.Receive(8))
+            endpoint_vectors = np.frombuffer(self.Receive(32 * nendpoints), dtype=[('endpoint', np.int64), ('vector', np.float64, 3)])
+
+            answers.append((label, skeleton, endpoint_vectors))
+
+        return answers
+
+    def CreateSkeletons(self, prefix, answers):
+        skeletons = []
+        resolution = dataIO.Resolution(prefix)
+        grid_size = dataIO.GridSize(prefix)
+
+        for label, skeleton, endpoint_vectors in answers:
+            joints = [int(index) for index in skeleton if index >= 0]
+            endpoints = [-1 * int(index) for index in skeleton if index < 0]
+            vectors = {}
+            for endpoint, vector in endpoint_vectors:
+                vectors[int(endpoint)] = tuple(vector)
+
+            skeletons.append(skeleton_points.Skeleton(label, joints, endpoints, vectors, resolution, grid_size))
+
+        return skeletons
+
+    # upsampled skeletons of these labels (thinned by the service on the first request)
+    def Skeletons(self, prefix, labels, skeleton_resolution=(80, 80, 80)):
+        self.Request(SERVICE_SKELETONS, prefix, labels, skeleton_resolution)
+
+        return self.CreateSkeletons(prefix, self.ReceiveSkeletons(True))
+
+    # dictionary from every label to a dictionary of its upsampled endpoints and their (z, y, x) vectors
+    def EndpointVectors(self, prefix, labels, skeleton_resolution=(80, 80, 80)):
+        self.Request(SERVICE_VECTORS, prefix, labels, skeleton_resolution)
+
+        endpoint_vectors = {}
+        for label, _, vectors in self.ReceiveSkeletons(False):
+            endpoint_vectors[label] = dict((int(endpoint), tuple(vector)) for endpoint, vector in vectors)
+
+        return endpoint_vectors
+
+    # reread the downsampled labels after DownsampleMapping of an edited segmentation and return the skeletons of
+    # these labels (the service only thins labels whose downsampled voxels changed)
+    def Rethin(self, prefix, labels, skeleton_resolution=(80, 80, 80)):
+        self.Request(SERVICE_RETHIN, prefix, labels, skeleton_resolution)
+
+        return self.CreateSkeletons(prefix, self.ReceiveSkeletons(True))
+
+    def Shutdown(self):
+        self.Request(SERVICE_SHUTDOWN)